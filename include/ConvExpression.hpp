@@ -0,0 +1,108 @@
+#ifndef __CONV_EXPRESSION__HPP_
+#define __CONV_EXPRESSION__HPP_
+
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * The header file for the lazy convolution expression ConvExpr.
+ */
+#include <vector>
+#include <memory>
+using namespace std;
+
+/** Lazy expression over Convolution2D results.
+ *  Building an expression only records the graph; evaluate() rewrites
+ *  it using linearity (filters of one image are summed, scalars are
+ *  folded into filters) and associativity (cascaded filters are
+ *  combined when the combined kernel is cheaper), then runs the
+ *  remaining passes with Convolution2D::autoConvolve().
+ */
+class ConvExpr {
+public:
+    enum NodeType { IMAGE, CONV, ADD, SCALE };
+
+private:
+    /** Graph node. Children are shared so sub-expressions can be reused */
+    struct Node {
+        NodeType type;
+        vector<vector<float>> data; /** image for IMAGE, filter for CONV */
+        float scale; /** factor for SCALE */
+        shared_ptr<const Node> lhs; /** operand, or left operand of ADD */
+        shared_ptr<const Node> rhs; /** right operand of ADD */
+    };
+
+    /** One product of the expanded expression:
+     *  scale * conv(...conv(leaf, chain[0])..., chain[m-1])
+     */
+    struct Term {
+        const Node* leaf;
+        vector<const vector<vector<float>>*> chain;
+        float scale;
+    };
+
+    shared_ptr<const Node> mNode;
+
+    explicit ConvExpr(shared_ptr<const Node> node) : mNode(node) {}
+
+    /** Distribute convolutions and scalars over sums
+     * @param const Node* node sub-expression to expand
+     * @param float scale product of enclosing scalars
+     * @param vector<...>& after filters applied after this node
+     * @param vector<Term>& terms output list of terms
+     */
+    static void expand(const Node* node, float scale,
+                       vector<const vector<vector<float>>*>& after,
+                       vector<Term>& terms);
+
+    /** Evaluate one term on the pixels within band of the border,
+     *  truncating intermediates exactly as separate passes would
+     * @param Term& term term to evaluate
+     * @param int band width of the border band
+     * @param vector<vector<float>>& out accumulates the term on the band
+     */
+    static void addTermOnBand(const Term& term, int band,
+                              vector<vector<float>>& out);
+
+public:
+    /** Wrap an image as an expression leaf. The image is copied.
+     * @param vector<vector<float>>& image input matrix image
+     * @return ConvExpr leaf expression
+     */
+    static ConvExpr image(vector<vector<float>>& image);
+
+    /** Convolve this expression with a filter
+     * @param vector<vector<float>>& filter input matrix filter
+     * @return ConvExpr deferred convolution
+     */
+    ConvExpr conv(vector<vector<float>>& filter) const;
+
+    /** Sum of two expressions over images of the same size */
+    friend ConvExpr operator+(const ConvExpr& a, const ConvExpr& b);
+
+    /** Product of a scalar and an expression */
+    friend ConvExpr operator*(float s, const ConvExpr& a);
+    friend ConvExpr operator*(const ConvExpr& a, float s);
+
+    /** Optimize the graph and materialize the result
+     * @return vector<vector<float>> value of the expression
+     */
+    vector<vector<float>> evaluate() const;
+
+    /** Optimize the graph and materialize the result
+     * @param int& passes set to the full image convolution passes
+     *        used, e.g. 1 for a sum of N filters over one image
+     * @return vector<vector<float>> value of the expression
+     */
+    vector<vector<float>> evaluate(int& passes) const;
+};
+#endif
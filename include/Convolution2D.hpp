@@ -16,6 +16,7 @@
  *
  * The header file for class Convolution2D.
  */
+#include "ImageTensor.hpp"
 #include <vector>
 using namespace std;
  
@@ -25,6 +26,8 @@ using namespace std;
 class Convolution2D {
     int mImgSize; /** Row or column size of image. Assume square matrix */
     int mFilterSize; /** Row/column size of filter. Assume square matrix*/
+    bool mRetainIm2col; /** keep the im2col matrix of fastConvolve() */
+    vector<vector<float>> mIm2col; /** im2col of the last fastConvolve() */
 
     /** Matrix multiplication of two matrices
      * @param vector<vector<float>>& a input matrix A
@@ -34,7 +37,37 @@ class Convolution2D {
     vector<vector<float>> matrixMultiply(vector<vector<float>>& a,
                                          vector<vector<float>>& b);
 
+    /** Flatten a filter into a 1xk^2 matrix for matrix multiplication
+     * @param vector<vector<float>>& filter input matrix filter
+     * @return vector<vector<float>> flattened filter
+     */
+    vector<vector<float>> flattenFilter(vector<vector<float>>& filter);
+
+    /** Copy the windows of an image into consecutive im2col columns
+     * @param vector<vector<float>>& image input matrix image
+     * @param vector<float*>& colPtr one pointer per im2col row, moved
+     *                               past the n^2 columns written
+     */
+    void im2col(vector<vector<float>>& image, vector<float*>& colPtr);
+
+    /** Sum the k^2 x n^2 column gradients back into image positions
+     * Each image pixel gathers its k^2 contributions, row blocks at a
+     * time, so no output is scattered to twice from different places
+     * @param vector<vector<float>>& columns column matrix
+     * @return vector<vector<float>> n x n image gradient
+     */
+    vector<vector<float>> col2im(vector<vector<float>>& columns);
+
 public:
+    /** Largest supported filter size */
+    static const int MAX_FILTER_SIZE = 11;
+    /** Largest supported image size */
+    static const int MAX_IMAGE_SIZE = 64;
+    /** Fraction of the dense work below which a sparse engine is used */
+    static const float SPARSE_WORK_RATIO;
+    /** Image rows gathered together by col2im() */
+    static const int COL2IM_BLOCK = 8;
+
     Convolution2D(int imgSize, int filterSize);
     ~Convolution2D() {}
 
@@ -54,6 +87,127 @@ public:
     vector<vector<float>> fastConvolve(vector<vector<float>>& image, 
                                        vector<vector<float>>& filter);
 
+    /** 2D fast convolution of several images with one filter
+     * The im2col columns of all images share one matrix so the filter
+     * is flattened once and one matrix multiplication covers the batch
+     * @param vector<vector<vector<float>>>& images input images
+     * @param vector<vector<float>>& filter input matrix filter
+     * @return vector<vector<vector<float>>> 2D convolution results
+     */
+    vector<vector<vector<float>>>
+    fastConvolveBatch(vector<vector<vector<float>>>& images,
+                      vector<vector<float>>& filter);
+
+    /** 2D convolution of row-major buffers, no copies are made
+     * @param const float* image mImgSize x mImgSize input image
+     * @param const float* filter mFilterSize x mFilterSize filter
+     * @param float* outImage mImgSize x mImgSize output image
+     */
+    void directConvolve(const float* image, const float* filter,
+                        float* outImage) const;
+
+    /** Keep the im2col matrix built by fastConvolve() for the
+     *  backward pass. Disabled by default.
+     * @param bool retain true to keep the matrix of the last call
+     */
+    void retainIm2col(bool retain);
+
+    /** Gradient of the loss with respect to the filter
+     * dL/dfilter[i][j] = sum over x,y of outGrad[x][y] * window(x,y)[i][j]
+     * computed as im2col rows times the flattened output gradient
+     * @param vector<vector<float>>& image forward input image
+     * @param vector<vector<float>>& outGrad gradient of the output
+     * @return vector<vector<float>> k x k filter gradient
+     */
+    vector<vector<float>> weightGradient(vector<vector<float>>& image,
+                                         vector<vector<float>>& outGrad);
+
+    /** Filter gradient reusing the im2col matrix retained by the last
+     *  fastConvolve(); throws if none was retained
+     * @param vector<vector<float>>& outGrad gradient of the output
+     * @return vector<vector<float>> k x k filter gradient
+     */
+    vector<vector<float>> weightGradient(vector<vector<float>>& outGrad);
+
+    /** Gradient of the loss with respect to the input image, i.e. the
+     *  transposed convolution of outGrad with filter, via col2im
+     * @param vector<vector<float>>& outGrad gradient of the output
+     * @param vector<vector<float>>& filter forward filter
+     * @return vector<vector<float>> n x n image gradient
+     */
+    vector<vector<float>> inputGradient(vector<vector<float>>& outGrad,
+                                        vector<vector<float>>& filter);
+
+    /** 2D convolution iterating only over the non-zero filter taps
+     * Cost scales with nnz(filter) * n^2 instead of k^2 * n^2
+     * @param vector<vector<float>>& image input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @return vector<vector<float>> 2D convolution results
+     */
+    vector<vector<float>> sparseFilterConvolve(vector<vector<float>>& image,
+                                             vector<vector<float>>& filter);
+
+    /** 2D convolution scattering only the non-zero image pixels
+     * Cost scales with nnz(image) * k^2 instead of k^2 * n^2
+     * @param vector<vector<float>>& image input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @return vector<vector<float>> 2D convolution results
+     */
+    vector<vector<float>> sparseImageConvolve(vector<vector<float>>& image,
+                                             vector<vector<float>>& filter);
+
+    /** 2D convolution using the engine picked from measured density
+     * Sparse engines are used when their estimated work is below
+     * SPARSE_WORK_RATIO of the dense work, else fastConvolve()
+     * @param vector<vector<float>>& image input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @return vector<vector<float>> 2D convolution results
+     */
+    vector<vector<float>> autoConvolve(vector<vector<float>>& image,
+                                       vector<vector<float>>& filter);
+
+    /** 2D convolution of image and filter over a region of the output
+     * Only output pixels in rows [x0,x1) and columns [y0,y1) are written.
+     * @param vector<vector<float>>& image input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param vector<vector<float>>& outImage output matrix, already sized
+     * @param int x0 first output row
+     * @param int y0 first output column
+     * @param int x1 one past the last output row
+     * @param int y1 one past the last output column
+     */
+    void convolveRegion(vector<vector<float>>& image,
+                        vector<vector<float>>& filter,
+                        vector<vector<float>>& outImage,
+                        int x0, int y0, int x1, int y1);
+
+    /** 2D convolution through the plan of the process-wide
+     *  FilterCache, so a recurring filter is prepared only once.
+     *  Box and separable filters get their O(1) and O(k) engines;
+     *  Gaussians get the recursive engine if it is within tolerance.
+     * @param vector<vector<float>>& image input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param float tolerance see PlanOptions::tolerance
+     * @return vector<vector<float>> 2D convolution results
+     */
+    vector<vector<float>> cachedConvolve(vector<vector<float>>& image,
+                                         vector<vector<float>>& filter,
+                                         float tolerance = 0);
+
+    /** Layout in which convolvePlanes() works without conversion
+     * @return TensorLayout NCHW, the channels are separate planes
+     */
+    static TensorLayout preferredLayout() { return NCHW; }
+
+    /** Convolve every plane of a tensor with the same filter
+     * Input in another layout is converted to NCHW once.
+     * @param ImageTensor& image n x n images, any layout
+     * @param vector<vector<float>>& filter input matrix filter
+     * @return ImageTensor NCHW output of the same shape
+     */
+    ImageTensor convolvePlanes(const ImageTensor& image,
+                               vector<vector<float>>& filter);
+
     /** Create random image using mImgSize
      * @return vector<vector<float>> random image
      */
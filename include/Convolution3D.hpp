@@ -0,0 +1,126 @@
+#ifndef __CONVOLUTION3D__HPP_
+#define __CONVOLUTION3D__HPP_
+
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * The header file for class Convolution3D.
+ */
+#include <vector>
+using namespace std;
+
+/** 'same' convolution of volumes with k x k x k filters.
+ *  A volume is depth slices of n x n (volume[z][x][y], flat z-major);
+ *  the filter is k slices of k x k. Borders are zero in all three
+ *  axes, as Convolution2D in two. Output slices are split into one
+ *  contiguous range per thread. Each thread keeps a rolling buffer of
+ *  the k zero padded input slices its current output slice needs: the
+ *  next output slice loads one new slice over the oldest one, so every
+ *  input voxel is copied in once per pass and reused by the k output
+ *  slices that read it, instead of being re-read by k separate 2D
+ *  convolutions.
+ *  - convolve()/directConvolve(): every non-zero tap streams a padded
+ *    row of the buffer into a row of accumulators
+ *  - gemmConvolve(): vol2col of one output slice (k^3 x n^2 from the
+ *    rolling buffer) times the flattened filter
+ */
+class Convolution3D {
+    int mDepth; /** slices of the volume */
+    int mImgSize; /** Row or column size of a slice. Assume square */
+    int mFilterSize; /** Row/column/slice size of filter, odd */
+    int mThreads; /** slice-parallel workers */
+
+    /** Bring input slice z into the rolling buffer, zero if outside
+     * @param float* volume flat input volume
+     * @param int z input slice, may be outside the volume
+     * @param vector<float>& ring k padded slices, slot z mod k
+     */
+    void loadSlice(const float* volume, int z, vector<float>& ring) const;
+
+    /** Output slices [zBegin, zEnd) of the direct engine
+     * @param float* volume flat input volume
+     * @param float* filter flat k x k x k filter
+     * @param float* outVolume flat output volume
+     * @param int zBegin first output slice
+     * @param int zEnd one past the last output slice
+     */
+    void directSlices(const float* volume, const float* filter,
+                      float* outVolume, int zBegin, int zEnd) const;
+
+    /** Output slices [zBegin, zEnd) of the vol2col engine
+     * @param float* volume flat input volume
+     * @param float* filter flat k x k x k filter
+     * @param float* outVolume flat output volume
+     * @param int zBegin first output slice
+     * @param int zEnd one past the last output slice
+     */
+    void gemmSlices(const float* volume, const float* filter,
+                    float* outVolume, int zBegin, int zEnd) const;
+
+    /** Run an engine over the output slices on all threads
+     * @param float* volume flat input volume
+     * @param float* filter flat k x k x k filter
+     * @param float* outVolume flat output volume
+     * @param bool gemm vol2col engine instead of direct
+     */
+    void runSlices(const float* volume, const float* filter,
+                   float* outVolume, bool gemm) const;
+
+public:
+    /** Prepare the engine
+     * @param int depth slices of the volume, 1 or more
+     * @param int imgSize size of a slice, as Convolution2D
+     * @param int filterSize size of filter, as Convolution2D
+     * @param int threads workers, 0 for hardware concurrency; never
+     *                    more than depth
+     */
+    Convolution3D(int depth, int imgSize, int filterSize, int threads = 0);
+    ~Convolution3D() {}
+
+    /** 3D convolution with the direct engine
+     * @param vector<vector<vector<float>>>& volume input volume
+     * @param vector<vector<vector<float>>>& filter input filter
+     * @return vector<vector<vector<float>>> 3D convolution results
+     */
+    vector<vector<vector<float>>>
+    convolve(vector<vector<vector<float>>>& volume,
+             vector<vector<vector<float>>>& filter);
+
+    /** 3D convolution with the vol2col and GEMM engine
+     * @param vector<vector<vector<float>>>& volume input volume
+     * @param vector<vector<vector<float>>>& filter input filter
+     * @return vector<vector<vector<float>>> 3D convolution results
+     */
+    vector<vector<vector<float>>>
+    gemmConvolve(vector<vector<vector<float>>>& volume,
+                 vector<vector<vector<float>>>& filter);
+
+    /** Direct engine on flat buffers
+     * @param float* volume depth x n x n input
+     * @param float* filter k x k x k filter
+     * @param float* outVolume depth x n x n output
+     */
+    void directConvolve(const float* volume, const float* filter,
+                        float* outVolume) const;
+
+    /** vol2col engine on flat buffers
+     * @param float* volume depth x n x n input
+     * @param float* filter k x k x k filter
+     * @param float* outVolume depth x n x n output
+     */
+    void gemmConvolve(const float* volume, const float* filter,
+                      float* outVolume) const;
+
+    int threads() const { return mThreads; }
+};
+#endif
@@ -0,0 +1,102 @@
+#ifndef __CONVOLUTION_CLIENT__HPP_
+#define __CONVOLUTION_CLIENT__HPP_
+
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * The header file for class ConvolutionClient.
+ */
+#include "SharedRing.hpp"
+#include <vector>
+#include <string>
+using namespace std;
+
+/** Client of a ConvolutionDaemon on the same host.
+ *  Maps the daemon's ring. The zero-copy interface hands out a slot
+ *  whose image and filter the caller fills in place and whose output
+ *  it reads in place:
+ *      int s = client.acquire(n, k);
+ *      ... write client.image(s), client.filter(s) ...
+ *      client.submit(s);
+ *      client.wait(s);
+ *      ... read client.output(s) ...
+ *      client.release(s);
+ *  convolve() does the same for vector images. One client may be used
+ *  from several threads, each with its own slots.
+ */
+class ConvolutionClient {
+    SharedRing::RingHeader* mHeader; /** start of the mapping */
+    size_t mSize; /** bytes mapped */
+
+    /** Slot record, checked to be in range
+     * @param int slot slot index
+     * @return SharedRing::RingSlot& record
+     */
+    SharedRing::RingSlot& slotAt(int slot) const;
+
+    /** Free slots held by clients that no longer exist
+     * @return int slots freed
+     */
+    int reclaimAbandoned();
+
+public:
+    /** Longest sleep of acquire() before looking for abandoned slots */
+    static const int RECLAIM_INTERVAL_MS = 50;
+
+    /** Map the ring of a running daemon
+     * @param string& name shared memory object name
+     */
+    explicit ConvolutionClient(const string& name);
+    ~ConvolutionClient();
+
+    /** Claim a free slot, sleeping while all are in use; slots of
+     *  clients that died are reclaimed before sleeping
+     * @param int imgSize size of image
+     * @param int filterSize size of filter
+     * @return int slot index
+     */
+    int acquire(int imgSize, int filterSize);
+
+    /** Row-major n x n input of a claimed slot */
+    float* image(int slot) { return slotAt(slot).image; }
+    /** Row-major k x k filter of a claimed slot */
+    float* filter(int slot) { return slotAt(slot).filter; }
+    /** Row-major n x n output of a completed slot */
+    const float* output(int slot) const { return slotAt(slot).output; }
+
+    /** Hand a filled slot to the daemon, again if already completed
+     * @param int slot claimed or completed slot
+     */
+    void submit(int slot);
+
+    /** Sleep until the daemon has completed a slot
+     * @param int slot submitted slot
+     * @return int status is 0 on success, -1 if refused or the daemon
+     *         stopped, died or was restarted meanwhile
+     */
+    int wait(int slot);
+
+    /** Return a slot to the ring
+     * @param int slot completed or claimed slot
+     */
+    void release(int slot);
+
+    /** Convolve through the daemon
+     * @param vector<vector<float>>& image input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @return vector<vector<float>> 2D convolution results
+     */
+    vector<vector<float>> convolve(vector<vector<float>>& image,
+                                   vector<vector<float>>& filter);
+};
+#endif
@@ -0,0 +1,83 @@
+#ifndef __CONVOLUTION_DAEMON__HPP_
+#define __CONVOLUTION_DAEMON__HPP_
+
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * The header file for class ConvolutionDaemon.
+ */
+#include "SharedRing.hpp"
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <sys/types.h>
+using namespace std;
+
+/** Host-wide convolution service over a shared-memory ring.
+ *  The daemon creates the POSIX shared memory object and runs one pool
+ *  of worker threads for every client process on the host. Workers
+ *  take submitted slots, run them with the plans of the process-wide
+ *  FilterCache directly on the slot memory, and wake the owner. A
+ *  worker that takes a slot also takes every other submitted slot
+ *  with the same sizes and filter, so that concurrent requests of
+ *  different clients share one plan lookup.
+ */
+class ConvolutionDaemon {
+    string mName; /** shared memory object name, e.g. "/conv2d" */
+    uint32_t mSlots; /** records in the ring */
+    SharedRing::RingHeader* mHeader; /** start of the mapping */
+    int mFd; /** descriptor of the object, holds the daemon lock */
+    dev_t mDevice; /** identity of the object this daemon created, */
+    ino_t mInode;  /** so that only that one is unlinked */
+    vector<thread> mWorkers;
+    atomic<unsigned long> mCompleted; /** slots completed */
+    atomic<unsigned long> mBatches; /** plan lookups, one per batch */
+
+    /** Remove the name if it still refers to this daemon's object */
+    void unlinkOwn();
+
+    /** Take and run submitted slots until shutdown */
+    void workerLoop();
+
+    /** Run one slot with a plan, or refuse it if its sizes are invalid
+     * @param SharedRing::RingSlot& slot running slot
+     */
+    void runSlot(SharedRing::RingSlot& slot);
+
+public:
+    /** Default name of the shared memory object */
+    static const char* const DEFAULT_NAME;
+
+    /** Create the ring and start the workers
+     * The object is locked for the lifetime of the daemon. A stale
+     * object left by a daemon that died is reused; one whose daemon
+     * is still running is not, and the constructor throws.
+     * @param string& name shared memory object name, starting with '/'
+     * @param uint32_t slots requests in flight at once
+     * @param int threads workers, 0 for hardware concurrency
+     */
+    ConvolutionDaemon(const string& name = DEFAULT_NAME,
+                      uint32_t slots = 64, int threads = 0);
+
+    /** Stop the workers, unmap, remove the object and drop the lock */
+    ~ConvolutionDaemon();
+
+    /** Wake and join the workers; pending requests are not run */
+    void stop();
+
+    unsigned long completed() const { return mCompleted; }
+    unsigned long batches() const { return mBatches; }
+    const string& name() const { return mName; }
+};
+#endif
@@ -0,0 +1,245 @@
+#ifndef __CONVOLUTION_PLAN__HPP_
+#define __CONVOLUTION_PLAN__HPP_
+
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * The header file for class ConvolutionPlan.
+ */
+#include <vector>
+#include <mutex>
+#include <cstdint>
+using namespace std;
+
+/** Engines a plan can be prepared for */
+enum PlanEngine {
+    PLAN_AUTO, /** picked from the filter when the plan is made */
+    PLAN_DIRECT, /** tap list, one broadcast weight per non-zero tap */
+    PLAN_GEMM, /** flattened filter panel times a tap-major im2col */
+    PLAN_BOX, /** constant filter, summed-area table */
+    PLAN_GAUSSIAN, /** Gaussian filter, recursive 4th order Deriche IIR */
+    PLAN_SEPARABLE /** rank one filter, row pass then column pass */
+};
+
+/** Options of ConvolutionPlan */
+struct PlanOptions {
+    PlanEngine engine; /** engine to prepare */
+    int workspaces; /** workspaces allocated up front */
+    float tolerance; /** largest deviation of the filter actually applied
+                         from the given one, relative to its largest
+                         tap; 0 accepts only exact box and separable
+                         filters, never the IIR Gaussian */
+
+    PlanOptions() : engine(PLAN_AUTO), workspaces(1), tolerance(0) {}
+};
+
+/** Convolution of one filter prepared for many images.
+ *  Everything that depends only on the image size and the filter is
+ *  done once when the plan is made: the filter is packed in the form
+ *  its engine reads, and the window bounds of every output row and
+ *  filter column are tabulated so execute() does no per-pixel border
+ *  tests. The plan owns a pool of workspaces; execute() is const and
+ *  may be called from several threads at once, each taking its own
+ *  workspace from the pool.
+ */
+class ConvolutionPlan {
+    /** Second order section of the Deriche IIR: the causal part
+     *  y[i] = a x[i] + c x[i-1] + d1 y[i-1] + d2 y[i-2] */
+    struct IirSection {
+        double a;
+        double c;
+        double d1;
+        double d2;
+    };
+
+    /** One filter tap of the direct engine */
+    struct Tap {
+        int i; /** filter row */
+        int j; /** filter column */
+        float weight;
+    };
+
+    int mImgSize; /** Row or column size of image. Assume square matrix */
+    int mFilterSize; /** Row/column size of filter. Assume square matrix*/
+    PlanEngine mEngine; /** engine the plan was prepared for */
+    vector<Tap> mTaps; /** non-zero taps in row-major order, direct */
+    vector<float> mPanel; /** 1 x k^2 flattened filter, GEMM */
+    vector<int> mRowBegin; /** first filter row inside the image, per x */
+    vector<int> mRowEnd; /** one past the last filter row, per x */
+    vector<int> mColBegin; /** first output column of filter column j */
+    vector<int> mColEnd; /** one past the last output column of j */
+    float mBoxWeight; /** value of every tap, box */
+    vector<float> mColFilter; /** filter = mColFilter x mRowFilter, */
+    vector<float> mRowFilter; /** separable */
+    IirSection mIir[2]; /** sections of one 1D pass, Gaussian */
+    double mIirGain; /** filter sum over the IIR gain, Gaussian */
+
+    int mWorkspaces; /** workspaces the pool keeps, PlanOptions */
+    mutable mutex mPoolMutex;
+    mutable vector<vector<float>> mPool; /** free workspaces */
+
+    /** Constant filter test
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param float tolerance relative deviation allowed
+     * @return bool true, with mBoxWeight set, if the filter is a box
+     */
+    bool recognizeBox(vector<vector<float>>& filter, float tolerance);
+
+    /** Rank one filter test, pivoting on the largest tap
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param float tolerance relative deviation allowed
+     * @return bool true, with mColFilter/mRowFilter set, if separable
+     */
+    bool recognizeSeparable(vector<vector<float>>& filter, float tolerance);
+
+    /** Gaussian filter test
+     * Sigma is estimated from the centre row, then the impulse response
+     * of the IIR is compared with the filter over the whole image span.
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param float tolerance relative deviation allowed
+     * @return bool true, with the IIR coefficients set, if accepted
+     */
+    bool recognizeGaussian(vector<vector<float>>& filter, float tolerance);
+
+    /** Causal plus anticausal IIR of one line, not normalized
+     * @param double* in signal, zero beyond the line
+     * @param double* out response, overwritten
+     * @param int length samples in the line
+     */
+    void iirLine(const double* in, double* out, int length) const;
+
+    /** Floats of one workspace: im2col plus output staging for GEMM,
+     *  one staged output row for direct
+     * @return size_t workspace size
+     */
+    size_t workspaceSize() const;
+
+    /** Take a workspace from the pool, allocating one if it is empty
+     * @return vector<float> workspaceSize() floats
+     */
+    vector<float> acquire() const;
+
+    /** Return a workspace to the pool, or drop it if the pool already
+     *  holds mWorkspaces, so memory does not grow with concurrency
+     * @param vector<float>& workspace buffer from acquire()
+     */
+    void release(vector<float>& workspace) const;
+
+    /** Engine dispatch for any input and output pixel type
+     * Integer output is summed in float and saturated when stored.
+     * @param In* image n x n input
+     * @param Out* outImage n x n output, overwritten
+     */
+    template <typename In, typename Out>
+    void run(const In* image, Out* outImage) const;
+
+    /** Tap list engine, one output row
+     * @param In* image n x n input, converted to float as it is read
+     * @param int x output row
+     * @param float* out n sums, overwritten
+     */
+    template <typename In>
+    void directRow(const In* image, int x, float* out) const;
+
+    /** Summed-area table engine, O(1) per pixel
+     * @param In* image n x n input, converted to double by the table
+     * @param float* outImage n x n sums, overwritten
+     */
+    template <typename In>
+    void executeBox(const In* image, float* outImage) const;
+
+    /** Recursive Gaussian engine, O(1) per pixel
+     * @param In* image n x n input, converted as the rows are loaded
+     * @param float* outImage n x n sums, overwritten
+     */
+    template <typename In>
+    void executeGaussian(const In* image, float* outImage) const;
+
+    /** Row pass then column pass, O(k) per pixel
+     * @param In* image n x n input, converted by the row pass
+     * @param float* outImage n x n sums, overwritten
+     * @param float* scratch n x n row pass result
+     */
+    template <typename In>
+    void executeSeparable(const In* image, float* outImage,
+                          float* scratch) const;
+
+    /** Panel times im2col engine
+     * @param In* image n x n input, converted to float by im2col
+     * @param float* outImage n x n sums, overwritten
+     * @param vector<float>& workspace k^2 x n^2 im2col buffer first
+     */
+    template <typename In>
+    void executeGemm(const In* image, float* outImage,
+                     vector<float>& workspace) const;
+
+public:
+    /** Prepare a plan
+     * @param int imgSize size of image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param PlanOptions& options engine and workspace count
+     */
+    ConvolutionPlan(int imgSize, vector<vector<float>>& filter,
+                    const PlanOptions& options = PlanOptions());
+    ~ConvolutionPlan() {}
+
+    /** 'same' convolution of one image, thread-safe
+     * @param float* image n x n row-major input
+     * @param float* outImage n x n row-major output, overwritten
+     */
+    void execute(const float* image, float* outImage) const;
+
+    /** 'same' convolution of integer pixels, thread-safe
+     * Pixels are widened to float as the engine loads them, there is
+     * no separate conversion pass.
+     * @param uint8_t* image n x n row-major input
+     * @param float* outImage n x n row-major output, overwritten
+     */
+    void execute(const uint8_t* image, float* outImage) const;
+    void execute(const uint16_t* image, float* outImage) const;
+
+    /** 'same' convolution of integer pixels back to the same type
+     * Sums are rounded to nearest, halves up, and saturated to the
+     * range of the pixel type.
+     * @param uint8_t* image n x n row-major input
+     * @param uint8_t* outImage n x n row-major output, overwritten
+     */
+    void execute(const uint8_t* image, uint8_t* outImage) const;
+    void execute(const uint16_t* image, uint16_t* outImage) const;
+
+    /** 'same' convolution of one image, thread-safe
+     * @param vector<vector<float>>& image input matrix image
+     * @return vector<vector<float>> 2D convolution results
+     */
+    vector<vector<float>> execute(vector<vector<float>>& image) const;
+
+    /** Memory held by the plan, the configured workspaces included;
+     *  constant for the life of the plan
+     * @return size_t bytes
+     */
+    size_t bytes() const;
+
+    /** Printable name of an engine
+     * @param PlanEngine engine engine
+     * @return const char* name
+     */
+    static const char* engineName(PlanEngine engine);
+
+    /** Engine the plan was prepared for, never PLAN_AUTO
+     * @return PlanEngine engine
+     */
+    PlanEngine engine() const { return mEngine; }
+    int imgSize() const { return mImgSize; }
+    int filterSize() const { return mFilterSize; }
+};
+#endif
@@ -0,0 +1,116 @@
+#ifndef __CONVOLUTION_SCHEDULER__HPP_
+#define __CONVOLUTION_SCHEDULER__HPP_
+
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * The header file for class ConvolutionScheduler.
+ */
+#include <vector>
+#include <deque>
+#include <map>
+#include <tuple>
+#include <memory>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+using namespace std;
+
+/** Counters of a ConvolutionScheduler */
+struct SchedulerStats {
+    size_t submitted; /** requests accepted by submit() */
+    size_t completed; /** requests whose future is ready */
+    size_t batches; /** batches executed */
+    size_t largestBatch; /** most requests executed in one batch */
+    size_t queueDepth; /** requests submitted but not yet executing */
+
+    /** Average number of requests per executed batch
+     * @return double mean batch size, 0 before the first batch
+     */
+    double meanBatch() const {
+        return batches ? double(completed)/batches : 0;
+    }
+};
+
+/** Asynchronous convolution service.
+ *  submit() returns a future immediately. Pending requests with the
+ *  same image size and filter are coalesced into one batch that is
+ *  run with Convolution2D::fastConvolveBatch() on the worker threads
+ *  once it is full or its oldest request reaches the latency deadline.
+ */
+class ConvolutionScheduler {
+    /** Batch identity: image size, filter size and filter contents */
+    typedef tuple<int, int, vector<float>> BatchKey;
+
+    /** Requests waiting for the same filter */
+    struct Batch {
+        int imgSize;
+        vector<vector<float>> filter;
+        vector<vector<vector<float>>> images;
+        vector<promise<vector<vector<float>>>> results;
+        chrono::steady_clock::time_point deadline;
+    };
+
+    size_t mMaxBatch; /** requests that close a batch immediately */
+    chrono::microseconds mMaxDelay; /** longest a request waits to batch */
+    map<BatchKey, shared_ptr<Batch>> mOpen; /** batches still filling */
+    deque<shared_ptr<Batch>> mReady; /** batches waiting for a worker */
+    vector<thread> mWorkers;
+    mutable mutex mMutex;
+    condition_variable mCond;
+    bool mStop;
+    SchedulerStats mStats;
+
+    /** Worker loop: close expired batches and run ready ones */
+    void workerLoop();
+
+    /** Convolve a batch and fulfil its promises
+     * @param Batch& batch batch to run
+     */
+    void runBatch(Batch& batch);
+
+public:
+    /** Start the worker threads
+     * @param int threads worker count, 0 for hardware concurrency
+     * @param size_t maxBatch requests per batch
+     * @param chrono::microseconds maxDelay latency deadline of a batch
+     */
+    ConvolutionScheduler(int threads = 0, size_t maxBatch = 16,
+                         chrono::microseconds maxDelay =
+                         chrono::microseconds(200));
+
+    /** Run the pending requests and stop the workers */
+    ~ConvolutionScheduler();
+
+    /** Queue a convolution of image and filter
+     * Errors, e.g. unsupported sizes, are reported through the future.
+     * @param vector<vector<float>>& image input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @return future<vector<vector<float>>> 2D convolution results
+     */
+    future<vector<vector<float>>> submit(vector<vector<float>>& image,
+                                         vector<vector<float>>& filter);
+
+    /** Number of requests submitted but not yet executing
+     * @return size_t queue depth
+     */
+    size_t queueDepth() const;
+
+    /** Snapshot of the counters
+     * @return SchedulerStats counters
+     */
+    SchedulerStats stats() const;
+};
+#endif
@@ -0,0 +1,111 @@
+#ifndef __FILTER_CACHE__HPP_
+#define __FILTER_CACHE__HPP_
+
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * The header file for class FilterCache.
+ */
+#include "ConvolutionPlan.hpp"
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+using namespace std;
+
+/** Counters of FilterCache */
+struct FilterCacheStats {
+    unsigned long hits; /** lookups served from the cache */
+    unsigned long misses; /** lookups that prepared a new plan */
+    unsigned long evictions; /** plans dropped to stay in budget */
+    size_t entries; /** plans held */
+    size_t bytes; /** memory held by the plans */
+
+    FilterCacheStats() : hits(0), misses(0), evictions(0), entries(0),
+                         bytes(0) {}
+};
+
+/** Process-wide least recently used cache of prepared filters.
+ *  Plans are keyed by a hash of the filter contents, the filter and
+ *  image size, the engine and the recognizer tolerance; the contents
+ *  are compared on a hash match, so a collision is a miss, never a
+ *  wrong plan. Plans are handed out as shared pointers: an evicted
+ *  plan stays valid for the callers still using it. The memory of a
+ *  plan does not change after it is made (its workspace pool is
+ *  bounded), so it is accounted once at insert.
+ */
+class FilterCache {
+    /** One cached plan */
+    struct Entry {
+        size_t hash;
+        int imgSize;
+        PlanEngine engine;
+        float tolerance;
+        vector<float> filter; /** flattened filter, compared on hit */
+        shared_ptr<const ConvolutionPlan> plan;
+        size_t bytes; /** plan.bytes() when inserted */
+    };
+
+    /** Entries by hash of their key */
+    typedef unordered_multimap<size_t, list<Entry>::iterator> Index;
+
+    mutex mMutex;
+    list<Entry> mEntries; /** most recently used first */
+    Index mIndex;
+    size_t mBudget; /** bytes the plans may hold */
+    FilterCacheStats mStats;
+
+    FilterCache();
+    FilterCache(const FilterCache&);
+    FilterCache& operator=(const FilterCache&);
+
+    /** Drop least recently used plans until the budget is met,
+     *  the lock must be held
+     */
+    void evict();
+
+public:
+    /** Default budget in bytes */
+    static const size_t DEFAULT_BUDGET = size_t(64) << 20;
+
+    /** The process-wide cache
+     * @return FilterCache& cache
+     */
+    static FilterCache& instance();
+
+    /** Prepared plan of a filter, made and cached on a miss
+     * Throws runtime_error for the sizes ConvolutionPlan refuses.
+     * @param int imgSize size of image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param PlanEngine engine engine to prepare
+     * @param float tolerance see PlanOptions::tolerance
+     * @return shared_ptr<const ConvolutionPlan> plan
+     */
+    shared_ptr<const ConvolutionPlan> get(int imgSize,
+                                          vector<vector<float>>& filter,
+                                          PlanEngine engine = PLAN_AUTO,
+                                          float tolerance = 0);
+
+    /** Change the budget, evicting as needed
+     * @param size_t bytes bytes the plans may hold
+     */
+    void setBudget(size_t bytes);
+
+    /** Drop all plans and reset the counters */
+    void clear();
+
+    FilterCacheStats stats();
+    size_t budget();
+};
+#endif
@@ -0,0 +1,94 @@
+#ifndef __FUZZ_TEST_HPP__
+#define __FUZZ_TEST_HPP__
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * Header file for the differential fuzz test.
+ */
+
+#include <vector>
+#include <string>
+using namespace std;
+
+/** Differential fuzzing of every Convolution2D engine against a
+ *  double precision reference. Each case is derived from one seed so
+ *  a failure is reproduced with "fuzz -seed <seed>".
+ */
+class FuzzTest {
+public:
+    /** Value distributions used for images and filters */
+    enum Distribution { UNIFORM, SIGNED, DENORMAL, DYNAMIC_RANGE,
+                        ALL_ZERO, SPARSE, NUM_DISTRIBUTIONS };
+
+private:
+    /** One generated test case */
+    struct FuzzCase {
+        unsigned long long seed;
+        int imgSize;
+        int filterSize;
+        Distribution imgDist;
+        Distribution filterDist;
+        vector<vector<float>> image;
+        vector<vector<float>> filter;
+    };
+
+    /** Generate the case of a seed
+     * @param unsigned long long seed case seed
+     * @return FuzzCase shapes, distributions and data
+     */
+    static FuzzCase makeCase(unsigned long long seed);
+
+    /** Double precision 'same' convolution and its error scale
+     * @param FuzzCase& fc test case
+     * @param vector<vector<double>>& magnitude sum of |filter*image|
+     *                                           per output pixel
+     * @return vector<vector<double>> reference output
+     */
+    static vector<vector<double>> reference(FuzzCase& fc,
+                                    vector<vector<double>>& magnitude);
+
+    /** Run every engine on one case
+     * @param unsigned long long seed case seed
+     * @param bool verbose print the case and the error of every engine
+     * @return int status is 0 if every engine is within budget
+     */
+    static int runCase(unsigned long long seed, bool verbose);
+
+    /** Name of a distribution
+     * @param Distribution dist distribution
+     * @return const char* printable name
+     */
+    static const char* distName(Distribution dist);
+
+    FuzzTest() {}
+public:
+
+    /** Run and describe a single seed
+     * @param unsigned long long seed case seed
+     * @return int status is 0 if every engine is within budget
+     */
+    static int runSeed(unsigned long long seed);
+
+    /** Run consecutive seeds on several threads
+     * Prints the smallest failing seed as the reproducer.
+     * @param unsigned long long start first seed
+     * @param unsigned long long count number of seeds
+     * @param int threads worker threads, 0 for hardware concurrency
+     * @return int status is 0 if every case passed
+     */
+    static int runRange(unsigned long long start, unsigned long long count,
+                        int threads);
+
+    ~FuzzTest() {}
+};
+#endif
@@ -0,0 +1,125 @@
+#ifndef __GROUPED_CONVOLUTION2D__HPP_
+#define __GROUPED_CONVOLUTION2D__HPP_
+
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * The header file for class GroupedConvolution2D.
+ */
+#include "ImageTensor.hpp"
+#include <vector>
+using namespace std;
+
+/** Multi-channel grouped and depthwise 'same' convolution.
+ *  Images are channels-last (HWC): pixel (x,y) channel c is at
+ *  (x*n + y)*C + c. Input channels are split into groups, and every
+ *  output channel of a group sums over the input channels of the same
+ *  group only. Filters are k x k x C/groups x outChannels (HWIO), so
+ *  the output channels of one tap are contiguous.
+ *  Depthwise (groups == channels == outChannels) has a kernel of its
+ *  own. Neither kernel builds an im2col matrix or calls a GEMM: every
+ *  output pixel walks its window once and the innermost loop runs over
+ *  contiguous channels.
+ */
+class GroupedConvolution2D {
+    int mImgSize; /** Row or column size of image. Assume square matrix */
+    int mFilterSize; /** Row/column size of filter. Assume square matrix*/
+    int mChannels; /** input channels */
+    int mGroups; /** channel groups */
+    int mOutChannels; /** output channels */
+
+    /** One filter per channel
+     * @param float* image n x n x C input
+     * @param float* filter k x k x C taps
+     * @param float* outImage n x n x C output
+     */
+    void depthwise(const float* image, const float* filter,
+                   float* outImage) const;
+
+    /** Any number of groups
+     * @param float* image n x n x C input
+     * @param float* filter k x k x C/groups x outChannels taps
+     * @param float* outImage n x n x outChannels output
+     */
+    void grouped(const float* image, const float* filter,
+                 float* outImage) const;
+
+    /** One filter per channel on channel blocks
+     * @param float* image one NCHWc image
+     * @param float* filter k x k x blocks x block taps, zero padded
+     * @param float* outImage one NCHWc image
+     * @param int block channels per block
+     */
+    void depthwiseBlocked(const float* image, const float* filter,
+                          float* outImage, int block) const;
+
+public:
+    /** Prepare the engine
+     * @param int imgSize size of image
+     * @param int filterSize size of filter
+     * @param int channels input channels
+     * @param int groups channel groups, must divide both channel counts
+     * @param int outChannels output channels, 0 for as many as input
+     */
+    GroupedConvolution2D(int imgSize, int filterSize, int channels,
+                         int groups, int outChannels = 0);
+    ~GroupedConvolution2D() {}
+
+    /** Convolve all channels in one sweep
+     * @param vector<float>& image n x n x C input, channels-last
+     * @param vector<float>& filter k x k x C/groups x outChannels taps
+     * @return vector<float> n x n x outChannels output, channels-last
+     */
+    vector<float> convolve(vector<float>& image, vector<float>& filter);
+
+    /** Convolve flat buffers in place of the caller's memory
+     * @param float* image n x n x C input, channels-last
+     * @param float* filter k x k x C/groups x outChannels taps
+     * @param float* outImage n x n x outChannels output, overwritten
+     */
+    void convolve(const float* image, const float* filter,
+                  float* outImage) const;
+
+    /** Convolve a batch held in a tensor
+     * Depthwise filters run on NHWC and NCHWc input as is, keeping the
+     * layout; anything else is converted to NHWC once.
+     * @param ImageTensor& image n x n images with C channels
+     * @param vector<float>& filter k x k x C/groups x outChannels taps
+     * @return ImageTensor output in the layout the engine ran in
+     */
+    ImageTensor convolve(const ImageTensor& image, vector<float>& filter);
+
+    /** Layout in which convolve() works without conversion
+     * @return TensorLayout NHWC, channels-last
+     */
+    TensorLayout preferredLayout() const { return NHWC; }
+
+    /** Whether convolve() runs on a layout without converting it
+     * @param TensorLayout layout memory order of the input
+     * @return bool true for NHWC, and for NCHWc when depthwise
+     */
+    bool acceptsLayout(TensorLayout layout) const {
+        return layout == NHWC || (layout == NCHWc && isDepthwise());
+    }
+
+    /** True when every channel has its own single filter
+     * @return bool groups == channels == outChannels
+     */
+    bool isDepthwise() const {
+        return mGroups == mChannels && mOutChannels == mChannels;
+    }
+    int channels() const { return mChannels; }
+    int groups() const { return mGroups; }
+    int outChannels() const { return mOutChannels; }
+};
+#endif
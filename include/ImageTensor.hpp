@@ -0,0 +1,102 @@
+#ifndef __IMAGE_TENSOR__HPP_
+#define __IMAGE_TENSOR__HPP_
+
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * The header file for class ImageTensor.
+ */
+#include <vector>
+using namespace std;
+
+/** Memory order of a batch of multi-channel images */
+enum TensorLayout {
+    NCHW, /** planar: one row-major plane per channel */
+    NHWC, /** channels-last: all channels of a pixel together */
+    NCHWc /** blocked: planes of interleaved blocks of channels */
+};
+
+/** Batch of multi-channel images with an explicit layout.
+ *  In NCHWc the channels are padded with zeros to a whole number of
+ *  blocks, and pixel (h,w) of channel c is lane c%block of the block
+ *  c/block. Conversions between layouts are tiled transposes or block
+ *  copies, so engines that state a preferred layout can convert their
+ *  input once and hand their output on in the same layout.
+ */
+class ImageTensor {
+    int mBatch; /** images in the batch */
+    int mChannels; /** channels of every image, without padding */
+    int mHeight; /** rows of every image */
+    int mWidth; /** columns of every image */
+    TensorLayout mLayout; /** memory order of mData */
+    int mBlock; /** channels per block in NCHWc, 1 otherwise */
+    vector<float> mData; /** zero initialized */
+
+public:
+    /** Channels per block unless given, one AVX2 register of floats */
+    static const int DEFAULT_BLOCK = 8;
+    /** Side of the square tiles of the transposes */
+    static const int TRANSPOSE_TILE = 16;
+
+    /** Allocate a zero tensor
+     * @param int batch images in the batch
+     * @param int channels channels of every image
+     * @param int height rows of every image
+     * @param int width columns of every image
+     * @param TensorLayout layout memory order
+     * @param int block channels per block, NCHWc only
+     */
+    ImageTensor(int batch, int channels, int height, int width,
+                TensorLayout layout = NCHW, int block = DEFAULT_BLOCK);
+    ~ImageTensor() {}
+
+    /** Position of an element in data()
+     * @param int n image
+     * @param int c channel
+     * @param int h row
+     * @param int w column
+     * @return size_t offset in floats
+     */
+    size_t offset(int n, int c, int h, int w) const;
+
+    float& at(int n, int c, int h, int w) { return mData[offset(n,c,h,w)]; }
+    float at(int n, int c, int h, int w) const {
+        return mData[offset(n,c,h,w)];
+    }
+
+    /** Same images in another layout
+     * @param TensorLayout layout memory order of the result
+     * @param int block channels per block, NCHWc only
+     * @return ImageTensor converted copy
+     */
+    ImageTensor to(TensorLayout layout, int block = DEFAULT_BLOCK) const;
+
+    /** Printable name of a layout
+     * @param TensorLayout layout memory order
+     * @return const char* name
+     */
+    static const char* layoutName(TensorLayout layout);
+
+    int batch() const { return mBatch; }
+    int channels() const { return mChannels; }
+    int height() const { return mHeight; }
+    int width() const { return mWidth; }
+    TensorLayout layout() const { return mLayout; }
+    int block() const { return mBlock; }
+    /** Channel blocks in NCHWc, i.e. channels rounded up, 1 otherwise */
+    int blocks() const { return (mChannels + mBlock - 1)/mBlock; }
+    float* data() { return &mData[0]; }
+    const float* data() const { return &mData[0]; }
+    size_t size() const { return mData.size(); }
+};
+#endif
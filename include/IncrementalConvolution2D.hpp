@@ -0,0 +1,89 @@
+#ifndef __INCREMENTAL_CONVOLUTION2D__HPP_
+#define __INCREMENTAL_CONVOLUTION2D__HPP_
+
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * The header file for class IncrementalConvolution2D.
+ */
+#include "Convolution2D.hpp"
+#include <vector>
+using namespace std;
+
+/** Rectangle of changed input pixels.
+ *  Rows [x0,x1) and columns [y0,y1), i.e. end bounds are exclusive.
+ */
+struct DirtyRect {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+};
+
+/** Stateful convolver for successive frames of the same size.
+ *  Keeps the previous input and output and recomputes only the output
+ *  pixels whose filter window touches a changed input pixel.
+ */
+class IncrementalConvolution2D {
+    Convolution2D mConv; /** engine used for full and partial passes */
+    int mImgSize; /** Row or column size of image. Assume square matrix */
+    int mFilterSize; /** Row/column size of filter. Assume square matrix*/
+    vector<vector<float>> mFilter; /** filter applied to every frame */
+    vector<vector<float>> mPrevImage; /** last frame seen */
+    vector<vector<float>> mPrevOutput; /** convolution of mPrevImage */
+    bool mPrimed; /** false until the first full frame is computed */
+    int mLastRecomputed; /** output pixels recomputed by last update */
+
+    /** Recompute the output pixels marked in the mask
+     * @param vector<vector<char>>& mask output pixels to recompute
+     */
+    void recompute(vector<vector<char>>& mask);
+
+    /** Mark output pixels affected by a dirty input rectangle
+     * @param vector<vector<char>>& mask output mask to update
+     * @param DirtyRect& rect changed input pixels
+     */
+    void markDirty(vector<vector<char>>& mask, const DirtyRect& rect);
+
+public:
+    /** Size of the square tiles compared when diffing frames */
+    static const int DIFF_TILE = 8;
+
+    IncrementalConvolution2D(int imgSize, vector<vector<float>>& filter);
+    ~IncrementalConvolution2D() {}
+
+    /** Convolve a new frame, detecting changed regions by diffing
+     * against the previous frame.
+     * @param vector<vector<float>>& image input matrix image
+     * @return const vector<vector<float>>& 2D convolution results
+     */
+    const vector<vector<float>>& update(vector<vector<float>>& image);
+
+    /** Convolve a new frame whose changes are confined to the given
+     * rectangles. Pixels outside the rectangles are not read.
+     * @param vector<vector<float>>& image input matrix image
+     * @param vector<DirtyRect>& dirty rectangles of changed input
+     * @return const vector<vector<float>>& 2D convolution results
+     */
+    const vector<vector<float>>& update(vector<vector<float>>& image,
+                                        vector<DirtyRect>& dirty);
+
+    /** Forget the previous frame; the next update is a full pass */
+    void reset() { mPrimed = false; }
+
+    /** Number of output pixels recomputed by the last update
+     * @return int pixel count, mImgSize^2 for a full pass
+     */
+    int lastRecomputed() const { return mLastRecomputed; }
+};
+#endif
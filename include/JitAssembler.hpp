@@ -0,0 +1,108 @@
+#ifndef __JIT_ASSEMBLER__HPP_
+#define __JIT_ASSEMBLER__HPP_
+
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * The header file for class JitAssembler.
+ */
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+using namespace std;
+
+/** Minimal x86-64 machine code emitter for the JIT convolution kernels.
+ *  Only the instructions the kernels use are encoded: packed single
+ *  SSE and AVX2/FMA arithmetic on xmm/ymm 0-15 with a [rdi/rsi + disp32]
+ *  or constant pool operand, and the few integer instructions of the
+ *  row loop. Constants are collected in a pool placed after the code
+ *  and read RIP-relative. finalize() copies both into fresh pages that
+ *  are made executable only after they are written (never W and X).
+ */
+class JitAssembler {
+    vector<uint8_t> mCode;
+    vector<float> mPool; /** distinct constants */
+    vector<pair<size_t, int>> mPoolRefs; /** disp32 position, pool index */
+
+    void byte(int value) { mCode.push_back(uint8_t(value)); }
+    void dword(uint32_t value);
+    void modrm(int mod, int reg, int rm) {
+        byte(mod << 6 | (reg & 7) << 3 | (rm & 7));
+    }
+    /** REX prefix when reg or rm is register 8-15 */
+    void rex(int reg, int rm);
+    /** Three byte VEX prefix
+     * @param int map 1 for 0F, 2 for 0F38
+     * @param int pp 0 none, 1 66, 2 F3, 3 F2
+     * @param int reg ModRM.reg register
+     * @param int vvvv second source register, 0 when unused
+     * @param int rm ModRM.rm register, 0 for a memory operand
+     */
+    void vex(int map, int pp, int reg, int vvvv, int rm);
+    /** [base + disp32] operand */
+    void memory(int reg, int base, int32_t disp);
+    /** [rip + constant] operand, resolved by finalize() */
+    void constant(int reg, float value);
+    /** Packed single SSE op, register to register */
+    void sse(int opcode, int dst, int src);
+
+public:
+    /** General purpose base registers of memory operands */
+    enum Base { RSI = 6, RDI = 7 };
+
+    /** SSE: xmm = [base + disp], unaligned */
+    void movups(int xmm, Base base, int32_t disp);
+    /** SSE: [base + disp] = xmm, unaligned */
+    void movups(Base base, int32_t disp, int xmm);
+    /** SSE: low lane of xmm = constant */
+    void movss(int xmm, float value);
+    void shufps(int dst, int src, int imm);
+    void addps(int dst, int src) { sse(0x58, dst, src); }
+    void mulps(int dst, int src) { sse(0x59, dst, src); }
+    void xorps(int dst, int src) { sse(0x57, dst, src); }
+    void maxps(int dst, int src) { sse(0x5F, dst, src); }
+
+    /** AVX2: every lane of ymm = constant */
+    void vbroadcastss(int ymm, float value);
+    /** FMA: acc += src * [base + disp] */
+    void vfmadd231ps(int acc, int src, Base base, int32_t disp);
+    /** AVX: [base + disp] = ymm, unaligned */
+    void vmovups(Base base, int32_t disp, int ymm);
+    void vxorps(int dst, int a, int b);
+    void vmaxps(int dst, int a, int b);
+    void vzeroupper();
+
+    void movEcx(uint32_t value);
+    void add(Base base, int32_t value);
+    void decEcx();
+    /** Jump back to a position if ecx is not zero */
+    void jnz(size_t target);
+    void ret() { byte(0xC3); }
+
+    /** Current code position, the target of a later jnz() */
+    size_t here() const { return mCode.size(); }
+
+    /** Copy code and constants into executable memory
+     * @param size_t& bytes length of the mapping, for release()
+     * @return void* entry point, NULL if the pages cannot be mapped
+     *               or made executable
+     */
+    void* finalize(size_t& bytes) const;
+
+    /** Unmap code returned by finalize()
+     * @param void* code entry point
+     * @param size_t bytes length of the mapping
+     */
+    static void release(void* code, size_t bytes);
+};
+#endif
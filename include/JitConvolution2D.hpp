@@ -0,0 +1,121 @@
+#ifndef __JIT_CONVOLUTION2D__HPP_
+#define __JIT_CONVOLUTION2D__HPP_
+
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * The header file for class JitConvolution2D.
+ */
+#include "Convolution2D.hpp"
+#include <vector>
+#include <memory>
+using namespace std;
+
+/** Instruction sets of the generated kernels */
+enum JitIsa {
+    JIT_ISA_NONE, /** no code generation, fastConvolve() */
+    JIT_ISA_SSE, /** 4 lanes, SSE2 baseline of every x86-64 CPU */
+    JIT_ISA_AVX2 /** 8 lanes with FMA */
+};
+
+/** Operation applied to the sums before they are stored */
+enum JitEpilogue {
+    JIT_EPILOGUE_NONE,
+    JIT_EPILOGUE_RELU /** max(sum, 0) */
+};
+
+struct JitKernel;
+
+/** 2D convolution by machine code generated for the exact shape.
+ *  The kernel for (image size, filter size, stride, ISA, epilogue) and
+ *  one filter is emitted at run time: taps are fully unrolled, zero
+ *  taps are left out and the filter values are broadcast from a
+ *  constant pool inside the code, so no filter is passed at all. One
+ *  output row is computed per iteration of the kernel loop, with the
+ *  accumulators of the row held in registers across all taps.
+ *  Borders are constant: the input is copied once per call into a
+ *  zero padded buffer, split into stride phases so that the columns
+ *  of every tap are contiguous. Kernels are shared through a
+ *  process-wide cache keyed by shape and filter. Without x86-64 or
+ *  when the code cannot be made executable the engine falls back to
+ *  fastConvolve().
+ *  Output is 'same' mode subsampled by the stride, (n+s-1)/s square.
+ */
+class JitConvolution2D {
+    int mImgSize; /** Row or column size of image. Assume square matrix */
+    int mFilterSize; /** Row/column size of filter. Assume square matrix*/
+    int mStride;
+    JitEpilogue mEpilogue;
+    JitIsa mIsa; /** requested set, lowered to what the CPU has */
+    int mOutSize; /** output rows/columns */
+    int mOutStride; /** output row length rounded to whole vectors */
+    int mPhaseWidth; /** floats of one stride phase of a padded row */
+    vector<float> mPadded; /** rows x stride phases, zero borders */
+    vector<float> mOutput; /** mOutSize x mOutStride */
+    vector<float> mFilter; /** flattened filter of mKernel */
+    shared_ptr<JitKernel> mKernel; /** kernel of the last filter */
+    bool mJitted; /** the last convolve() ran generated code */
+    Convolution2D mFallback;
+
+    /** Emit the kernel of the current filter
+     * @return shared_ptr<JitKernel> kernel, NULL if it cannot be run
+     */
+    shared_ptr<JitKernel> generate() const;
+
+    /** Kernel of the current filter from the cache, generated on a miss
+     * @return shared_ptr<JitKernel> kernel, NULL if it cannot be run
+     */
+    shared_ptr<JitKernel> lookup() const;
+
+public:
+    /** Kernels kept by the process-wide cache */
+    static const size_t MAX_KERNELS = 256;
+
+    /** Prepare the engine
+     * @param int imgSize size of image
+     * @param int filterSize size of filter
+     * @param int stride output subsampling, 1 or more
+     * @param JitEpilogue epilogue operation on the sums
+     * @param JitIsa isa instruction set, lowered to detectIsa()
+     */
+    JitConvolution2D(int imgSize, int filterSize, int stride = 1,
+                     JitEpilogue epilogue = JIT_EPILOGUE_NONE,
+                     JitIsa isa = JIT_ISA_AVX2);
+    ~JitConvolution2D();
+
+    /** 2D convolution of image and filter
+     * @param vector<vector<float>>& image input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @return vector<vector<float>> outSize() square output
+     */
+    vector<vector<float>> convolve(vector<vector<float>>& image,
+                                   vector<vector<float>>& filter);
+
+    /** Best instruction set of this CPU
+     * @return JitIsa JIT_ISA_NONE when not built for x86-64
+     */
+    static JitIsa detectIsa();
+
+    /** Kernels held by the cache
+     * @return size_t kernel count
+     */
+    static size_t cachedKernels();
+
+    /** Drop all cached kernels; engines keep the ones they hold */
+    static void clearKernels();
+
+    int outSize() const { return mOutSize; }
+    JitIsa isa() const { return mIsa; }
+    bool jitted() const { return mJitted; }
+};
+#endif
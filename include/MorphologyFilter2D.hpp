@@ -0,0 +1,89 @@
+#ifndef __MORPHOLOGY_FILTER2D__HPP_
+#define __MORPHOLOGY_FILTER2D__HPP_
+
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * The header file for class MorphologyFilter2D.
+ */
+#include <vector>
+#include <cstdint>
+using namespace std;
+
+/** Non-linear filters over the k x k window of the convolution.
+ *  Windows and borders are those of Convolution2D::convolve(): 'same'
+ *  mode, centred on the output pixel, with zero padding, so a window
+ *  near the border also sees the zeros outside the image.
+ *  - erode()/dilate(): minimum/maximum over a flat square window by
+ *    van Herk/Gil-Werman, a row pass then a column pass, each with 3
+ *    comparisons per pixel whatever the window size
+ *  - median(): Perreault-Hebert sliding histograms. Float pixels are
+ *    replaced by their rank among the distinct values of the image, so
+ *    the result is exact; the rank histograms have a coarse level of
+ *    RANK_GROUP bins each, and the fine bins of a coarse bin are only
+ *    brought up to date when the median falls into it
+ *  NaN pixels are not supported.
+ */
+class MorphologyFilter2D {
+    int mImgSize; /** Row or column size of image. Assume square matrix */
+    int mWindowSize; /** Row/column size of window, odd */
+    vector<float> mLine; /** zero padded line, whole windows long */
+    vector<float> mPrefix; /** running extreme from each window start */
+    vector<float> mSuffix; /** running extreme to each window end */
+
+    /** Min or max of every window of one line
+     * @param float* in first pixel of the line
+     * @param int stride distance between pixels of the line
+     * @param float* out first output pixel
+     * @param int outStride distance between output pixels
+     */
+    template <bool Dilate>
+    void extremeLine(const float* in, int stride, float* out, int outStride);
+
+    /** Min or max over the window, row pass then column pass
+     * @param vector<vector<float>>& image input matrix image
+     * @return vector<vector<float>> filtered image
+     */
+    template <bool Dilate>
+    vector<vector<float>> extreme(vector<vector<float>>& image);
+
+public:
+    /** Ranks per coarse histogram bin of median() */
+    static const int RANK_GROUP = 16;
+
+    /** Prepare the filter
+     * @param int imgSize size of image, as Convolution2D
+     * @param int windowSize size of window, as a Convolution2D filter
+     */
+    MorphologyFilter2D(int imgSize, int windowSize);
+    ~MorphologyFilter2D() {}
+
+    /** Minimum over the window
+     * @param vector<vector<float>>& image input matrix image
+     * @return vector<vector<float>> eroded image
+     */
+    vector<vector<float>> erode(vector<vector<float>>& image);
+
+    /** Maximum over the window
+     * @param vector<vector<float>>& image input matrix image
+     * @return vector<vector<float>> dilated image
+     */
+    vector<vector<float>> dilate(vector<vector<float>>& image);
+
+    /** Median over the window, the (k*k+1)/2-th smallest value
+     * @param vector<vector<float>>& image input matrix image
+     * @return vector<vector<float>> median filtered image
+     */
+    vector<vector<float>> median(vector<vector<float>>& image);
+};
+#endif
@@ -0,0 +1,80 @@
+#ifndef __NUMA_TOPOLOGY__HPP_
+#define __NUMA_TOPOLOGY__HPP_
+
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * The header file for class NumaTopology.
+ */
+#include <vector>
+#include <string>
+using namespace std;
+
+/** NUMA nodes and the CPUs that belong to each of them.
+ *  Detected from /sys/devices/system/node, from libnuma when built
+ *  with -DHAVE_LIBNUMA, or given explicitly as a string.
+ */
+class NumaTopology {
+    vector<vector<int>> mNodeCpus; /** CPU ids of every node */
+
+public:
+    /** Where detect() reads the topology from */
+    enum Source { SYSFS, LIBNUMA };
+
+    /** Single node holding every CPU this process may run on */
+    NumaTopology();
+
+    /** Topology with the given CPUs per node
+     * @param vector<vector<int>>& nodeCpus CPU ids of every node
+     */
+    explicit NumaTopology(const vector<vector<int>>& nodeCpus);
+    ~NumaTopology() {}
+
+    /** Detect the machine topology
+     * Falls back to the single node topology when the source is not
+     * available, e.g. libnuma was not compiled in.
+     * @param Source source sysfs or libnuma
+     * @return NumaTopology detected topology
+     */
+    static NumaTopology detect(Source source = SYSFS);
+
+    /** Parse a topology such as "0-3,8-11:4-7,12-15"
+     * Nodes are separated by ':' and use the sysfs cpulist syntax.
+     * @param string& spec topology description
+     * @return NumaTopology parsed topology
+     */
+    static NumaTopology fromString(const string& spec);
+
+    /** Parse a sysfs cpulist such as "0-3,8-11"
+     * @param string& list cpulist
+     * @return vector<int> CPU ids
+     */
+    static vector<int> parseCpuList(const string& list);
+
+    /** Number of nodes
+     * @return int node count, at least 1
+     */
+    int nodes() const { return mNodeCpus.size(); }
+
+    /** CPUs of one node
+     * @param int node node index
+     * @return const vector<int>& CPU ids
+     */
+    const vector<int>& cpus(int node) const { return mNodeCpus[node]; }
+
+    /** Total number of CPUs over all nodes
+     * @return int CPU count
+     */
+    int totalCpus() const;
+};
+#endif
@@ -0,0 +1,89 @@
+#ifndef __OUT_OF_CORE_CONVOLUTION2D__HPP_
+#define __OUT_OF_CORE_CONVOLUTION2D__HPP_
+
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * The header file for class OutOfCoreConvolution2D.
+ */
+#include <vector>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+using namespace std;
+
+/** 'same' convolution of raw float32 image files of any size.
+ *  The image is processed in blocks of output rows and columns. A
+ *  reader thread prefetches each block with its filter-radius halo, a
+ *  compute thread convolves it tile by tile with the in-memory engine
+ *  (tiles of Convolution2D::MAX_IMAGE_SIZE including the halo) and a
+ *  writer thread stores the result. Blocks come from a fixed pool
+ *  sized by the memory budget, so memory use does not depend on the
+ *  image size.
+ */
+class OutOfCoreConvolution2D {
+    /** One block of the pipeline */
+    struct Block {
+        long row; /** first output row */
+        long col; /** first output column */
+        long rows; /** output rows in the block */
+        long cols; /** output columns in the block */
+        vector<float> input; /** (rows+2r) x (cols+2r), zero padded */
+        vector<float> output; /** rows x cols */
+    };
+
+    /** Blocking queue of block indices */
+    struct BlockQueue {
+        deque<int> items;
+        mutex lock;
+        condition_variable cond;
+
+        void push(int item);
+        int pop();
+    };
+
+    int mFilterSize; /** Row/column size of filter. Assume square matrix*/
+    vector<float> mFilter; /** flattened filter */
+    size_t mMemoryBudget; /** bytes available for block buffers */
+    long mLastBlocks; /** blocks processed by the last call */
+
+public:
+    /** Output rows/columns of one tile, so that tile plus halo fits
+     *  the in-memory engine */
+    int tileSize() const;
+
+    /** Prepare the engine
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param size_t memoryBudget bytes for block buffers, at least
+     *                            three blocks must fit
+     */
+    OutOfCoreConvolution2D(vector<vector<float>>& filter,
+                           size_t memoryBudget = size_t(256) << 20);
+    ~OutOfCoreConvolution2D() {}
+
+    /** Convolve a raw row-major float32 image file
+     * @param string& inPath input image, rows x cols floats
+     * @param string& outPath output image, created or truncated
+     * @param long rows image rows
+     * @param long cols image columns
+     */
+    void convolveFile(const string& inPath, const string& outPath,
+                      long rows, long cols);
+
+    /** Number of blocks processed by the last convolveFile()
+     * @return long block count
+     */
+    long lastBlocks() const { return mLastBlocks; }
+};
+#endif
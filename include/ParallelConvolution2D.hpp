@@ -0,0 +1,101 @@
+#ifndef __PARALLEL_CONVOLUTION2D__HPP_
+#define __PARALLEL_CONVOLUTION2D__HPP_
+
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * The header file for class ParallelConvolution2D.
+ */
+#include "NumaTopology.hpp"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+using namespace std;
+
+/** Placement options of ParallelConvolution2D */
+struct NumaPolicy {
+    int threadsPerNode; /** workers per node, 0 for one per CPU */
+    bool pinThreads; /** restrict every worker to the CPUs of its node */
+    bool replicateFilter; /** node-local copy of the filter per node */
+
+    NumaPolicy() : threadsPerNode(0), pinThreads(true),
+                   replicateFilter(true) {}
+};
+
+/** NUMA-aware multi-threaded im2col convolution.
+ *  Output rows are split into one contiguous band per node, and each
+ *  band into one sub-band per worker. Workers are started once, pinned
+ *  to their node, and allocate their im2col workspace themselves so
+ *  that first touch places it on the node that reads it. Output rows
+ *  are allocated by the worker that computes them for the same reason.
+ */
+class ParallelConvolution2D {
+    /** State owned by one worker thread */
+    struct Worker {
+        int node; /** node the worker runs on */
+        int rowBegin; /** first output row of the sub-band */
+        int rowEnd; /** one past the last output row */
+        vector<float> im2col; /** k^2 x rows*n, t-major */
+    };
+
+    int mImgSize; /** Row or column size of image. Assume square matrix */
+    int mFilterSize; /** Row/column size of filter. Assume square matrix*/
+    NumaTopology mTopology;
+    NumaPolicy mPolicy;
+    vector<Worker> mWorkers;
+    vector<thread> mThreads;
+    vector<vector<float>> mNodeFilter; /** flattened filter per node */
+
+    mutex mCallMutex; /** one convolve() at a time */
+    mutex mMutex;
+    condition_variable mStartCond;
+    condition_variable mDoneCond;
+    unsigned long mGeneration; /** incremented for every convolve() */
+    int mRunning; /** workers still busy with the current call */
+    int mStarted; /** workers that finished their setup */
+    bool mStop;
+    vector<vector<float>>* mImage; /** input of the current call */
+    vector<vector<float>>* mResult; /** output of the current call */
+
+    /** Pin, allocate node-local buffers and serve convolve() calls
+     * @param int index worker index
+     */
+    void workerLoop(int index);
+
+    /** im2col and filter product over the rows of one worker
+     * @param Worker& worker worker state
+     */
+    void convolveRows(Worker& worker);
+
+public:
+    ParallelConvolution2D(int imgSize, int filterSize,
+                          const NumaTopology& topology =
+                              NumaTopology::detect(),
+                          const NumaPolicy& policy = NumaPolicy());
+    ~ParallelConvolution2D();
+
+    /** 2D convolution of image and filter on all workers
+     * @param vector<vector<float>>& image input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @return vector<vector<float>> 2D convolution results
+     */
+    vector<vector<float>> convolve(vector<vector<float>>& image,
+                                   vector<vector<float>>& filter);
+
+    /** Number of worker threads
+     * @return int worker count
+     */
+    int workers() const { return mWorkers.size(); }
+};
+#endif
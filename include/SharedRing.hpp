@@ -0,0 +1,101 @@
+#ifndef __SHARED_RING__HPP_
+#define __SHARED_RING__HPP_
+
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * Memory layout shared by ConvolutionDaemon and ConvolutionClient.
+ */
+#include <atomic>
+#include <cstdint>
+using namespace std;
+
+/** Layout of the POSIX shared memory object of a daemon:
+ *  one RingHeader followed by RingHeader::slots RingSlot records.
+ *  Every record holds a whole request, so pixels are written and read
+ *  in place by the client and the daemon workers, never copied
+ *  through a socket or pipe. The atomic words double as futex words,
+ *  shared between processes.
+ */
+namespace SharedRing {
+
+/** Written last by the daemon, checked by clients */
+static const uint32_t MAGIC = 0x43324452;
+static const uint32_t VERSION = 3;
+/** Largest filter and image of a slot, as Convolution2D */
+static const int SLOT_FILTER_SIZE = 11;
+static const int SLOT_IMAGE_SIZE = 64;
+
+/** Life cycle of a slot */
+enum SlotState {
+    SLOT_FREE, /** no owner */
+    SLOT_CLAIMED, /** a client is filling it */
+    SLOT_SUBMITTED, /** waiting for a worker */
+    SLOT_RUNNING, /** a worker is computing it */
+    SLOT_DONE /** output and status are valid */
+};
+
+struct RingHeader {
+    atomic<uint32_t> magic;
+    uint32_t version;
+    uint32_t slots; /** records following the header */
+    atomic<uint32_t> work; /** bumped by every submit, workers sleep on it */
+    atomic<uint32_t> freed; /** bumped by every release, clients sleep on it */
+    atomic<uint32_t> shutdown; /** non-zero once the daemon is stopping */
+    atomic<int32_t> daemon; /** pid of the daemon serving the ring */
+};
+
+struct RingSlot {
+    atomic<uint32_t> state; /** SlotState, the owning client sleeps on it */
+    atomic<int32_t> owner; /** pid of the claiming client, 0 while none
+                               or not yet recorded */
+    int32_t imgSize;
+    int32_t filterSize;
+    int32_t status; /** 0 on success, -1 for sizes the daemon refused */
+    float filter[SLOT_FILTER_SIZE*SLOT_FILTER_SIZE]; /** row-major k x k */
+    float image[SLOT_IMAGE_SIZE*SLOT_IMAGE_SIZE]; /** row-major n x n */
+    float output[SLOT_IMAGE_SIZE*SLOT_IMAGE_SIZE]; /** row-major n x n */
+};
+
+/** Bytes of the shared object for a slot count
+ * @param uint32_t slots records
+ * @return size_t object size
+ */
+inline size_t mappingSize(uint32_t slots) {
+    return sizeof(RingHeader) + size_t(slots)*sizeof(RingSlot);
+}
+
+/** Record of a slot in a mapping
+ * @param RingHeader* header start of the mapping
+ * @param uint32_t index slot index
+ * @return RingSlot* record
+ */
+inline RingSlot* slotAt(RingHeader* header, uint32_t index) {
+    return reinterpret_cast<RingSlot*>(header + 1) + index;
+}
+
+/** Sleep while a shared word still holds a value
+ * @param atomic<uint32_t>* word futex word
+ * @param uint32_t expected value seen before deciding to sleep
+ * @param int timeoutMs longest sleep, negative for none
+ */
+void futexWait(atomic<uint32_t>* word, uint32_t expected,
+               int timeoutMs = -1);
+
+/** Wake sleepers of a shared word
+ * @param atomic<uint32_t>* word futex word
+ * @param int count sleepers to wake
+ */
+void futexWake(atomic<uint32_t>* word, int count);
+}
+#endif
@@ -44,6 +44,229 @@ class UnitTest {
     static int compareOutImages(vector<vector<float>>& expected,
                                   vector<vector<float>>& actual);
 
+    /** Check incremental convolution against full recomputation
+     *  - first frame is compared to the expected output, then a block
+     *    of pixels is changed and the update compared to fastConvolve
+     *  - updates recompute no more than the dirty pixels dilated by
+     *    the filter radius
+     * @param vector<vector<float>>& img input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param vector<vector<float>>& expected output of the first frame
+     * @return int status is 0 if all frames match
+     */
+    static int testIncrementalConv2D(vector<vector<float>>& img,
+                                     vector<vector<float>>& filter,
+                                     vector<vector<float>>& expected);
+
+    /** Check the sparse engines on the given data and on a sparsified
+     *  copy of it against the naive convolution
+     * @param vector<vector<float>>& img input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param vector<vector<float>>& expected output for img and filter
+     * @return int status is 0 if all engines match
+     */
+    static int testSparseConv2D(vector<vector<float>>& img,
+                                vector<vector<float>>& filter,
+                                vector<vector<float>>& expected);
+
+    /** Check lazy expressions against separate convolution passes
+     *  - a scaled sum of one filter must collapse into a single pass
+     *  - a sum with a cascade must match the two-pass result, borders
+     *    included
+     *  - one expression evaluated by two threads at once
+     * @param vector<vector<float>>& img input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param vector<vector<float>>& expected output for img and filter
+     * @return int status is 0 if all expressions match
+     */
+    static int testExpressionConv2D(vector<vector<float>>& img,
+                                    vector<vector<float>>& filter,
+                                    vector<vector<float>>& expected);
+
+    /** Check the asynchronous scheduler against the expected output
+     *  - requests from two threads are coalesced into batches
+     *  - a ragged image or filter fails its own future
+     * @param vector<vector<float>>& img input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param vector<vector<float>>& expected output for img and filter
+     * @return int status is 0 if every future holds the expected output
+     */
+    static int testSchedulerConv2D(vector<vector<float>>& img,
+                                   vector<vector<float>>& filter,
+                                   vector<vector<float>>& expected);
+
+    /** Check the NUMA-aware parallel engine on a two node topology,
+     *  with and without filter replication
+     * @param vector<vector<float>>& img input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param vector<vector<float>>& expected output for img and filter
+     * @return int status is 0 if both policies match
+     */
+    static int testParallelConv2D(vector<vector<float>>& img,
+                                  vector<vector<float>>& filter,
+                                  vector<vector<float>>& expected);
+
+    /** Check the out-of-core engine through temporary files
+     *  - the given image in one block, then a larger rectangular
+     *    random image split into many blocks by a small budget
+     *  - the input file given as output, directly and by a hard link,
+     *    refused without truncating it
+     * @param vector<vector<float>>& img input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param vector<vector<float>>& expected output for img and filter
+     * @return int status is 0 if both files match
+     */
+    static int testOutOfCoreConv2D(vector<vector<float>>& img,
+                                   vector<vector<float>>& filter,
+                                   vector<vector<float>>& expected);
+
+    /** Check the backward pass against the definitions
+     *  - filter gradient against a double precision loop, with and
+     *    without the im2col matrix retained by fastConvolve()
+     *  - input gradient through <conv(img,f), g> = <img, dX(g,f)>
+     * @param vector<vector<float>>& img input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param vector<vector<float>>& expected output for img and filter
+     * @return int status is 0 if both gradients match
+     */
+    static int testBackwardConv2D(vector<vector<float>>& img,
+                                  vector<vector<float>>& filter,
+                                  vector<vector<float>>& expected);
+
+    /** Check the grouped engine against per-channel convolve()
+     *  - depthwise over three channels, the first being img/filter
+     *  - four input channels in two groups of three outputs each
+     * @param vector<vector<float>>& img input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param vector<vector<float>>& expected output for img and filter
+     * @return int status is 0 if every output channel matches
+     */
+    static int testGroupedConv2D(vector<vector<float>>& img,
+                                 vector<vector<float>>& filter,
+                                 vector<vector<float>>& expected);
+
+    /** Check layout conversions and layout-aware engines
+     *  - a 5 channel batch through every layout and back, bit exact
+     *  - convolvePlanes() and depthwise convolve() on each layout
+     * @param vector<vector<float>>& img input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param vector<vector<float>>& expected output for img and filter
+     * @return int status is 0 if all layouts agree
+     */
+    static int testLayoutConv2D(vector<vector<float>>& img,
+                                vector<vector<float>>& filter,
+                                vector<vector<float>>& expected);
+
+    /** Check prepared plans of every engine
+     *  - one execute() per engine, then four threads sharing a plan,
+     *    after which the plan holds no more memory than before
+     * @param vector<vector<float>>& img input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param vector<vector<float>>& expected output for img and filter
+     * @return int status is 0 if every execution matches
+     */
+    static int testPlanConv2D(vector<vector<float>>& img,
+                              vector<vector<float>>& filter,
+                              vector<vector<float>>& expected);
+
+    /** Check cachedConvolve() and the counters of FilterCache
+     *  - a miss then a hit for the same filter
+     *  - an eviction when the budget holds a single plan
+     *  - plan memory unchanged by concurrent execute()
+     *  - empty and ragged filters refused
+     * @param vector<vector<float>>& img input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param vector<vector<float>>& expected output for img and filter
+     * @return int status is 0 if outputs and counters are as expected
+     */
+    static int testCacheConv2D(vector<vector<float>>& img,
+                               vector<vector<float>>& filter,
+                               vector<vector<float>>& expected);
+
+    /** Check the uint8/uint16 plan inputs on both engines
+     *  - float output of the plan against expected
+     *  - float output against the widened image, bit exact
+     *  - saturated output with the filter as is and normalized
+     * @param vector<vector<float>>& img input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param vector<vector<float>>& expected output for img and filter
+     * @return int status is 0 if all outputs match
+     */
+    static int testIntegerConv2D(vector<vector<float>>& img,
+                                 vector<vector<float>>& filter,
+                                 vector<vector<float>>& expected);
+
+    /** Check the box, Gaussian and separable plan engines
+     *  - the filter on each exact engine accepting it, against expected
+     *  - box and rank one filters picked by PLAN_AUTO, against convolve()
+     *  - an 11x11 Gaussian on the IIR within tolerance, and on the
+     *    separable engine when the tolerance is too tight
+     * @param vector<vector<float>>& img input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param vector<vector<float>>& expected output for img and filter
+     * @return int status is 0 if engines and outputs are as expected
+     */
+    static int testBlurConv2D(vector<vector<float>>& img,
+                              vector<vector<float>>& filter,
+                              vector<vector<float>>& expected);
+
+    /** Test the shared-memory daemon
+     *  - client threads on their own mappings, more requests in
+     *    flight than slots
+     *  - a completed slot submitted again without rewriting it
+     *  - a second daemon of the same name refused, and the slots of
+     *    a client that exited holding them reclaimed
+     *  - a wait failed by a daemon killed with the request in flight
+     * @param vector<vector<float>>& img input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param vector<vector<float>>& expected output for img and filter
+     * @return int status is 0 if every client request matches expected
+     */
+    static int testDaemonConv2D(vector<vector<float>>& img,
+                                vector<vector<float>>& filter,
+                                vector<vector<float>>& expected);
+
+    /** Test the JIT engine
+     *  - every instruction set of this CPU, and the fastConvolve()
+     *    fallback
+     *  - strides 2 and 3 with the ReLU epilogue
+     *  - kernels shared between engines through the cache
+     * @param vector<vector<float>>& img input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param vector<vector<float>>& expected output for img and filter
+     * @return int status is 0 if every kernel matches expected
+     */
+    static int testJitConv2D(vector<vector<float>>& img,
+                             vector<vector<float>>& filter,
+                             vector<vector<float>>& expected);
+
+    /** Test the morphological and rank filters
+     *  - erode(), dilate() and median() against a sort of every zero
+     *    padded window
+     *  - the window size of the file and the largest one, on the image
+     *    and on a copy with many repeated values
+     * @param vector<vector<float>>& img input matrix image
+     * @param int windowSize side of the window of the file
+     * @return int status is 0 if every filter matches a sort of each
+     *             window
+     */
+    static int testMorphConv2D(vector<vector<float>>& img, int windowSize);
+
+    /** Test the 3D engines
+     *  - direct and vol2col engines, 1 and 3 threads, against the sum
+     *    of k 2D convolutions per output slice
+     *  - volumes of 1, 2 and 5 slices with the file image in the middle
+     *  - the single slice volume against expected
+     * @param vector<vector<float>>& img input matrix image
+     * @param vector<vector<float>>& filter input matrix filter
+     * @param vector<vector<float>>& expected output for img and filter
+     * @return int status is 0 if every engine matches the sum of 2D
+     *             convolutions
+     */
+    static int testVolumeConv2D(vector<vector<float>>& img,
+                                vector<vector<float>>& filter,
+                                vector<vector<float>>& expected);
+
     UnitTest() {}
 public:
 
@@ -61,6 +284,14 @@ public:
      */
     static int testUnitFile(string testFile);
 
+    /** Time the engines on a random image and filter
+     * @param int imgSz input image size
+     * @param int filterSz input filter size
+     * @param int iterations calls per engine
+     * @return int status is 0 on success
+     */
+    static int benchConv2D(int imgSz, int filterSz, int iterations);
+
     ~UnitTest() {}
 };
 #endif
@@ -0,0 +1,300 @@
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * CPython extension module "conv2d" exposing the Convolution2D engines.
+ *
+ * Images and filters are read through the buffer protocol, so NumPy
+ * arrays, array.array and memoryview objects are all accepted. A
+ * C-contiguous, aligned float32 input is read in place by the direct
+ * engine; other layouts and float64 are converted once into a flat
+ * float buffer, and the other engines copy into nested vectors. Input
+ * that overlaps the output buffer is copied first. The GIL is released
+ * while the convolution runs.
+ *
+ *   >>> import numpy as np, conv2d
+ *   >>> out = np.asarray(conv2d.convolve(img32, filt32))
+ *   >>> conv2d.convolve(img32, filt32, engine="fast", out=out)
+ */
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "Convolution2D.hpp"
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+using namespace std;
+
+// Names accepted by the engine keyword, in Convolution2D method order
+static const char* ENGINES[] = { "direct", "naive", "fast", "sparse_filter",
+                                 "sparse_image", "auto", NULL };
+
+/**
+ * Square 2D float view of a Python buffer
+ * Holds the Py_buffer for the lifetime of the view. data points into
+ * the caller's memory for C-contiguous, float aligned float32 buffers
+ * and into the private copy otherwise.
+ */
+struct FloatMatrix {
+    Py_buffer view;
+    bool held;
+    int size;
+    const float* data;
+    vector<float> copy;
+
+    FloatMatrix() : held(false), size(0), data(NULL) {}
+    ~FloatMatrix() {
+        if (held)
+            PyBuffer_Release(&view);
+    }
+};
+
+/**
+ * Acquire a square 2D float32/float64 buffer
+ * @param obj Python object exporting the buffer protocol
+ * @param name argument name used in error messages
+ * @param m filled view
+ * @return bool false with a Python exception set on failure
+ */
+static
+bool getFloatMatrix(PyObject* obj, const char* name, FloatMatrix& m)
+{
+    if (PyObject_GetBuffer(obj, &m.view, PyBUF_RECORDS_RO) != 0)
+        return false;
+    m.held = true;
+    if (m.view.ndim != 2 || m.view.shape[0] != m.view.shape[1]) {
+        PyErr_Format(PyExc_ValueError, "%s must be a square 2D array", name);
+        return false;
+    }
+    const char* fmt = m.view.format ? m.view.format : "B";
+    if (fmt[0] == '<' || fmt[0] == '=' || fmt[0] == '@')
+        ++fmt;
+    bool isFloat = strcmp(fmt, "f") == 0;
+    bool isDouble = strcmp(fmt, "d") == 0;
+    if (!isFloat && !isDouble) {
+        PyErr_Format(PyExc_TypeError,
+                     "%s must hold float32 or float64, not '%s'",
+                     name, m.view.format);
+        return false;
+    }
+    m.size = m.view.shape[0];
+    bool aligned = uintptr_t(m.view.buf) % alignof(float) == 0;
+    if (isFloat && aligned && PyBuffer_IsContiguous(&m.view, 'C')) {
+        // zero copy path
+        m.data = static_cast<const float*>(m.view.buf);
+        return true;
+    }
+    // memcpy, as the elements of a misaligned buffer cannot be
+    // dereferenced in place
+    m.copy.resize(size_t(m.size)*m.size);
+    const char* base = static_cast<const char*>(m.view.buf);
+    for (int i = 0; i < m.size; ++i) {
+        for (int j = 0; j < m.size; ++j) {
+            const char* p = base + i*m.view.strides[0] + j*m.view.strides[1];
+            if (isFloat) {
+                memcpy(&m.copy[i*m.size + j], p, sizeof(float));
+            } else {
+                double value;
+                memcpy(&value, p, sizeof(double));
+                m.copy[i*m.size + j] = float(value);
+            }
+        }
+    }
+    m.data = &m.copy[0];
+    return true;
+}
+
+/**
+ * Copy an in place view that shares memory with the output
+ * The engines read input they have already written otherwise, e.g.
+ * for out=image.
+ * @param m view of an input
+ * @param out output buffer
+ * @param bytes output length
+ */
+static
+void detachFromOutput(FloatMatrix& m, const void* out, size_t bytes)
+{
+    if (m.data == NULL || (!m.copy.empty() && m.data == &m.copy[0]))
+        return;
+    uintptr_t begin = uintptr_t(m.data);
+    uintptr_t end = begin + size_t(m.size)*m.size*sizeof(float);
+    uintptr_t outBegin = uintptr_t(out);
+    if (begin < outBegin + bytes && outBegin < end) {
+        m.copy.assign(m.data, m.data + size_t(m.size)*m.size);
+        m.data = &m.copy[0];
+    }
+}
+
+// utility function to build a nested vector from a flat buffer
+static
+vector<vector<float>> toMatrix(const float* data, int size)
+{
+    vector<vector<float>> matrix(size, vector<float>(size));
+    for (int i = 0; i < size; ++i)
+        memcpy(&matrix[i][0], data + i*size, size*sizeof(float));
+    return matrix;
+}
+
+/**
+ * Run one engine on flat buffers. Called without the GIL.
+ * @param engine index into ENGINES
+ * @param conv2d engine sized for image and filter
+ * @param image row-major image
+ * @param filter row-major filter
+ * @param out row-major output
+ * @param imgSize image size
+ * @param filterSize filter size
+ */
+static
+void runEngine(int engine, Convolution2D& conv2d, const float* image,
+               const float* filter, float* out, int imgSize, int filterSize)
+{
+    if (engine == 0) {
+        conv2d.directConvolve(image, filter, out);
+        return;
+    }
+    vector<vector<float>> img = toMatrix(image, imgSize);
+    vector<vector<float>> flt = toMatrix(filter, filterSize);
+    vector<vector<float>> result;
+    switch (engine) {
+    case 1: result = conv2d.convolve(img, flt); break;
+    case 2: result = conv2d.fastConvolve(img, flt); break;
+    case 3: result = conv2d.sparseFilterConvolve(img, flt); break;
+    case 4: result = conv2d.sparseImageConvolve(img, flt); break;
+    default: result = conv2d.autoConvolve(img, flt); break;
+    }
+    for (int i = 0; i < imgSize; ++i)
+        memcpy(out + i*imgSize, &result[i][0], imgSize*sizeof(float));
+}
+
+/**
+ * conv2d.convolve(image, filter, engine="direct", out=None)
+ * @return out, or a new (n, n) float32 memoryview when out is None
+ */
+static
+PyObject* conv2d_convolve(PyObject* self, PyObject* args, PyObject* kwargs)
+{
+    static const char* kwlist[] = { "image", "filter", "engine", "out",
+                                    NULL };
+    PyObject* imageObj;
+    PyObject* filterObj;
+    const char* engineName = "direct";
+    PyObject* outObj = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|sO",
+                                     const_cast<char**>(kwlist), &imageObj,
+                                     &filterObj, &engineName, &outObj))
+        return NULL;
+
+    int engine = 0;
+    while (ENGINES[engine] && strcmp(ENGINES[engine], engineName) != 0)
+        ++engine;
+    if (!ENGINES[engine]) {
+        PyErr_Format(PyExc_ValueError, "unknown engine '%s'", engineName);
+        return NULL;
+    }
+
+    FloatMatrix image, filter;
+    if (!getFloatMatrix(imageObj, "image", image) ||
+        !getFloatMatrix(filterObj, "filter", filter))
+        return NULL;
+
+    Py_buffer outView;
+    PyObject* result;
+    if (outObj == Py_None) {
+        result = PyByteArray_FromStringAndSize(NULL,
+                         Py_ssize_t(image.size)*image.size*sizeof(float));
+        if (!result)
+            return NULL;
+        if (PyObject_GetBuffer(result, &outView, PyBUF_WRITABLE) != 0) {
+            Py_DECREF(result);
+            return NULL;
+        }
+    } else {
+        if (PyObject_GetBuffer(outObj, &outView,
+                               PyBUF_C_CONTIGUOUS | PyBUF_FORMAT |
+                               PyBUF_WRITABLE) != 0)
+            return NULL;
+        if (outView.len != Py_ssize_t(image.size)*image.size*sizeof(float)
+            || outView.itemsize != sizeof(float) ||
+            (outView.format && strchr(outView.format, 'f') == NULL)) {
+            PyBuffer_Release(&outView);
+            PyErr_SetString(PyExc_ValueError,
+                "out must be a writable C-contiguous float32 array "
+                "of the image shape");
+            return NULL;
+        }
+        Py_INCREF(outObj);
+        result = outObj;
+    }
+
+    string error;
+    float* out = static_cast<float*>(outView.buf);
+    detachFromOutput(image, out, outView.len);
+    detachFromOutput(filter, out, outView.len);
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        Convolution2D conv2d(image.size, filter.size);
+        runEngine(engine, conv2d, image.data, filter.data, out,
+                  image.size, filter.size);
+    } catch (exception& exc) {
+        error = exc.what();
+    }
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&outView);
+
+    if (!error.empty()) {
+        Py_DECREF(result);
+        PyErr_SetString(PyExc_ValueError, error.c_str());
+        return NULL;
+    }
+    if (outObj != Py_None)
+        return result;
+
+    // expose the bytearray as an (n, n) float32 memoryview
+    PyObject* flat = PyMemoryView_FromObject(result);
+    Py_DECREF(result);
+    if (!flat)
+        return NULL;
+    PyObject* shaped = PyObject_CallMethod(flat, "cast", "s(nn)", "f",
+                                           Py_ssize_t(image.size),
+                                           Py_ssize_t(image.size));
+    Py_DECREF(flat);
+    return shaped;
+}
+
+static PyMethodDef Conv2DMethods[] = {
+    { "convolve", (PyCFunction)(void(*)(void))conv2d_convolve,
+      METH_VARARGS | METH_KEYWORDS,
+      "convolve(image, filter, engine='direct', out=None)\n\n"
+      "'same' mode 2D convolution of square float32/float64 buffers.\n"
+      "engine is one of direct, naive, fast, sparse_filter, sparse_image\n"
+      "or auto. engine='direct' reads contiguous float32 input without a\n"
+      "copy unless it overlaps out; the GIL is released during compute." },
+    { NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef conv2dModule = {
+    PyModuleDef_HEAD_INIT,
+    "conv2d",
+    "Convolution2D engines over the buffer protocol.",
+    -1,
+    Conv2DMethods
+};
+
+PyMODINIT_FUNC
+PyInit_conv2d(void)
+{
+    return PyModule_Create(&conv2dModule);
+}
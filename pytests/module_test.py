@@ -0,0 +1,70 @@
+import sys
+import threading
+import numpy as np
+from scipy.signal import convolve2d
+import conv2d
+
+ENGINES = ["direct", "naive", "fast", "sparse_filter", "sparse_image", "auto"]
+
+def reference(img, fltr):
+    # the C++ engines correlate, scipy convolves: flip the filter
+    return convolve2d(img, fltr[::-1, ::-1], mode='same')
+
+def check_engines(img_size, filter_size):
+    img = np.random.rand(img_size, img_size).astype(np.float32)*10
+    fltr = np.random.rand(filter_size, filter_size).astype(np.float32)*10
+    expected = reference(img.astype(np.float64), fltr.astype(np.float64))
+    ok = True
+    for engine in ENGINES:
+        out = np.asarray(conv2d.convolve(img, fltr, engine=engine))
+        if not np.allclose(out, expected, rtol=1e-4, atol=1e-3):
+            print("  %13s FAILED (%d,%d)" % (engine, img_size, filter_size))
+            ok = False
+    # float64 and Fortran ordered input take the converting path
+    out = np.asarray(conv2d.convolve(np.asfortranarray(img, np.float64),
+                                     fltr))
+    ok = ok and np.allclose(out, expected, rtol=1e-4, atol=1e-3)
+    # in place output
+    out = np.empty_like(img)
+    conv2d.convolve(img, fltr, out=out)
+    ok = ok and np.allclose(out, expected, rtol=1e-4, atol=1e-3)
+    # output over the input is read from a copy
+    for engine in ENGINES:
+        same = img.copy()
+        conv2d.convolve(same, fltr, engine=engine, out=same)
+        ok = ok and np.allclose(same, expected, rtol=1e-4, atol=1e-3)
+    return ok
+
+def check_threads(threads=4, calls=200):
+    img = np.random.rand(64, 64).astype(np.float32)
+    fltr = np.random.rand(11, 11).astype(np.float32)
+    expected = np.asarray(conv2d.convolve(img, fltr))
+    errors = []
+    def worker():
+        out = np.empty_like(img)
+        for _ in range(calls):
+            conv2d.convolve(img, fltr, out=out)
+            if not np.array_equal(out, expected):
+                errors.append(1)
+    pool = [threading.Thread(target=worker) for _ in range(threads)]
+    for t in pool:
+        t.start()
+    for t in pool:
+        t.join()
+    return not errors
+
+if __name__ == "__main__":
+    status = 0
+    for img_size, filter_size in [(7, 3), (7, 5), (7, 1), (7, 7), (16, 7),
+                                  (32, 11), (64, 11), (55, 9)]:
+        if check_engines(img_size, filter_size):
+            print("(ImageSize,FilterSize) = (%d,%d) PASSED" %
+                  (img_size, filter_size))
+        else:
+            status = 1
+    if check_threads():
+        print("Concurrent calls PASSED")
+    else:
+        print("Concurrent calls FAILED")
+        status = 1
+    sys.exit(status)
@@ -0,0 +1,347 @@
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * Implementation code for lazy convolution expressions.
+ */
+#include "ConvExpression.hpp"
+#include "Convolution2D.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+// utility function giving the distance of a pixel to the image border
+static inline
+int borderDistance(int x, int y, int n)
+{
+    return min(min(x, y), min(n-1-x, n-1-y));
+}
+
+// utility function combining two cascaded filters into one kernel.
+// correlating with f then g equals correlating with the full
+// convolution of f and g, of size kf + kg - 1
+static
+vector<vector<float>> combineFilters(const vector<vector<float>>& f,
+                                     const vector<vector<float>>& g)
+{
+    size_t kf = f.size();
+    size_t kg = g.size();
+    vector<vector<float>> h(kf+kg-1, vector<float>(kf+kg-1, 0));
+    for (size_t i = 0; i < kf; ++i)
+        for (size_t j = 0; j < kf; ++j)
+            for (size_t p = 0; p < kg; ++p)
+                for (size_t q = 0; q < kg; ++q)
+                    h[i+p][j+q] += f[i][j]*g[p][q];
+    return h;
+}
+
+// utility function adding a scaled filter centered into a larger kernel
+static
+void addCentered(vector<vector<float>>& kernel,
+                 const vector<vector<float>>& f, float scale)
+{
+    size_t off = (kernel.size() - f.size())/2;
+    for (size_t i = 0; i < f.size(); ++i)
+        for (size_t j = 0; j < f.size(); ++j)
+            kernel[i+off][j+off] += scale*f[i][j];
+}
+
+/**
+ * Wrap an image as a leaf of the expression graph
+ * @param image input matrix image
+ * @return leaf expression
+ */
+ConvExpr ConvExpr::image(vector<vector<float>>& image)
+{
+    for (size_t i = 0; i < image.size(); ++i) {
+        if (image[i].size() != image.size()) {
+            throw runtime_error(
+                    string("Fatal error: image should be square"));
+        }
+    }
+    shared_ptr<Node> node = make_shared<Node>();
+    node->type = IMAGE;
+    node->data = image;
+    node->scale = 1;
+    return ConvExpr(node);
+}
+
+/**
+ * Deferred convolution of this expression with a filter
+ * @param filter input matrix filter
+ * @return convolution expression
+ */
+ConvExpr ConvExpr::conv(vector<vector<float>>& filter) const
+{
+    for (size_t i = 0; i < filter.size(); ++i) {
+        if (filter[i].size() != filter.size()) {
+            throw runtime_error(
+                    string("Fatal error: filter should be square"));
+        }
+    }
+    shared_ptr<Node> node = make_shared<Node>();
+    node->type = CONV;
+    node->data = filter;
+    node->scale = 1;
+    node->lhs = mNode;
+    return ConvExpr(node);
+}
+
+/**
+ * Deferred sum of two expressions
+ */
+ConvExpr operator+(const ConvExpr& a, const ConvExpr& b)
+{
+    shared_ptr<ConvExpr::Node> node = make_shared<ConvExpr::Node>();
+    node->type = ConvExpr::ADD;
+    node->scale = 1;
+    node->lhs = a.mNode;
+    node->rhs = b.mNode;
+    return ConvExpr(node);
+}
+
+/**
+ * Deferred product of a scalar and an expression
+ */
+ConvExpr operator*(float s, const ConvExpr& a)
+{
+    shared_ptr<ConvExpr::Node> node = make_shared<ConvExpr::Node>();
+    node->type = ConvExpr::SCALE;
+    node->scale = s;
+    node->lhs = a.mNode;
+    return ConvExpr(node);
+}
+
+ConvExpr operator*(const ConvExpr& a, float s)
+{
+    return s*a;
+}
+
+/**
+ * Expand the graph into a sum of terms
+ * conv(a + b, f) = conv(a, f) + conv(b, f) and conv(s*a, f) = s*conv(a, f)
+ * so every expression is a sum of scaled filter chains over leaves.
+ * @param node sub-expression to expand
+ * @param scale product of enclosing scalars
+ * @param after filters applied after this node, innermost first
+ * @param terms output list of terms
+ */
+void ConvExpr::expand(const Node* node, float scale,
+                      vector<const vector<vector<float>>*>& after,
+                      vector<Term>& terms)
+{
+    switch (node->type) {
+    case IMAGE: {
+        Term term;
+        term.leaf = node;
+        term.chain = after;
+        term.scale = scale;
+        terms.push_back(term);
+        break;
+    }
+    case CONV: {
+        vector<const vector<vector<float>>*> chain(1, &node->data);
+        chain.insert(chain.end(), after.begin(), after.end());
+        expand(node->lhs.get(), scale, chain, terms);
+        break;
+    }
+    case ADD:
+        expand(node->lhs.get(), scale, after, terms);
+        expand(node->rhs.get(), scale, after, terms);
+        break;
+    case SCALE:
+        expand(node->lhs.get(), scale*node->scale, after, terms);
+        break;
+    }
+}
+
+/**
+ * Evaluate one term on the border band only
+ * Separate 'same' passes drop the intermediate values that fall
+ * outside the image, so a combined kernel is exact only for pixels
+ * further from the border than the radii of the later filters. Each
+ * stage is computed on the strips the next stages read from.
+ * @param term term to evaluate
+ * @param band width of the border band
+ * @param out accumulates the term on the band
+ */
+void ConvExpr::addTermOnBand(const Term& term, int band,
+                             vector<vector<float>>& out)
+{
+    int n = term.leaf->data.size();
+    vector<vector<float>> cur = term.leaf->data;
+    float scale = term.scale;
+    for (size_t s = 0; s < term.chain.size(); ++s) {
+        int width = band;
+        for (size_t j = s+1; j < term.chain.size(); ++j)
+            width += term.chain[j]->size()/2;
+        vector<vector<float>> filter = *term.chain[s];
+        if (s == 0) {
+            for (size_t i = 0; i < filter.size(); ++i)
+                for (size_t j = 0; j < filter.size(); ++j)
+                    filter[i][j] *= scale;
+            scale = 1;
+        }
+        Convolution2D conv2d(n, filter.size());
+        vector<vector<float>> next(n, vector<float>(n, 0));
+        if (2*width >= n) {
+            conv2d.convolveRegion(cur, filter, next, 0, 0, n, n);
+        } else {
+            conv2d.convolveRegion(cur, filter, next, 0, 0, width, n);
+            conv2d.convolveRegion(cur, filter, next, n-width, 0, n, n);
+            conv2d.convolveRegion(cur, filter, next, width, 0, n-width, width);
+            conv2d.convolveRegion(cur, filter, next, width, n-width,
+                                  n-width, n);
+        }
+        cur.swap(next);
+    }
+    for (int x = 0; x < n; ++x)
+        for (int y = 0; y < n; ++y)
+            if (borderDistance(x, y, n) < band)
+                out[x][y] += scale*cur[x][y];
+}
+
+/**
+ * Optimize and evaluate the expression
+ * - expand into terms and group them by leaf image
+ * - per leaf, sum all single filters (scalars folded in) into one
+ *   kernel, and merge cascades whose combined kernel grows the merged
+ *   kernel by fewer taps than the cascade costs on its own
+ * - run one pass per leaf for the merged kernel, fixing up the border
+ *   band of merged cascades, and separate passes for the rest
+ * The pass count is returned rather than kept in the expression, so
+ * one expression can be evaluated by several threads at once.
+ * @param passes set to the full convolution passes used
+ * @return value of the expression
+ */
+vector<vector<float>> ConvExpr::evaluate(int& passes) const
+{
+    vector<Term> terms;
+    vector<const vector<vector<float>>*> none;
+    expand(mNode.get(), 1, none, terms);
+
+    int n = terms[0].leaf->data.size();
+    for (size_t t = 0; t < terms.size(); ++t) {
+        if (terms[t].leaf->data.size() != n) {
+            throw runtime_error(
+                    string("Fatal error: expression mixes image sizes"));
+        }
+    }
+
+    passes = 0;
+    vector<vector<float>> result(n, vector<float>(n, 0));
+    vector<char> done(terms.size(), 0);
+    for (size_t g = 0; g < terms.size(); ++g) {
+        if (done[g])
+            continue;
+        const Node* leaf = terms[g].leaf;
+        vector<Term> group;
+        for (size_t t = g; t < terms.size(); ++t) {
+            if (terms[t].leaf == leaf) {
+                group.push_back(terms[t]);
+                done[t] = 1;
+            }
+        }
+
+        // single filters always merge: max(k)^2 <= sum(k^2)
+        vector<Term> merged;
+        vector<Term> separate;
+        int kernelSize = 0;
+        for (size_t t = 0; t < group.size(); ++t) {
+            if (group[t].chain.size() <= 1) {
+                int k = group[t].chain.empty() ? 1 : group[t].chain[0]->size();
+                kernelSize = max(kernelSize, k);
+                merged.push_back(group[t]);
+            }
+        }
+        int band = 0;
+        for (size_t t = 0; t < group.size(); ++t) {
+            if (group[t].chain.size() <= 1)
+                continue;
+            int combined = 1;
+            int cost = 0;
+            int later = 0;
+            for (size_t j = 0; j < group[t].chain.size(); ++j) {
+                int k = group[t].chain[j]->size();
+                combined += k - 1;
+                cost += k*k;
+                if (j > 0)
+                    later += k/2;
+            }
+            int grown = max(kernelSize, combined);
+            if (combined <= Convolution2D::MAX_FILTER_SIZE &&
+                grown*grown - kernelSize*kernelSize <= cost) {
+                kernelSize = grown;
+                band = max(band, later);
+                merged.push_back(group[t]);
+            } else {
+                separate.push_back(group[t]);
+            }
+        }
+
+        vector<vector<float>> leafImage = leaf->data;
+        if (!merged.empty()) {
+            vector<vector<float>> kernel(kernelSize,
+                                         vector<float>(kernelSize, 0));
+            for (size_t t = 0; t < merged.size(); ++t) {
+                vector<vector<float>> combined(1, vector<float>(1, 1));
+                for (size_t j = 0; j < merged[t].chain.size(); ++j)
+                    combined = combineFilters(combined, *merged[t].chain[j]);
+                addCentered(kernel, combined, merged[t].scale);
+            }
+            Convolution2D conv2d(n, kernelSize);
+            vector<vector<float>> out = conv2d.autoConvolve(leafImage, kernel);
+            ++passes;
+            if (band > 0) {
+                vector<vector<float>> exact(n, vector<float>(n, 0));
+                for (size_t t = 0; t < merged.size(); ++t)
+                    addTermOnBand(merged[t], band, exact);
+                for (int x = 0; x < n; ++x)
+                    for (int y = 0; y < n; ++y)
+                        if (borderDistance(x, y, n) < band)
+                            out[x][y] = exact[x][y];
+            }
+            for (int x = 0; x < n; ++x)
+                for (int y = 0; y < n; ++y)
+                    result[x][y] += out[x][y];
+        }
+
+        for (size_t t = 0; t < separate.size(); ++t) {
+            vector<vector<float>> cur = leafImage;
+            for (size_t j = 0; j < separate[t].chain.size(); ++j) {
+                vector<vector<float>> filter = *separate[t].chain[j];
+                if (j == 0) {
+                    for (size_t i = 0; i < filter.size(); ++i)
+                        for (size_t l = 0; l < filter.size(); ++l)
+                            filter[i][l] *= separate[t].scale;
+                }
+                Convolution2D conv2d(n, filter.size());
+                cur = conv2d.autoConvolve(cur, filter);
+                ++passes;
+            }
+            for (int x = 0; x < n; ++x)
+                for (int y = 0; y < n; ++y)
+                    result[x][y] += cur[x][y];
+        }
+    }
+    return result;
+}
+
+/**
+ * Optimize and evaluate the expression, without the pass count
+ * @return value of the expression
+ */
+vector<vector<float>> ConvExpr::evaluate() const
+{
+    int passes = 0;
+    return evaluate(passes);
+}
@@ -14,6 +14,7 @@
  * Implementation code for convolution2D using naive and fast methods.
  */
 #include "Convolution2D.hpp"
+#include "FilterCache.hpp"
 #include <cassert>
 #include <cstdlib>
 #include <ctime>
@@ -23,6 +24,19 @@
 #include <stdexcept>
 #include <iostream>
 
+const float Convolution2D::SPARSE_WORK_RATIO = 0.5;
+
+// utility function to count the non-zero values of a matrix
+static
+size_t countNonZero(vector<vector<float>>& matrix)
+{
+    size_t nnz = 0;
+    for (size_t i = 0; i < matrix.size(); ++i)
+        nnz += matrix[i].size() - count(matrix[i].begin(),
+                                        matrix[i].end(), 0.0f);
+    return nnz;
+}
+
 /**
  * Constructor 
  * Verifies the size of filter and image and assumes square matrices.
@@ -30,14 +44,16 @@
  * @param filterSize size of filter
  */
 Convolution2D::Convolution2D(int imgSize, int filterSize): 
-                             mImgSize(imgSize), mFilterSize(filterSize) 
+                             mImgSize(imgSize), mFilterSize(filterSize),
+                             mRetainIm2col(false)
 {
-    if (filterSize <= 0 || filterSize > 11 || (filterSize % 2) == 0) {
+    if (filterSize <= 0 || filterSize > MAX_FILTER_SIZE ||
+        (filterSize % 2) == 0) {
         throw runtime_error(
          string("Fatal error: filter size should be in range 1-11 and odd"));
     }
 
-    if (imgSize > 64 || imgSize <= 4) {
+    if (imgSize > MAX_IMAGE_SIZE || imgSize <= 4) {
         throw runtime_error(
                 string("Fatal error: image size  <= 4 and > 64 unsupported"));
     }
@@ -138,40 +154,37 @@ vector<vector<float>> Convolution2D::convolve(vector<vector<float>>& image,
 }
 
 /**
- * Fast 2D convolution
- * Assume 'same' mode, i.e., input and output images are of same size
- * - using im2col to create [k^2,n^2] image and then matrix multiplication
- * @param image input matrix image
+ * Flatten filter
  * @param filter input matrix filter
- * @return returns convolve2D output matrix
+ * @return 1xk^2 matrix for matrix multiplication
  */
-vector<vector<float>> Convolution2D::fastConvolve(vector<vector<float>>& image,
-                                                vector<vector<float>>& filter)
+vector<vector<float>>
+Convolution2D::flattenFilter(vector<vector<float>>& filter)
 {
-    assert(filter.size() == mFilterSize);
-    assert(filter[0].size() == mFilterSize);
-    assert(image.size() == mImgSize);
-    assert(image[0].size() == mImgSize);
-
     vector<vector<float>> flattenedFilter(1, 
                           vector<float>(mFilterSize*mFilterSize,0));
     for (size_t i = 0; i < mFilterSize; ++i) {
         copy_n(filter[i].begin(), mFilterSize, 
                flattenedFilter[0].begin() + i*mFilterSize);
     }
+    return flattenedFilter;
+}
 
-    vector<vector<float>> inImage(mFilterSize*mFilterSize, 
-                                   vector<float>(mImgSize*mImgSize, 0));
-    vector<float*> colPtr;
+/**
+ * im2col
+ * Copies every k x k window of the image into one column. Columns
+ * outside the image are left untouched, so the destination has to be
+ * zero initialized.
+ * @param image input matrix image
+ * @param colPtr column pointers, one per im2col row
+ */
+void Convolution2D::im2col(vector<vector<float>>& image,
+                           vector<float*>& colPtr)
+{
     register int hFltrSz = (mFilterSize+1)/2;
-    for (size_t i = 0; i < inImage.size(); ++i) {
-        colPtr.push_back(&inImage[i][0]);
-    }
-
     // loop over column element addresses
     for (int x = 0; x < mImgSize; ++x) {
         for (int y = 0; y < mImgSize; ++y) {
-            vector<float> chunk(mFilterSize*mFilterSize, 0);
             int startx = max(hFltrSz-1-x, 0);
             int starty = max(hFltrSz-1-y, 0);
             int endx = mFilterSize + min(mImgSize - x - hFltrSz,0);
@@ -188,15 +201,415 @@ vector<vector<float>> Convolution2D::fastConvolve(vector<vector<float>>& image,
                       [] (float* x) { return ++x;});
         }
     }
+}
+
+/**
+ * Fast 2D convolution
+ * Assume 'same' mode, i.e., input and output images are of same size
+ * - using im2col to create [k^2,n^2] image and then matrix multiplication
+ * @param image input matrix image
+ * @param filter input matrix filter
+ * @return returns convolve2D output matrix
+ */
+vector<vector<float>> Convolution2D::fastConvolve(vector<vector<float>>& image,
+                                                vector<vector<float>>& filter)
+{
+    assert(filter.size() == mFilterSize);
+    assert(filter[0].size() == mFilterSize);
+    assert(image.size() == mImgSize);
+    assert(image[0].size() == mImgSize);
+
+    vector<vector<float>> flattenedFilter = flattenFilter(filter);
+
+    vector<vector<float>> inImage(mFilterSize*mFilterSize, 
+                                   vector<float>(mImgSize*mImgSize, 0));
+    vector<float*> colPtr;
+    for (size_t i = 0; i < inImage.size(); ++i) {
+        colPtr.push_back(&inImage[i][0]);
+    }
+    im2col(image, colPtr);
+
     // allocate output image size
     vector<vector<float>> result(mImgSize, vector<float>(mImgSize, 0));
     vector<vector<float>> outImage =  matrixMultiply(flattenedFilter, inImage);
     for (int i = 0; i < mImgSize; ++i) {
         copy_n(outImage[0].begin() + i*mImgSize, mImgSize, result[i].begin());
     }
+    if (mRetainIm2col)
+        mIm2col.swap(inImage);
     return result;
 }
 
+/**
+ * Retain the im2col matrix of fastConvolve()
+ * @param retain true to keep the matrix of the last call
+ */
+void Convolution2D::retainIm2col(bool retain)
+{
+    mRetainIm2col = retain;
+    if (!retain)
+        vector<vector<float>>().swap(mIm2col);
+}
+
+/**
+ * Filter gradient
+ * Builds the im2col matrix of the forward image and reuses the
+ * retained-matrix overload.
+ * @param image forward input image
+ * @param outGrad gradient of the output
+ * @return k x k filter gradient
+ */
+vector<vector<float>>
+Convolution2D::weightGradient(vector<vector<float>>& image,
+                              vector<vector<float>>& outGrad)
+{
+    assert(image.size() == mImgSize);
+    assert(image[0].size() == mImgSize);
+
+    vector<vector<float>> columns(mFilterSize*mFilterSize,
+                                  vector<float>(mImgSize*mImgSize, 0));
+    vector<float*> colPtr;
+    for (size_t i = 0; i < columns.size(); ++i) {
+        colPtr.push_back(&columns[i][0]);
+    }
+    im2col(image, colPtr);
+    columns.swap(mIm2col);
+    vector<vector<float>> grad = weightGradient(outGrad);
+    columns.swap(mIm2col);
+    return grad;
+}
+
+/**
+ * Filter gradient from the retained im2col matrix
+ * Every im2col row holds one filter tap over all windows, so the
+ * gradient of that tap is its dot product with the output gradient.
+ * @param outGrad gradient of the output
+ * @return k x k filter gradient
+ */
+vector<vector<float>>
+Convolution2D::weightGradient(vector<vector<float>>& outGrad)
+{
+    assert(outGrad.size() == mImgSize);
+    assert(outGrad[0].size() == mImgSize);
+    if (mIm2col.size() != mFilterSize*mFilterSize) {
+        throw runtime_error(
+                string("Fatal error: no im2col matrix retained"));
+    }
+
+    vector<float> flatGrad;
+    for (int i = 0; i < mImgSize; ++i)
+        flatGrad.insert(flatGrad.end(), outGrad[i].begin(), outGrad[i].end());
+    vector<vector<float>> grad(mFilterSize, vector<float>(mFilterSize, 0));
+    for (int t = 0; t < mFilterSize*mFilterSize; ++t) {
+        grad[t/mFilterSize][t%mFilterSize] = inner_product(
+                mIm2col[t].begin(), mIm2col[t].end(), flatGrad.begin(),
+                float(0.0));
+    }
+    return grad;
+}
+
+/**
+ * Input gradient (transposed convolution)
+ * - column gradients are the [k^2,1]x[1,n^2] product of the flattened
+ *   filter and output gradient, then col2im folds them into the image
+ * @param outGrad gradient of the output
+ * @param filter forward filter
+ * @return n x n image gradient
+ */
+vector<vector<float>>
+Convolution2D::inputGradient(vector<vector<float>>& outGrad,
+                             vector<vector<float>>& filter)
+{
+    assert(filter.size() == mFilterSize);
+    assert(filter[0].size() == mFilterSize);
+    assert(outGrad.size() == mImgSize);
+    assert(outGrad[0].size() == mImgSize);
+
+    vector<vector<float>> flattenedFilter = flattenFilter(filter);
+    vector<vector<float>> filterColumn(mFilterSize*mFilterSize,
+                                       vector<float>(1, 0));
+    for (int t = 0; t < mFilterSize*mFilterSize; ++t)
+        filterColumn[t][0] = flattenedFilter[0][t];
+    vector<vector<float>> flatGrad(1, vector<float>());
+    for (int i = 0; i < mImgSize; ++i)
+        flatGrad[0].insert(flatGrad[0].end(), outGrad[i].begin(),
+                           outGrad[i].end());
+    vector<vector<float>> columns = matrixMultiply(filterColumn, flatGrad);
+    return col2im(columns);
+}
+
+/**
+ * col2im
+ * Column (x,y) row (i,j) came from image pixel (x+i-r, y+j-r), so
+ * image pixel (p,q) gathers row (i,j) of column (p-i+r, q-j+r). Image
+ * rows are processed COL2IM_BLOCK at a time so the block being summed
+ * stays in cache while all taps are visited.
+ * @param columns k^2 x n^2 column matrix
+ * @return n x n image
+ */
+vector<vector<float>> Convolution2D::col2im(vector<vector<float>>& columns)
+{
+    int radius = mFilterSize/2;
+    vector<vector<float>> image(mImgSize, vector<float>(mImgSize, 0));
+    for (int p0 = 0; p0 < mImgSize; p0 += COL2IM_BLOCK) {
+        int p1 = min(p0 + COL2IM_BLOCK, mImgSize);
+        for (int i = 0; i < mFilterSize; ++i) {
+            for (int j = 0; j < mFilterSize; ++j) {
+                const vector<float>& row = columns[i*mFilterSize + j];
+                // source column (x,y) must lie inside the image
+                int q0 = max(j - radius, 0);
+                int q1 = min(mImgSize + j - radius, mImgSize);
+                for (int p = p0; p < p1; ++p) {
+                    int x = p - i + radius;
+                    if (x < 0 || x >= mImgSize)
+                        continue;
+                    int base = x*mImgSize - j + radius;
+                    vector<float>& dst = image[p];
+                    for (int q = q0; q < q1; ++q)
+                        dst[q] += row[base + q];
+                }
+            }
+        }
+    }
+    return image;
+}
+
+/**
+ * Fast 2D convolution of a batch
+ * Assume 'same' mode, i.e., input and output images are of same size
+ * - using im2col to create [k^2,b*n^2] image and one matrix multiplication
+ * @param images input images, all of size mImgSize
+ * @param filter input matrix filter
+ * @return returns convolve2D output matrices, in input order
+ */
+vector<vector<vector<float>>>
+Convolution2D::fastConvolveBatch(vector<vector<vector<float>>>& images,
+                                 vector<vector<float>>& filter)
+{
+    assert(filter.size() == mFilterSize);
+    assert(filter[0].size() == mFilterSize);
+
+    vector<vector<vector<float>>> results;
+    if (images.empty())
+        return results;
+
+    vector<vector<float>> flattenedFilter = flattenFilter(filter);
+    size_t pixels = mImgSize*mImgSize;
+    vector<vector<float>> inImage(mFilterSize*mFilterSize, 
+                                  vector<float>(images.size()*pixels, 0));
+    vector<float*> colPtr;
+    for (size_t i = 0; i < inImage.size(); ++i) {
+        colPtr.push_back(&inImage[i][0]);
+    }
+    for (size_t b = 0; b < images.size(); ++b) {
+        assert(images[b].size() == mImgSize);
+        assert(images[b][0].size() == mImgSize);
+        im2col(images[b], colPtr);
+    }
+
+    vector<vector<float>> outImage =  matrixMultiply(flattenedFilter, inImage);
+    results.resize(images.size(),
+                   vector<vector<float>>(mImgSize, vector<float>(mImgSize)));
+    for (size_t b = 0; b < images.size(); ++b) {
+        for (int i = 0; i < mImgSize; ++i) {
+            copy_n(outImage[0].begin() + b*pixels + i*mImgSize, mImgSize,
+                   results[b][i].begin());
+        }
+    }
+    return results;
+}
+
+/**
+ * Direct 2D convolution on contiguous buffers
+ * Assume 'same' mode, i.e., input and output images are of same size
+ * - same window bounds as convolve(), dot products read the caller's
+ *   buffers in place so callers holding flat arrays need no copy
+ * @param image row-major input image
+ * @param filter row-major filter
+ * @param outImage row-major output image
+ */
+void Convolution2D::directConvolve(const float* image, const float* filter,
+                                   float* outImage) const
+{
+    register int hFltrSz = (mFilterSize+1)/2;
+    for (int x = 0; x < mImgSize; ++x) {
+        for (int y = 0; y < mImgSize; ++y) {
+            int startx = max(hFltrSz-1-x, 0);
+            int starty = max(hFltrSz-1-y, 0);
+            int endx = mFilterSize + min(mImgSize - x - hFltrSz,0);
+            int endy = mFilterSize + min(mImgSize - y - hFltrSz,0);
+            float sum = 0;
+            for (int i = startx; i < endx; ++i) {
+                const float* in = image + (x+i-hFltrSz+1)*mImgSize
+                                        + y+starty-hFltrSz+1;
+                const float* flt = filter + i*mFilterSize + starty;
+                for (int j = 0; j < endy-starty; ++j)
+                    sum += flt[j]*in[j];
+            }
+            outImage[x*mImgSize + y] = sum;
+        }
+    }
+}
+
+/**
+ * Sparse filter 2D convolution
+ * Assume 'same' mode, i.e., input and output images are of same size
+ * - compress the filter into a list of non-zero taps, then for each tap
+ *   accumulate the shifted image rows over the valid output range
+ * @param image input matrix image
+ * @param filter input matrix filter
+ * @return returns convolve2D output matrix
+ */
+vector<vector<float>>
+Convolution2D::sparseFilterConvolve(vector<vector<float>>& image,
+                                    vector<vector<float>>& filter)
+{
+    assert(filter.size() == mFilterSize);
+    assert(filter[0].size() == mFilterSize);
+    assert(image.size() == mImgSize);
+    assert(image[0].size() == mImgSize);
+
+    // tap list of (row offset, column offset, weight)
+    int radius = mFilterSize/2;
+    vector<int> tapX, tapY;
+    vector<float> tapW;
+    for (int i = 0; i < mFilterSize; ++i) {
+        for (int j = 0; j < mFilterSize; ++j) {
+            if (filter[i][j] != 0) {
+                tapX.push_back(i - radius);
+                tapY.push_back(j - radius);
+                tapW.push_back(filter[i][j]);
+            }
+        }
+    }
+
+    vector<vector<float>> outImage(mImgSize, vector<float>(mImgSize, 0));
+    for (size_t t = 0; t < tapW.size(); ++t) {
+        // output rows/columns whose shifted input stays in the image
+        int x0 = max(-tapX[t], 0);
+        int x1 = mImgSize - max(tapX[t], 0);
+        int y0 = max(-tapY[t], 0);
+        int y1 = mImgSize - max(tapY[t], 0);
+        float w = tapW[t];
+        for (int x = x0; x < x1; ++x) {
+            vector<float>& out = outImage[x];
+            vector<float>& in = image[x + tapX[t]];
+            int dy = tapY[t];
+            for (int y = y0; y < y1; ++y)
+                out[y] += w * in[y + dy];
+        }
+    }
+    return outImage;
+}
+
+/**
+ * Sparse image 2D convolution
+ * Assume 'same' mode, i.e., input and output images are of same size
+ * - scatter every non-zero input pixel into the outputs that read it
+ * @param image input matrix image
+ * @param filter input matrix filter
+ * @return returns convolve2D output matrix
+ */
+vector<vector<float>>
+Convolution2D::sparseImageConvolve(vector<vector<float>>& image,
+                                   vector<vector<float>>& filter)
+{
+    assert(filter.size() == mFilterSize);
+    assert(filter[0].size() == mFilterSize);
+    assert(image.size() == mImgSize);
+    assert(image[0].size() == mImgSize);
+
+    int radius = mFilterSize/2;
+    vector<vector<float>> outImage(mImgSize, vector<float>(mImgSize, 0));
+    for (int p = 0; p < mImgSize; ++p) {
+        for (int q = 0; q < mImgSize; ++q) {
+            float v = image[p][q];
+            if (v == 0)
+                continue;
+            // input (p,q) is read by output (p-i+r, q-j+r) via tap (i,j)
+            int i0 = max(p + radius - mImgSize + 1, 0);
+            int i1 = min(p + radius + 1, mFilterSize);
+            int j0 = max(q + radius - mImgSize + 1, 0);
+            int j1 = min(q + radius + 1, mFilterSize);
+            for (int i = i0; i < i1; ++i) {
+                vector<float>& out = outImage[p - i + radius];
+                for (int j = j0; j < j1; ++j)
+                    out[q + radius - j] += v * filter[i][j];
+            }
+        }
+    }
+    return outImage;
+}
+
+/**
+ * Density driven 2D convolution
+ * Estimates the work of each engine from the number of non-zeros
+ * and runs the cheapest one.
+ * @param image input matrix image
+ * @param filter input matrix filter
+ * @return returns convolve2D output matrix
+ */
+vector<vector<float>> Convolution2D::autoConvolve(vector<vector<float>>& image,
+                                                vector<vector<float>>& filter)
+{
+    float pixels = float(mImgSize)*mImgSize;
+    float taps = float(mFilterSize)*mFilterSize;
+    float denseWork = taps*pixels;
+    float filterWork = countNonZero(filter)*pixels;
+    float imageWork = countNonZero(image)*taps;
+
+    if (min(filterWork, imageWork) > SPARSE_WORK_RATIO*denseWork)
+        return fastConvolve(image, filter);
+    if (filterWork <= imageWork)
+        return sparseFilterConvolve(image, filter);
+    return sparseImageConvolve(image, filter);
+}
+
+/**
+ * 2D convolution over a rectangular region of the output
+ * Same window bounds as convolve(), but the dot product is taken
+ * directly over the image rows so no chunk matrix is allocated.
+ * @param image input matrix image
+ * @param filter input matrix filter
+ * @param outImage output matrix of size mImgSize x mImgSize
+ * @param x0 first output row
+ * @param y0 first output column
+ * @param x1 one past the last output row
+ * @param y1 one past the last output column
+ */
+void Convolution2D::convolveRegion(vector<vector<float>>& image,
+                                   vector<vector<float>>& filter,
+                                   vector<vector<float>>& outImage,
+                                   int x0, int y0, int x1, int y1)
+{
+    assert(filter.size() == mFilterSize);
+    assert(image.size() == mImgSize);
+    assert(outImage.size() == mImgSize);
+
+    // clip the region to the image
+    x0 = max(x0, 0);
+    y0 = max(y0, 0);
+    x1 = min(x1, mImgSize);
+    y1 = min(y1, mImgSize);
+    register int hFltrSz = (mFilterSize+1)/2;
+    for (int x = x0; x < x1; ++x) {
+        for (int y = y0; y < y1; ++y) {
+            int startx = max(hFltrSz-1-x, 0);
+            int starty = max(hFltrSz-1-y, 0);
+            int endx = mFilterSize + min(mImgSize - x - hFltrSz,0);
+            int endy = mFilterSize + min(mImgSize - y - hFltrSz,0);
+            float sum = 0;
+            for (int i = startx; i < endx; ++i) {
+                sum = inner_product(filter[i].begin() + starty,
+                        filter[i].begin() + endy,
+                        image[x+i-hFltrSz+1].begin() + y+starty-hFltrSz+1,
+                        sum);
+            }
+            outImage[x][y] = sum;
+        }
+    }
+}
+
 /**
  * Create Random Image using mImgSize
  * @return random image input matrix
@@ -226,3 +639,51 @@ vector<vector<float>> Convolution2D::createRandFilter()
     }
     return filter;
 }
+
+/**
+ * Cached 2D convolution
+ * @param image input matrix image
+ * @param filter input matrix filter
+ * @param tolerance see PlanOptions::tolerance
+ * @return 2D convolution results
+ */
+vector<vector<float>>
+Convolution2D::cachedConvolve(vector<vector<float>>& image,
+                              vector<vector<float>>& filter,
+                              float tolerance)
+{
+    assert(filter.size() == mFilterSize);
+    assert(filter[0].size() == mFilterSize);
+    return FilterCache::instance().get(mImgSize, filter, PLAN_AUTO,
+                                       tolerance)->execute(image);
+}
+
+/**
+ * Planar convolution of a tensor
+ * Every NCHW plane is a flat row-major image, so directConvolve() runs
+ * on the tensor memory in place.
+ * @param image n x n images, any layout
+ * @param filter input matrix filter
+ * @return NCHW output of the same shape
+ */
+ImageTensor Convolution2D::convolvePlanes(const ImageTensor& image,
+                                          vector<vector<float>>& filter)
+{
+    assert(image.height() == mImgSize && image.width() == mImgSize);
+    assert(filter.size() == mFilterSize);
+    if (image.layout() != preferredLayout())
+        return convolvePlanes(image.to(preferredLayout()), filter);
+
+    vector<float> flatFilter;
+    for (int i = 0; i < mFilterSize; ++i)
+        flatFilter.insert(flatFilter.end(), filter[i].begin(),
+                          filter[i].end());
+    ImageTensor result(image.batch(), image.channels(), mImgSize, mImgSize,
+                       NCHW);
+    size_t plane = size_t(mImgSize)*mImgSize;
+    for (size_t p = 0; p < image.size()/plane; ++p) {
+        directConvolve(image.data() + p*plane, &flatFilter[0],
+                       result.data() + p*plane);
+    }
+    return result;
+}
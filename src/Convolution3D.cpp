@@ -0,0 +1,280 @@
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * Implementation code for 3D volumetric convolution.
+ */
+#include "Convolution3D.hpp"
+#include "Convolution2D.hpp"
+#include <cassert>
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+/**
+ * Constructor
+ * @param depth slices of the volume
+ * @param imgSize size of a slice
+ * @param filterSize size of filter
+ * @param threads workers, 0 for hardware concurrency
+ */
+Convolution3D::Convolution3D(int depth, int imgSize, int filterSize,
+                             int threads):
+                             mDepth(depth), mImgSize(imgSize),
+                             mFilterSize(filterSize), mThreads(threads)
+{
+    // same slice and filter checks as the 2D engines
+    Convolution2D check(imgSize, filterSize);
+    if (depth <= 0) {
+        throw runtime_error(string("Fatal error: volume without slices"));
+    }
+    if (mThreads <= 0)
+        mThreads = max(int(thread::hardware_concurrency()), 1);
+    mThreads = min(mThreads, mDepth);
+}
+
+/**
+ * Load one input slice into the rolling buffer
+ * Only the interior is written, the border of a slot stays zero.
+ * @param volume flat input volume
+ * @param z input slice
+ * @param ring k padded slices
+ */
+void Convolution3D::loadSlice(const float* volume, int z,
+                              vector<float>& ring) const
+{
+    int padded = mImgSize + mFilterSize - 1;
+    int radius = mFilterSize/2;
+    float* slot = &ring[0] + size_t((z%mFilterSize + mFilterSize)%
+                                    mFilterSize)*padded*padded;
+    if (z < 0 || z >= mDepth) {
+        fill(slot, slot + padded*padded, 0.0f);
+        return;
+    }
+    const float* in = volume + size_t(z)*mImgSize*mImgSize;
+    for (int x = 0; x < mImgSize; ++x)
+        copy_n(in + x*mImgSize, mImgSize,
+               slot + (x + radius)*padded + radius);
+}
+
+/**
+ * Direct engine over a range of output slices
+ * The first output slice of the range loads all k input slices, every
+ * following one loads the single slice entering the window.
+ * @param volume flat input volume
+ * @param filter flat filter
+ * @param outVolume flat output volume
+ * @param zBegin first output slice
+ * @param zEnd one past the last output slice
+ */
+void Convolution3D::directSlices(const float* volume, const float* filter,
+                                 float* outVolume, int zBegin,
+                                 int zEnd) const
+{
+    int n = mImgSize;
+    int k = mFilterSize;
+    int radius = k/2;
+    int padded = n + k - 1;
+    vector<float> ring(size_t(k)*padded*padded, 0);
+    for (int z = zBegin; z < zEnd; ++z) {
+        if (z == zBegin) {
+            for (int dz = -radius; dz <= radius; ++dz)
+                loadSlice(volume, z + dz, ring);
+        } else {
+            loadSlice(volume, z + radius, ring);
+        }
+        float* out = outVolume + size_t(z)*n*n;
+        fill(out, out + n*n, 0.0f);
+        for (int dz = 0; dz < k; ++dz) {
+            int zIn = z + dz - radius;
+            const float* slot = &ring[0] +
+                                size_t((zIn%k + k)%k)*padded*padded;
+            const float* taps = filter + dz*k*k;
+            for (int x = 0; x < n; ++x) {
+                float* row = out + x*n;
+                for (int i = 0; i < k; ++i) {
+                    const float* in = slot + (x + i)*padded;
+                    for (int j = 0; j < k; ++j) {
+                        float w = taps[i*k + j];
+                        if (w == 0)
+                            continue;
+                        for (int y = 0; y < n; ++y)
+                            row[y] += w*in[y + j];
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * vol2col engine over a range of output slices
+ * Row t = (dz*k + i)*k + j of the matrix holds tap t for every output
+ * voxel of the slice, so the product with the filter streams through
+ * it row by row, as fastConvolve() does in 2D.
+ * @param volume flat input volume
+ * @param filter flat filter
+ * @param outVolume flat output volume
+ * @param zBegin first output slice
+ * @param zEnd one past the last output slice
+ */
+void Convolution3D::gemmSlices(const float* volume, const float* filter,
+                               float* outVolume, int zBegin, int zEnd) const
+{
+    int n = mImgSize;
+    int k = mFilterSize;
+    int radius = k/2;
+    int padded = n + k - 1;
+    int taps = k*k*k;
+    vector<float> ring(size_t(k)*padded*padded, 0);
+    vector<float> columns(size_t(taps)*n*n);
+    for (int z = zBegin; z < zEnd; ++z) {
+        if (z == zBegin) {
+            for (int dz = -radius; dz <= radius; ++dz)
+                loadSlice(volume, z + dz, ring);
+        } else {
+            loadSlice(volume, z + radius, ring);
+        }
+        for (int dz = 0; dz < k; ++dz) {
+            int zIn = z + dz - radius;
+            const float* slot = &ring[0] +
+                                size_t((zIn%k + k)%k)*padded*padded;
+            for (int i = 0; i < k; ++i) {
+                for (int j = 0; j < k; ++j) {
+                    float* col = &columns[size_t((dz*k + i)*k + j)*n*n];
+                    for (int x = 0; x < n; ++x)
+                        copy_n(slot + (x + i)*padded + j, n, col + x*n);
+                }
+            }
+        }
+        float* out = outVolume + size_t(z)*n*n;
+        fill(out, out + n*n, 0.0f);
+        for (int t = 0; t < taps; ++t) {
+            float w = filter[t];
+            const float* col = &columns[size_t(t)*n*n];
+            for (int p = 0; p < n*n; ++p)
+                out[p] += w*col[p];
+        }
+    }
+}
+
+/**
+ * Slice-parallel run
+ * Equal contiguous ranges of output slices; the calling thread takes
+ * the first range.
+ * @param volume flat input volume
+ * @param filter flat filter
+ * @param outVolume flat output volume
+ * @param gemm vol2col engine instead of direct
+ */
+void Convolution3D::runSlices(const float* volume, const float* filter,
+                              float* outVolume, bool gemm) const
+{
+    vector<thread> workers;
+    for (int t = 1; t < mThreads; ++t) {
+        int zBegin = long(mDepth)*t/mThreads;
+        int zEnd = long(mDepth)*(t + 1)/mThreads;
+        workers.push_back(thread(gemm ? &Convolution3D::gemmSlices :
+                                        &Convolution3D::directSlices,
+                                 this, volume, filter, outVolume,
+                                 zBegin, zEnd));
+    }
+    int zEnd = mDepth/mThreads;
+    if (gemm)
+        gemmSlices(volume, filter, outVolume, 0, zEnd);
+    else
+        directSlices(volume, filter, outVolume, 0, zEnd);
+    for (size_t t = 0; t < workers.size(); ++t)
+        workers[t].join();
+}
+
+void Convolution3D::directConvolve(const float* volume, const float* filter,
+                                   float* outVolume) const
+{
+    runSlices(volume, filter, outVolume, false);
+}
+
+void Convolution3D::gemmConvolve(const float* volume, const float* filter,
+                                 float* outVolume) const
+{
+    runSlices(volume, filter, outVolume, true);
+}
+
+// utility function flattening a z-major nested volume
+static
+vector<float> flatten(vector<vector<vector<float>>>& volume)
+{
+    vector<float> flat;
+    for (size_t z = 0; z < volume.size(); ++z)
+        for (size_t x = 0; x < volume[z].size(); ++x)
+            flat.insert(flat.end(), volume[z][x].begin(),
+                        volume[z][x].end());
+    return flat;
+}
+
+// utility function nesting a flat depth x n x n volume
+static
+vector<vector<vector<float>>> nest(vector<float>& flat, int depth, int n)
+{
+    vector<vector<vector<float>>> volume(depth, vector<vector<float>>(n));
+    for (int z = 0; z < depth; ++z)
+        for (int x = 0; x < n; ++x)
+            volume[z][x].assign(flat.begin() + (size_t(z)*n + x)*n,
+                                flat.begin() + (size_t(z)*n + x + 1)*n);
+    return volume;
+}
+
+/**
+ * 3D convolution, direct engine
+ * Assume 'same' mode, i.e., input and output volumes are of same size
+ * @param volume input volume
+ * @param filter input filter
+ * @return returns convolve3D output volume
+ */
+vector<vector<vector<float>>>
+Convolution3D::convolve(vector<vector<vector<float>>>& volume,
+                        vector<vector<vector<float>>>& filter)
+{
+    assert(volume.size() == mDepth);
+    assert(volume[0].size() == mImgSize);
+    assert(filter.size() == mFilterSize);
+    assert(filter[0].size() == mFilterSize);
+
+    vector<float> in = flatten(volume);
+    vector<float> taps = flatten(filter);
+    vector<float> out(in.size());
+    directConvolve(&in[0], &taps[0], &out[0]);
+    return nest(out, mDepth, mImgSize);
+}
+
+/**
+ * 3D convolution, vol2col engine
+ * Assume 'same' mode, i.e., input and output volumes are of same size
+ * @param volume input volume
+ * @param filter input filter
+ * @return returns convolve3D output volume
+ */
+vector<vector<vector<float>>>
+Convolution3D::gemmConvolve(vector<vector<vector<float>>>& volume,
+                            vector<vector<vector<float>>>& filter)
+{
+    assert(volume.size() == mDepth);
+    assert(volume[0].size() == mImgSize);
+    assert(filter.size() == mFilterSize);
+    assert(filter[0].size() == mFilterSize);
+
+    vector<float> in = flatten(volume);
+    vector<float> taps = flatten(filter);
+    vector<float> out(in.size());
+    gemmConvolve(&in[0], &taps[0], &out[0]);
+    return nest(out, mDepth, mImgSize);
+}
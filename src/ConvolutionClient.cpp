@@ -0,0 +1,250 @@
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * Implementation code for the client of the convolution daemon.
+ */
+#include "ConvolutionClient.hpp"
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace SharedRing;
+
+/**
+ * Constructor
+ * @param name shared memory object name of the daemon
+ */
+ConvolutionClient::ConvolutionClient(const string& name):
+                             mHeader(NULL), mSize(0)
+{
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        throw runtime_error(string("Fatal error: no daemon at ") + name);
+    }
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) >= mappingSize(0)) {
+        mSize = st.st_size;
+        map = mmap(NULL, mSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        throw runtime_error(string("Fatal error: cannot map ") + name);
+    }
+    mHeader = static_cast<RingHeader*>(map);
+    if (mHeader->magic.load(memory_order_acquire) != MAGIC ||
+        mHeader->version != VERSION ||
+        mappingSize(mHeader->slots) > mSize) {
+        munmap(mHeader, mSize);
+        throw runtime_error(string("Fatal error: not a convolution ring ") +
+                            name);
+    }
+}
+
+/**
+ * Destructor
+ */
+ConvolutionClient::~ConvolutionClient()
+{
+    munmap(mHeader, mSize);
+}
+
+RingSlot& ConvolutionClient::slotAt(int slot) const
+{
+    if (slot < 0 || uint32_t(slot) >= mHeader->slots) {
+        throw runtime_error(string("Fatal error: slot out of range"));
+    }
+    return *SharedRing::slotAt(mHeader, slot);
+}
+
+/**
+ * Claim a slot
+ * The freed counter is read before scanning, so a release that the
+ * scan misses ends the futex wait at once.
+ * @param imgSize size of image
+ * @param filterSize size of filter
+ * @return slot index
+ */
+int ConvolutionClient::acquire(int imgSize, int filterSize)
+{
+    if (filterSize < 1 || filterSize > SLOT_FILTER_SIZE ||
+        filterSize % 2 == 0) {
+        throw runtime_error(
+         string("Fatal error: filter size should be in range 1-11 and odd"));
+    }
+    if (imgSize <= 4 || imgSize > SLOT_IMAGE_SIZE) {
+        throw runtime_error(
+                string("Fatal error: image size  <= 4 and > 64 unsupported"));
+    }
+    while (true) {
+        if (mHeader->shutdown) {
+            throw runtime_error(string("Fatal error: daemon stopped"));
+        }
+        uint32_t seen = mHeader->freed;
+        for (uint32_t i = 0; i < mHeader->slots; ++i) {
+            RingSlot& slot = *SharedRing::slotAt(mHeader, i);
+            uint32_t expected = SLOT_FREE;
+            if (slot.state.compare_exchange_strong(expected, SLOT_CLAIMED)) {
+                slot.owner = getpid();
+                slot.imgSize = imgSize;
+                slot.filterSize = filterSize;
+                slot.status = -1;
+                return i;
+            }
+        }
+        // a client dying while all are in use never releases, so the
+        // sleep is bounded and abandoned slots are looked for again
+        if (reclaimAbandoned() == 0)
+            futexWait(&mHeader->freed, seen, RECLAIM_INTERVAL_MS);
+    }
+}
+
+/**
+ * Free the slots of clients that died holding them
+ * Claimed and done slots wait for their owner, which never comes back
+ * after a crash; submitted and running ones are taken once they are
+ * done. Ownership is cleared by exchanging the dead pid for 0 first,
+ * so of several clients reclaiming at once only one frees the slot,
+ * and a slot claimed again meanwhile (owner 0 or a live pid) is left
+ * alone.
+ * @return slots freed
+ */
+int ConvolutionClient::reclaimAbandoned()
+{
+    int freed = 0;
+    for (uint32_t i = 0; i < mHeader->slots; ++i) {
+        RingSlot& slot = *SharedRing::slotAt(mHeader, i);
+        uint32_t state = slot.state;
+        if (state != SLOT_CLAIMED && state != SLOT_DONE)
+            continue;
+        int32_t owner = slot.owner;
+        if (owner <= 0 || kill(owner, 0) == 0 || errno != ESRCH)
+            continue;
+        if (slot.owner.compare_exchange_strong(owner, 0)) {
+            slot.state.store(SLOT_FREE, memory_order_release);
+            ++freed;
+        }
+    }
+    if (freed > 0) {
+        ++mHeader->freed;
+        futexWake(&mHeader->freed, INT_MAX);
+    }
+    return freed;
+}
+
+/**
+ * Submit a slot
+ * The release store publishes image and filter to the worker that
+ * takes the slot. A completed slot may be submitted again without
+ * rewriting its filter or image.
+ * @param slot claimed or completed slot
+ */
+void ConvolutionClient::submit(int slot)
+{
+    RingSlot& record = slotAt(slot);
+    assert(record.state == SLOT_CLAIMED || record.state == SLOT_DONE);
+    record.state.store(SLOT_SUBMITTED, memory_order_release);
+    ++mHeader->work;
+    futexWake(&mHeader->work, 1);
+}
+
+/**
+ * Wait for a slot
+ * A daemon that is killed never completes the slot nor wakes its
+ * owner, so the sleep is bounded and the daemon is looked for again.
+ * A daemon restarted on the ring frees every slot, which also loses
+ * the request.
+ * @param slot submitted slot
+ * @return status is 0 on success, -1 if refused or the daemon stopped
+ *         or died
+ */
+int ConvolutionClient::wait(int slot)
+{
+    RingSlot& record = slotAt(slot);
+    int32_t daemon = mHeader->daemon;
+    while (true) {
+        uint32_t state = record.state.load(memory_order_acquire);
+        if (state == SLOT_DONE)
+            return record.status;
+        if (state != SLOT_SUBMITTED && state != SLOT_RUNNING)
+            return -1;
+        if (mHeader->shutdown && state == SLOT_SUBMITTED)
+            return -1;
+        if (mHeader->daemon != daemon ||
+            (kill(daemon, 0) != 0 && errno == ESRCH))
+            return -1;
+        futexWait(&record.state, state, RECLAIM_INTERVAL_MS);
+    }
+}
+
+/**
+ * Release a slot
+ * A slot freed by a restarted daemon may have been claimed by another
+ * client since, so it is only freed while still owned by the caller.
+ * @param slot slot owned by the caller
+ */
+void ConvolutionClient::release(int slot)
+{
+    RingSlot& record = slotAt(slot);
+    int32_t owner = getpid();
+    if (!record.owner.compare_exchange_strong(owner, 0))
+        return;
+    record.state.store(SLOT_FREE, memory_order_release);
+    ++mHeader->freed;
+    futexWake(&mHeader->freed, 1);
+}
+
+/**
+ * 2D convolution through the daemon
+ * Assume 'same' mode, i.e., input and output images are of same size
+ * @param image input matrix image
+ * @param filter input matrix filter
+ * @return returns convolve2D output matrix
+ */
+vector<vector<float>>
+ConvolutionClient::convolve(vector<vector<float>>& image,
+                            vector<vector<float>>& filter)
+{
+    int n = image.size();
+    int k = filter.size();
+    int slot = acquire(n, k);
+    float* in = this->image(slot);
+    float* flt = this->filter(slot);
+    for (int i = 0; i < k; ++i) {
+        assert(filter[i].size() == k);
+        copy(filter[i].begin(), filter[i].end(), flt + i*k);
+    }
+    for (int i = 0; i < n; ++i) {
+        assert(image[i].size() == n);
+        copy(image[i].begin(), image[i].end(), in + i*n);
+    }
+    submit(slot);
+    int status = wait(slot);
+    vector<vector<float>> result;
+    if (status == 0) {
+        const float* out = output(slot);
+        for (int i = 0; i < n; ++i)
+            result.push_back(vector<float>(out + i*n, out + (i+1)*n));
+    }
+    release(slot);
+    if (status != 0) {
+        throw runtime_error(string("Fatal error: daemon refused request"));
+    }
+    return result;
+}
@@ -0,0 +1,263 @@
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * Implementation code for the shared-memory convolution daemon.
+ */
+#include "ConvolutionDaemon.hpp"
+#include "Convolution2D.hpp"
+#include "FilterCache.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+using namespace SharedRing;
+
+const char* const ConvolutionDaemon::DEFAULT_NAME = "/conv2d";
+
+// utility function checking client-written sizes, as Convolution2D does
+static
+bool validSizes(int imgSize, int filterSize)
+{
+    return imgSize > 4 && imgSize <= Convolution2D::MAX_IMAGE_SIZE &&
+           filterSize >= 1 && filterSize <= Convolution2D::MAX_FILTER_SIZE &&
+           filterSize % 2 == 1;
+}
+
+// utility function copying the flattened filter of a slot
+static
+vector<vector<float>> slotFilter(const RingSlot& slot)
+{
+    int k = slot.filterSize;
+    vector<vector<float>> filter(k, vector<float>(k));
+    for (int r = 0; r < k; ++r)
+        copy_n(slot.filter + r*k, k, filter[r].begin());
+    return filter;
+}
+
+/**
+ * Constructor
+ * - the object is opened or created, then locked with flock(); the
+ *   lock is held by mFd until the destructor, so a second daemon of
+ *   the same name fails instead of taking the name over
+ * - a lock won on an object that was unlinked meanwhile (the previous
+ *   daemon was exiting) is retried on the current one
+ * - the header is initialized before the magic is published, so a
+ *   client never maps a half-initialized ring
+ * @param name shared memory object name, starting with '/'
+ * @param slots requests in flight at once
+ * @param threads workers, 0 for hardware concurrency
+ */
+ConvolutionDaemon::ConvolutionDaemon(const string& name, uint32_t slots,
+                                     int threads):
+                             mName(name), mSlots(slots), mHeader(NULL),
+                             mFd(-1), mCompleted(0), mBatches(0)
+{
+    if (slots == 0) {
+        throw runtime_error(string("Fatal error: ring needs slots"));
+    }
+    struct stat st;
+    while (mFd < 0) {
+        int fd = shm_open(mName.c_str(), O_CREAT | O_RDWR, 0600);
+        if (fd < 0) {
+            throw runtime_error(string("Fatal error: cannot create ") +
+                                mName);
+        }
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+            close(fd);
+            throw runtime_error(string("Fatal error: a daemon is running at ")
+                                + mName);
+        }
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw runtime_error(string("Fatal error: cannot create ") +
+                                mName);
+        }
+        if (st.st_nlink == 0)
+            close(fd);
+        else
+            mFd = fd;
+    }
+    mDevice = st.st_dev;
+    mInode = st.st_ino;
+
+    size_t size = mappingSize(mSlots);
+    void* map = MAP_FAILED;
+    if (ftruncate(mFd, size) == 0)
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    if (map == MAP_FAILED) {
+        unlinkOwn();
+        close(mFd);
+        throw runtime_error(string("Fatal error: cannot map ") + mName);
+    }
+    mHeader = static_cast<RingHeader*>(map);
+    // a reused object still carries the magic of its dead daemon
+    mHeader->magic.store(0, memory_order_release);
+    mHeader->version = VERSION;
+    mHeader->slots = mSlots;
+    mHeader->work = 0;
+    mHeader->freed = 0;
+    mHeader->shutdown = 0;
+    mHeader->daemon = getpid();
+    // clients of a dead daemon still sleeping on its slots wake up to
+    // find them free and give up their requests
+    for (uint32_t i = 0; i < mSlots; ++i) {
+        slotAt(mHeader, i)->owner = 0;
+        slotAt(mHeader, i)->state = SLOT_FREE;
+        futexWake(&slotAt(mHeader, i)->state, INT_MAX);
+    }
+    mHeader->magic.store(MAGIC, memory_order_release);
+
+    if (threads <= 0)
+        threads = max(int(thread::hardware_concurrency()), 1);
+    for (int t = 0; t < threads; ++t)
+        mWorkers.push_back(thread(&ConvolutionDaemon::workerLoop, this));
+}
+
+/**
+ * Destructor
+ * Unlinks while the lock is still held, so a daemon waiting for the
+ * name sees the unlinked object and retries.
+ */
+ConvolutionDaemon::~ConvolutionDaemon()
+{
+    stop();
+    munmap(mHeader, mappingSize(mSlots));
+    unlinkOwn();
+    close(mFd);
+}
+
+/**
+ * Unlink the name only if it still refers to the object this daemon
+ * created
+ */
+void ConvolutionDaemon::unlinkOwn()
+{
+    int fd = shm_open(mName.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return;
+    struct stat st;
+    bool own = fstat(fd, &st) == 0 && st.st_dev == mDevice &&
+               st.st_ino == mInode;
+    close(fd);
+    if (own)
+        shm_unlink(mName.c_str());
+}
+
+/**
+ * Stop the workers
+ * Clients sleeping on a slot or on the free counter are woken after
+ * the join and see the shutdown flag.
+ */
+void ConvolutionDaemon::stop()
+{
+    mHeader->shutdown = 1;
+    ++mHeader->work;
+    futexWake(&mHeader->work, INT_MAX);
+    ++mHeader->freed;
+    futexWake(&mHeader->freed, INT_MAX);
+    for (size_t i = 0; i < mWorkers.size(); ++i)
+        mWorkers[i].join();
+    mWorkers.clear();
+    for (uint32_t i = 0; i < mSlots; ++i)
+        futexWake(&slotAt(mHeader, i)->state, INT_MAX);
+}
+
+/**
+ * Worker loop
+ * - the work counter is read before scanning, so a submit that the
+ *   scan misses changes it and the futex wait returns at once
+ * - taking a slot is a SUBMITTED -> RUNNING exchange, so every slot is
+ *   run by exactly one worker
+ * - slots with the same sizes and filter as the first one taken are
+ *   run with the same plan
+ */
+void ConvolutionDaemon::workerLoop()
+{
+    while (!mHeader->shutdown) {
+        uint32_t seen = mHeader->work;
+        bool found = false;
+        for (uint32_t i = 0; i < mSlots && !mHeader->shutdown; ++i) {
+            RingSlot& first = *slotAt(mHeader, i);
+            uint32_t expected = SLOT_SUBMITTED;
+            if (!first.state.compare_exchange_strong(expected, SLOT_RUNNING))
+                continue;
+            found = true;
+            int n = first.imgSize;
+            int k = first.filterSize;
+            if (!validSizes(n, k)) {
+                runSlot(first);
+                continue;
+            }
+            vector<vector<float>> filter = slotFilter(first);
+            shared_ptr<const ConvolutionPlan> plan =
+                FilterCache::instance().get(n, filter);
+            ++mBatches;
+            for (uint32_t j = i; j < mSlots; ++j) {
+                RingSlot& slot = *slotAt(mHeader, j);
+                if (j != i) {
+                    if (slot.state != SLOT_SUBMITTED ||
+                        slot.imgSize != n || slot.filterSize != k ||
+                        memcmp(slot.filter, first.filter,
+                               k*k*sizeof(float)) != 0)
+                        continue;
+                    expected = SLOT_SUBMITTED;
+                    if (!slot.state.compare_exchange_strong(expected,
+                                                            SLOT_RUNNING))
+                        continue;
+                    // the filter may have been rewritten before the
+                    // exchange; compare again now that the slot is ours
+                    if (memcmp(slot.filter, first.filter,
+                               k*k*sizeof(float)) != 0 ||
+                        slot.imgSize != n || slot.filterSize != k) {
+                        runSlot(slot);
+                        continue;
+                    }
+                }
+                plan->execute(slot.image, slot.output);
+                slot.status = 0;
+                ++mCompleted;
+                slot.state.store(SLOT_DONE, memory_order_release);
+                futexWake(&slot.state, INT_MAX);
+            }
+        }
+        if (!found)
+            futexWait(&mHeader->work, seen);
+    }
+}
+
+/**
+ * Run one slot on its own
+ * @param slot running slot
+ */
+void ConvolutionDaemon::runSlot(RingSlot& slot)
+{
+    int n = slot.imgSize;
+    int k = slot.filterSize;
+    slot.status = -1;
+    if (validSizes(n, k)) {
+        vector<vector<float>> filter = slotFilter(slot);
+        FilterCache::instance().get(n, filter)->execute(slot.image,
+                                                        slot.output);
+        ++mBatches;
+        slot.status = 0;
+    }
+    ++mCompleted;
+    slot.state.store(SLOT_DONE, memory_order_release);
+    futexWake(&slot.state, INT_MAX);
+}
@@ -0,0 +1,644 @@
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * Implementation code for prepared convolution plans.
+ */
+#include "ConvolutionPlan.hpp"
+#include "Convolution2D.hpp"
+#include <cassert>
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
+#include <cmath>
+#include <type_traits>
+
+// utility function storing float sums, nothing to do when summed in place
+static
+void storeSums(const float* sums, float* out, size_t count)
+{
+    if (sums != out)
+        copy_n(sums, count, out);
+}
+
+// utility function storing float sums rounded and saturated to Out
+template <typename Out>
+static
+void storeSums(const float* sums, Out* out, size_t count)
+{
+    const float top = numeric_limits<Out>::max();
+    for (size_t i = 0; i < count; ++i) {
+        float v = floor(sums[i] + 0.5f);
+        // NaN fails both tests and stores 0
+        out[i] = v >= top ? Out(top) : (v > 0 ? Out(v) : Out(0));
+    }
+}
+
+// utility function picking where sums go: in place for float output,
+// staged in the workspace otherwise
+static
+float* sumsFor(float* out, float*)
+{
+    return out;
+}
+
+template <typename Out>
+static
+float* sumsFor(Out*, float* staging)
+{
+    return staging;
+}
+
+/**
+ * Constructor
+ * - PLAN_AUTO tries, for filters of 3x3 and up, the box, Gaussian (only
+ *   with a tolerance) and separable recognizers in that order, and
+ *   otherwise prepares the direct engine: its tap list skips zero
+ *   taps, so sparse filters cost only their non-zero taps
+ * - an explicit box, Gaussian or separable engine throws if the
+ *   filter is not recognized
+ * - border tables: filter rows i with 0 <= x+i-r < n for every output
+ *   row x, output columns y with 0 <= y+j-r < n for every filter
+ *   column j
+ * @param imgSize size of image
+ * @param filter input matrix filter
+ * @param options engine and workspace count
+ */
+ConvolutionPlan::ConvolutionPlan(int imgSize, vector<vector<float>>& filter,
+                                 const PlanOptions& options):
+                             mImgSize(imgSize), mFilterSize(filter.size()),
+                             mEngine(options.engine), mBoxWeight(0),
+                             mIirGain(0),
+                             mWorkspaces(max(options.workspaces, 0))
+{
+    // same size checks as the single image engines
+    Convolution2D check(imgSize, filter.size());
+    for (int i = 0; i < mFilterSize; ++i) {
+        if (filter[i].size() != size_t(mFilterSize)) {
+            throw runtime_error(
+                    string("Fatal error: filter should be square"));
+        }
+    }
+    for (int k = 0; k < 2; ++k) {
+        IirSection none = { 0, 0, 0, 0 };
+        mIir[k] = none;
+    }
+    float tolerance = options.tolerance;
+    if (mEngine == PLAN_AUTO) {
+        mEngine = PLAN_DIRECT;
+        if (mFilterSize < 3)
+            ;
+        else if (recognizeBox(filter, tolerance))
+            mEngine = PLAN_BOX;
+        else if (tolerance > 0 && recognizeGaussian(filter, tolerance))
+            mEngine = PLAN_GAUSSIAN;
+        else if (recognizeSeparable(filter, tolerance))
+            mEngine = PLAN_SEPARABLE;
+    } else if ((mEngine == PLAN_BOX && !recognizeBox(filter, tolerance)) ||
+               (mEngine == PLAN_GAUSSIAN &&
+                !recognizeGaussian(filter, tolerance)) ||
+               (mEngine == PLAN_SEPARABLE &&
+                !recognizeSeparable(filter, tolerance))) {
+        throw runtime_error(
+                string("Fatal error: filter does not suit the plan engine"));
+    }
+
+    int radius = mFilterSize/2;
+    for (int x = 0; x < mImgSize; ++x) {
+        mRowBegin.push_back(max(radius - x, 0));
+        mRowEnd.push_back(min(mImgSize + radius - x, mFilterSize));
+    }
+    for (int j = 0; j < mFilterSize; ++j) {
+        mColBegin.push_back(max(radius - j, 0));
+        mColEnd.push_back(min(mImgSize + radius - j, mImgSize));
+    }
+
+    for (int i = 0; i < mFilterSize; ++i) {
+        for (int j = 0; j < mFilterSize; ++j) {
+            if (mEngine == PLAN_GEMM) {
+                mPanel.push_back(filter[i][j]);
+            } else if (mEngine == PLAN_DIRECT && filter[i][j] != 0) {
+                Tap tap = { i, j, filter[i][j] };
+                mTaps.push_back(tap);
+            }
+        }
+    }
+    if (mWorkspaces > 0)
+        mPool.assign(mWorkspaces, vector<float>(workspaceSize(), 0));
+}
+
+/**
+ * Constant filter test
+ * @param filter input matrix filter
+ * @param tolerance relative deviation allowed
+ * @return true if every tap is within tolerance of the first one
+ */
+bool ConvolutionPlan::recognizeBox(vector<vector<float>>& filter,
+                                   float tolerance)
+{
+    float first = filter[0][0];
+    double total = 0;
+    for (int i = 0; i < mFilterSize; ++i) {
+        for (int j = 0; j < mFilterSize; ++j) {
+            if (fabs(filter[i][j] - first) > tolerance*fabs(first))
+                return false;
+            total += filter[i][j];
+        }
+    }
+    if (first == 0)
+        return false;
+    mBoxWeight = tolerance == 0 ? first :
+                 float(total/(mFilterSize*mFilterSize));
+    return true;
+}
+
+/**
+ * Rank one filter test
+ * With pivot p = filter[pr][pc], the filter is column pc times row pr
+ * divided by p. Rounding of the factors, a few ulps of each tap, is
+ * always allowed for.
+ * @param filter input matrix filter
+ * @param tolerance relative deviation allowed
+ * @return true if every tap is within tolerance of the product
+ */
+bool ConvolutionPlan::recognizeSeparable(vector<vector<float>>& filter,
+                                         float tolerance)
+{
+    int pr = 0, pc = 0;
+    for (int i = 0; i < mFilterSize; ++i)
+        for (int j = 0; j < mFilterSize; ++j)
+            if (fabs(filter[i][j]) > fabs(filter[pr][pc])) {
+                pr = i;
+                pc = j;
+            }
+    float pivot = filter[pr][pc];
+    if (pivot == 0 || !std::isfinite(pivot))
+        return false;
+    vector<float> col(mFilterSize), row(mFilterSize);
+    for (int i = 0; i < mFilterSize; ++i) {
+        col[i] = filter[i][pc];
+        row[i] = filter[pr][i]/pivot;
+    }
+    float rounding = 4*numeric_limits<float>::epsilon();
+    for (int i = 0; i < mFilterSize; ++i)
+        for (int j = 0; j < mFilterSize; ++j)
+            if (!(fabs(col[i]*row[j] - filter[i][j]) <=
+                  tolerance*fabs(pivot) + rounding*fabs(filter[i][j])))
+                return false;
+    mColFilter.swap(col);
+    mRowFilter.swap(row);
+    return true;
+}
+
+/**
+ * Gaussian filter test
+ * - sigma from the centre row: f[r][r+1]/f[r][r] = exp(-1/(2 sigma^2))
+ * - Deriche's 4th order fit of a unit Gaussian, as two damped cosine
+ *   sections, scaled to sigma
+ * - the 2D impulse response of the row and column passes, scaled to
+ *   the filter sum, must be within tolerance of the filter (zero
+ *   outside it) at every offset an n x n image can see
+ * @param filter input matrix filter
+ * @param tolerance relative deviation allowed
+ * @return true if the IIR is accurate enough
+ */
+bool ConvolutionPlan::recognizeGaussian(vector<vector<float>>& filter,
+                                        float tolerance)
+{
+    int r = mFilterSize/2;
+    double centre = filter[r][r];
+    double ratio = centre > 0 ? filter[r][r+1]/centre : 0;
+    if (!(ratio > 0 && ratio < 1))
+        return false;
+    double sigma = sqrt(-1/(2*log(ratio)));
+    if (sigma < 0.5)
+        return false;
+
+    // a, b, rate, frequency of the two sections
+    static const double fit[2][4] = { {  1.680,   3.735, 1.783, 0.6318 },
+                                      { -0.6803, -0.2598, 1.723, 1.997 } };
+    double gain = 0;
+    for (int k = 0; k < 2; ++k) {
+        double omega = fit[k][3]/sigma;
+        double decay = exp(-fit[k][2]/sigma);
+        IirSection& section = mIir[k];
+        section.a = fit[k][0];
+        section.c = decay*(fit[k][1]*sin(omega) - fit[k][0]*cos(omega));
+        section.d1 = 2*decay*cos(omega);
+        section.d2 = -decay*decay;
+        // both one-sided sums share the centre sample
+        gain += 2*(section.a + section.c)/(1 - section.d1 - section.d2) -
+                section.a;
+    }
+    double total = 0, peak = 0;
+    for (int i = 0; i < mFilterSize; ++i)
+        for (int j = 0; j < mFilterSize; ++j) {
+            total += filter[i][j];
+            peak = max(peak, double(fabs(filter[i][j])));
+        }
+    mIirGain = total/(gain*gain);
+
+    int span = 2*mImgSize - 1;
+    vector<double> impulse(span, 0), response(span);
+    impulse[mImgSize - 1] = 1;
+    iirLine(&impulse[0], &response[0], span);
+    for (int a = 0; a < span; ++a) {
+        for (int b = 0; b < span; ++b) {
+            int i = a - (mImgSize - 1) + r;
+            int j = b - (mImgSize - 1) + r;
+            bool inside = i >= 0 && j >= 0 && i < mFilterSize &&
+                          j < mFilterSize;
+            double want = inside ? filter[i][j] : 0;
+            if (!(fabs(mIirGain*response[a]*response[b] - want) <=
+                  tolerance*peak))
+                return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Causal plus anticausal IIR of one line
+ * Each section runs forward for h(m), m >= 0, and backward for
+ * h(m), m >= 1; the state is zero outside the line, which is exactly
+ * the zero padding of the 'same' convolution.
+ * @param in signal, zero beyond the line
+ * @param out response, overwritten
+ * @param length samples in the line
+ */
+void ConvolutionPlan::iirLine(const double* in, double* out,
+                              int length) const
+{
+    double y1[2] = { 0, 0 }, y2[2] = { 0, 0 };
+    for (int i = 0; i < length; ++i) {
+        double x0 = in[i];
+        double x1 = i > 0 ? in[i-1] : 0;
+        double sum = 0;
+        for (int k = 0; k < 2; ++k) {
+            const IirSection& s = mIir[k];
+            double y = s.a*x0 + s.c*x1 + s.d1*y1[k] + s.d2*y2[k];
+            y2[k] = y1[k];
+            y1[k] = y;
+            sum += y;
+        }
+        out[i] = sum;
+    }
+    double g1[2] = { 0, 0 }, g2[2] = { 0, 0 };
+    for (int i = length - 1; i >= 0; --i) {
+        double x0 = in[i];
+        double x1 = i + 1 < length ? in[i+1] : 0;
+        for (int k = 0; k < 2; ++k) {
+            const IirSection& s = mIir[k];
+            double g = s.a*x0 + s.c*x1 + s.d1*g1[k] + s.d2*g2[k];
+            g2[k] = g1[k];
+            g1[k] = g;
+            out[i] += g - s.a*x0;
+        }
+    }
+}
+
+/**
+ * Workspace size
+ * @return floats of one workspace
+ */
+size_t ConvolutionPlan::workspaceSize() const
+{
+    size_t cols = size_t(mImgSize)*mImgSize;
+    switch (mEngine) {
+    case PLAN_GEMM:
+        return (size_t(mFilterSize)*mFilterSize + 1)*cols;
+    case PLAN_SEPARABLE:
+        return 2*cols;
+    case PLAN_BOX:
+    case PLAN_GAUSSIAN:
+        return cols;
+    default:
+        return mImgSize;
+    }
+}
+
+/**
+ * Take a workspace
+ * @return workspaceSize() floats
+ */
+vector<float> ConvolutionPlan::acquire() const
+{
+    vector<float> workspace;
+    {
+        lock_guard<mutex> lock(mPoolMutex);
+        if (!mPool.empty()) {
+            workspace.swap(mPool.back());
+            mPool.pop_back();
+            return workspace;
+        }
+    }
+    workspace.assign(workspaceSize(), 0);
+    return workspace;
+}
+
+/**
+ * Return a workspace
+ * Workspaces allocated beyond the configured count while more calls
+ * ran at once are freed, so bytes() stays fixed.
+ * @param workspace buffer from acquire()
+ */
+void ConvolutionPlan::release(vector<float>& workspace) const
+{
+    lock_guard<mutex> lock(mPoolMutex);
+    if (int(mPool.size()) >= mWorkspaces)
+        return;
+    mPool.push_back(vector<float>());
+    mPool.back().swap(workspace);
+}
+
+/**
+ * Memory held by the plan
+ * Counts the configured workspaces whether they are in the pool or
+ * out with a running execute(), so the figure is fixed for the life of
+ * the plan and FilterCache can account for it once. Workspaces made
+ * beyond that count only live for the call that made them.
+ * @return bytes
+ */
+size_t ConvolutionPlan::bytes() const
+{
+    return sizeof(*this) + mTaps.size()*sizeof(Tap) +
+           (mPanel.size() + mColFilter.size() + mRowFilter.size() +
+            size_t(mWorkspaces)*workspaceSize())*sizeof(float) +
+           (mRowBegin.size() + mRowEnd.size() + mColBegin.size() +
+            mColEnd.size())*sizeof(int);
+}
+
+/**
+ * Prepared 2D convolution
+ * Assume 'same' mode, i.e., input and output images are of same size
+ * @param image n x n row-major input
+ * @param outImage n x n row-major output, overwritten
+ */
+void ConvolutionPlan::execute(const float* image, float* outImage) const
+{
+    run(image, outImage);
+}
+
+void ConvolutionPlan::execute(const uint8_t* image, float* outImage) const
+{
+    run(image, outImage);
+}
+
+void ConvolutionPlan::execute(const uint16_t* image, float* outImage) const
+{
+    run(image, outImage);
+}
+
+void ConvolutionPlan::execute(const uint8_t* image, uint8_t* outImage) const
+{
+    run(image, outImage);
+}
+
+void ConvolutionPlan::execute(const uint16_t* image,
+                              uint16_t* outImage) const
+{
+    run(image, outImage);
+}
+
+/**
+ * Engine dispatch
+ * Float output of the direct engine is summed in place and needs no
+ * workspace; everything else takes one from the pool. Whole image
+ * engines stage integer output in the last n^2 floats.
+ * @param image n x n input
+ * @param outImage n x n output, overwritten
+ */
+template <typename In, typename Out>
+void ConvolutionPlan::run(const In* image, Out* outImage) const
+{
+    size_t cols = size_t(mImgSize)*mImgSize;
+    bool staged = !is_same<Out, float>::value;
+    vector<float> workspace;
+    if (mEngine != PLAN_DIRECT || staged)
+        workspace = acquire();
+    if (mEngine != PLAN_DIRECT) {
+        float* sums = sumsFor(outImage, &workspace[0] + workspace.size() -
+                                        cols);
+        if (mEngine == PLAN_GEMM)
+            executeGemm(image, sums, workspace);
+        else if (mEngine == PLAN_BOX)
+            executeBox(image, sums);
+        else if (mEngine == PLAN_GAUSSIAN)
+            executeGaussian(image, sums);
+        else
+            executeSeparable(image, sums, &workspace[0]);
+        storeSums(sums, outImage, cols);
+    } else {
+        for (int x = 0; x < mImgSize; ++x) {
+            Out* out = outImage + x*mImgSize;
+            float* sums = sumsFor(out, staged ? &workspace[0] : NULL);
+            directRow(image, x, sums);
+            storeSums(sums, out, mImgSize);
+        }
+    }
+    if (!workspace.empty())
+        release(workspace);
+}
+
+/**
+ * Prepared 2D convolution
+ * @param image input matrix image
+ * @return 2D convolution results
+ */
+vector<vector<float>>
+ConvolutionPlan::execute(vector<vector<float>>& image) const
+{
+    assert(image.size() == mImgSize);
+    assert(image[0].size() == mImgSize);
+    vector<float> flatImg, flatOut(mImgSize*mImgSize);
+    for (int i = 0; i < mImgSize; ++i)
+        flatImg.insert(flatImg.end(), image[i].begin(), image[i].end());
+    execute(&flatImg[0], &flatOut[0]);
+    vector<vector<float>> result(mImgSize, vector<float>(mImgSize));
+    for (int i = 0; i < mImgSize; ++i)
+        copy_n(flatOut.begin() + i*mImgSize, mImgSize, result[i].begin());
+    return result;
+}
+
+/**
+ * Tap list engine, one output row
+ * Taps are visited in row-major order, so each output pixel sums its
+ * products in the same order as convolve().
+ * @param image n x n input, converted to float as it is read
+ * @param x output row
+ * @param out n sums, overwritten
+ */
+template <typename In>
+void ConvolutionPlan::directRow(const In* image, int x, float* out) const
+{
+    int radius = mFilterSize/2;
+    fill(out, out + mImgSize, 0.0f);
+    for (size_t t = 0; t < mTaps.size(); ++t) {
+        const Tap& tap = mTaps[t];
+        if (tap.i < mRowBegin[x] || tap.i >= mRowEnd[x])
+            continue;
+        int offset = (x + tap.i - radius)*mImgSize + tap.j - radius;
+        float w = tap.weight;
+        for (int y = mColBegin[tap.j]; y < mColEnd[tap.j]; ++y)
+            out[y] += w*float(image[offset + y]);
+    }
+}
+
+/**
+ * Summed-area table engine
+ * The table is kept in double so that differences of large prefix sums
+ * keep the precision of the window sum, unless pixels outside the
+ * window are some 1e9 times larger than those inside.
+ * @param image n x n input
+ * @param outImage n x n sums, overwritten
+ */
+template <typename In>
+void ConvolutionPlan::executeBox(const In* image, float* outImage) const
+{
+    int n = mImgSize;
+    int radius = mFilterSize/2;
+    vector<double> table(size_t(n+1)*(n+1), 0);
+    for (int x = 0; x < n; ++x) {
+        double rowSum = 0;
+        for (int y = 0; y < n; ++y) {
+            rowSum += double(image[x*n + y]);
+            table[(x+1)*(n+1) + y+1] = table[x*(n+1) + y+1] + rowSum;
+        }
+    }
+    for (int x = 0; x < n; ++x) {
+        int x0 = max(x - radius, 0);
+        int x1 = min(x + radius + 1, n);
+        for (int y = 0; y < n; ++y) {
+            int y0 = max(y - radius, 0);
+            int y1 = min(y + radius + 1, n);
+            double sum = table[x1*(n+1) + y1] - table[x0*(n+1) + y1] -
+                         table[x1*(n+1) + y0] + table[x0*(n+1) + y0];
+            outImage[x*n + y] = float(mBoxWeight*sum);
+        }
+    }
+}
+
+/**
+ * Recursive Gaussian engine
+ * Rows then columns through iirLine(), in double.
+ * @param image n x n input
+ * @param outImage n x n sums, overwritten
+ */
+template <typename In>
+void ConvolutionPlan::executeGaussian(const In* image, float* outImage) const
+{
+    int n = mImgSize;
+    vector<double> rows(size_t(n)*n);
+    vector<double> line(n), response(n);
+    for (int x = 0; x < n; ++x) {
+        for (int y = 0; y < n; ++y)
+            line[y] = double(image[x*n + y]);
+        iirLine(&line[0], &rows[0] + x*n, n);
+    }
+    for (int y = 0; y < n; ++y) {
+        for (int x = 0; x < n; ++x)
+            line[x] = rows[x*n + y];
+        iirLine(&line[0], &response[0], n);
+        for (int x = 0; x < n; ++x)
+            outImage[x*n + y] = float(mIirGain*response[x]);
+    }
+}
+
+/**
+ * Separable engine
+ * Row pass with mRowFilter, then column pass with mColFilter, both
+ * bounded by the border tables.
+ * @param image n x n input
+ * @param outImage n x n sums, overwritten
+ * @param scratch n x n row pass result
+ */
+template <typename In>
+void ConvolutionPlan::executeSeparable(const In* image, float* outImage,
+                                       float* scratch) const
+{
+    int n = mImgSize;
+    int radius = mFilterSize/2;
+    fill(scratch, scratch + n*n, 0.0f);
+    for (int x = 0; x < n; ++x) {
+        float* out = scratch + x*n;
+        for (int j = 0; j < mFilterSize; ++j) {
+            float w = mRowFilter[j];
+            int offset = x*n + j - radius;
+            for (int y = mColBegin[j]; y < mColEnd[j]; ++y)
+                out[y] += w*float(image[offset + y]);
+        }
+    }
+    fill(outImage, outImage + n*n, 0.0f);
+    for (int x = 0; x < n; ++x) {
+        float* out = outImage + x*n;
+        for (int i = mRowBegin[x]; i < mRowEnd[x]; ++i) {
+            float w = mColFilter[i];
+            const float* in = scratch + (x + i - radius)*n;
+            for (int y = 0; y < n; ++y)
+                out[y] += w*in[y];
+        }
+    }
+}
+
+/**
+ * Panel times im2col engine
+ * The workspace is tap-major so that row t holds tap t of every
+ * window; the product streams through it one tap at a time.
+ * @param image n x n input, converted to float by im2col
+ * @param outImage n x n sums, overwritten
+ * @param workspace k^2 x n^2 im2col buffer first
+ */
+template <typename In>
+void ConvolutionPlan::executeGemm(const In* image, float* outImage,
+                                  vector<float>& workspace) const
+{
+    int radius = mFilterSize/2;
+    size_t cols = size_t(mImgSize)*mImgSize;
+    fill(workspace.begin(), workspace.begin() + mPanel.size()*cols, 0.0f);
+    for (int i = 0; i < mFilterSize; ++i) {
+        for (int j = 0; j < mFilterSize; ++j) {
+            float* row = &workspace[0] + (i*mFilterSize + j)*cols;
+            for (int x = 0; x < mImgSize; ++x) {
+                if (i < mRowBegin[x] || i >= mRowEnd[x])
+                    continue;
+                int offset = (x + i - radius)*mImgSize + j - radius;
+                for (int y = mColBegin[j]; y < mColEnd[j]; ++y)
+                    row[x*mImgSize + y] = float(image[offset + y]);
+            }
+        }
+    }
+    fill(outImage, outImage + cols, 0.0f);
+    for (size_t t = 0; t < mPanel.size(); ++t) {
+        float w = mPanel[t];
+        const float* row = &workspace[0] + t*cols;
+        for (size_t c = 0; c < cols; ++c)
+            outImage[c] += w*row[c];
+    }
+}
+
+/**
+ * Printable name of an engine
+ * @param engine engine
+ * @return name
+ */
+const char* ConvolutionPlan::engineName(PlanEngine engine)
+{
+    switch (engine) {
+    case PLAN_AUTO:      return "auto";
+    case PLAN_DIRECT:    return "direct";
+    case PLAN_GEMM:      return "gemm";
+    case PLAN_BOX:       return "box";
+    case PLAN_GAUSSIAN:  return "gaussian";
+    case PLAN_SEPARABLE: return "separable";
+    default:             return "?";
+    }
+}
@@ -0,0 +1,213 @@
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * Implementation code for the asynchronous convolution scheduler.
+ */
+#include "ConvolutionScheduler.hpp"
+#include "Convolution2D.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <exception>
+
+/**
+ * Constructor
+ * Starts the worker threads.
+ * @param threads worker count, 0 for hardware concurrency
+ * @param maxBatch requests per batch
+ * @param maxDelay latency deadline of a batch
+ */
+ConvolutionScheduler::ConvolutionScheduler(int threads, size_t maxBatch,
+                                           chrono::microseconds maxDelay):
+                             mMaxBatch(max(maxBatch, size_t(1))),
+                             mMaxDelay(maxDelay), mStop(false)
+{
+    mStats.submitted = 0;
+    mStats.completed = 0;
+    mStats.batches = 0;
+    mStats.largestBatch = 0;
+    mStats.queueDepth = 0;
+    if (threads <= 0)
+        threads = max(int(thread::hardware_concurrency()), 1);
+    for (int i = 0; i < threads; ++i)
+        mWorkers.push_back(thread(&ConvolutionScheduler::workerLoop, this));
+}
+
+/**
+ * Destructor
+ * Pending batches are run without waiting for their deadline.
+ */
+ConvolutionScheduler::~ConvolutionScheduler()
+{
+    {
+        lock_guard<mutex> lock(mMutex);
+        mStop = true;
+    }
+    mCond.notify_all();
+    for (size_t i = 0; i < mWorkers.size(); ++i)
+        mWorkers[i].join();
+}
+
+/**
+ * Check that every row of a matrix has as many elements as it has rows
+ * @param matrix input matrix
+ * @return bool true if matrix is square
+ */
+static bool isSquare(const vector<vector<float>>& matrix)
+{
+    for (size_t i = 0; i < matrix.size(); ++i) {
+        if (matrix[i].size() != matrix.size())
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Queue a convolution
+ * The request joins the open batch of its filter, or starts one.
+ * A full batch is handed to the workers at once. A matrix with a row
+ * of the wrong length fails its own future here, so it never reaches
+ * a batch shared with other requests.
+ * @param image input matrix image
+ * @param filter input matrix filter
+ * @return future of the convolution result
+ */
+future<vector<vector<float>>>
+ConvolutionScheduler::submit(vector<vector<float>>& image,
+                             vector<vector<float>>& filter)
+{
+    promise<vector<vector<float>>> result;
+    future<vector<vector<float>>> fut = result.get_future();
+    if (!isSquare(image) || !isSquare(filter)) {
+        result.set_exception(make_exception_ptr(runtime_error(
+            string("Fatal error: image and filter should be square"))));
+        lock_guard<mutex> lock(mMutex);
+        ++mStats.submitted;
+        ++mStats.completed;
+        return fut;
+    }
+
+    vector<float> flat;
+    for (size_t i = 0; i < filter.size(); ++i)
+        flat.insert(flat.end(), filter[i].begin(), filter[i].end());
+    BatchKey key(int(image.size()), int(filter.size()), flat);
+
+    {
+        lock_guard<mutex> lock(mMutex);
+        shared_ptr<Batch>& batch = mOpen[key];
+        if (!batch) {
+            batch = make_shared<Batch>();
+            batch->imgSize = image.size();
+            batch->filter = filter;
+            batch->deadline = chrono::steady_clock::now() + mMaxDelay;
+        }
+        batch->images.push_back(image);
+        batch->results.push_back(move(result));
+        ++mStats.submitted;
+        ++mStats.queueDepth;
+        if (batch->images.size() >= mMaxBatch) {
+            mReady.push_back(batch);
+            mOpen.erase(key);
+        }
+    }
+    mCond.notify_one();
+    return fut;
+}
+
+/**
+ * Worker loop
+ * Takes ready batches first; otherwise closes the open batch with the
+ * earliest deadline once it expires, or sleeps until it does.
+ */
+void ConvolutionScheduler::workerLoop()
+{
+    unique_lock<mutex> lock(mMutex);
+    while (true) {
+        if (!mReady.empty()) {
+            shared_ptr<Batch> batch = mReady.front();
+            mReady.pop_front();
+            mStats.queueDepth -= batch->images.size();
+            ++mStats.batches;
+            mStats.largestBatch = max(mStats.largestBatch,
+                                      batch->images.size());
+            lock.unlock();
+            runBatch(*batch);
+            lock.lock();
+            continue;
+        }
+        if (mOpen.empty()) {
+            if (mStop)
+                return;
+            mCond.wait(lock);
+            continue;
+        }
+        map<BatchKey, shared_ptr<Batch>>::iterator first = mOpen.begin();
+        for (map<BatchKey, shared_ptr<Batch>>::iterator it = mOpen.begin();
+             it != mOpen.end(); ++it) {
+            if (it->second->deadline < first->second->deadline)
+                first = it;
+        }
+        if (mStop || first->second->deadline <= chrono::steady_clock::now()) {
+            mReady.push_back(first->second);
+            mOpen.erase(first);
+            continue;
+        }
+        mCond.wait_until(lock, first->second->deadline);
+    }
+}
+
+/**
+ * Run a batch
+ * The counters are updated before the futures become ready.
+ * @param batch requests sharing image size and filter
+ */
+void ConvolutionScheduler::runBatch(Batch& batch)
+{
+    vector<vector<vector<float>>> out;
+    exception_ptr error;
+    try {
+        Convolution2D conv2d(batch.imgSize, batch.filter.size());
+        out = conv2d.fastConvolveBatch(batch.images, batch.filter);
+    } catch (...) {
+        error = current_exception();
+    }
+    {
+        lock_guard<mutex> lock(mMutex);
+        mStats.completed += batch.results.size();
+    }
+    for (size_t i = 0; i < batch.results.size(); ++i) {
+        if (error)
+            batch.results[i].set_exception(error);
+        else
+            batch.results[i].set_value(move(out[i]));
+    }
+}
+
+/**
+ * Number of requests submitted but not yet executing
+ * @return queue depth
+ */
+size_t ConvolutionScheduler::queueDepth() const
+{
+    lock_guard<mutex> lock(mMutex);
+    return mStats.queueDepth;
+}
+
+/**
+ * Snapshot of the counters
+ * @return counters
+ */
+SchedulerStats ConvolutionScheduler::stats() const
+{
+    lock_guard<mutex> lock(mMutex);
+    return mStats;
+}
@@ -0,0 +1,193 @@
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * Implementation code for the cache of prepared filters.
+ */
+#include "FilterCache.hpp"
+#include "Convolution2D.hpp"
+#include <cstring>
+#include <stdexcept>
+
+// utility function hashing the key with 64 bit FNV-1a
+static
+size_t hashKey(const vector<float>& filter, int imgSize, PlanEngine engine,
+               float tolerance)
+{
+    unsigned long long h = 14695981039346656037ULL;
+    int shape[3] = { int(filter.size()), imgSize, int(engine) };
+    const unsigned char* bytes =
+        reinterpret_cast<const unsigned char*>(shape);
+    for (size_t i = 0; i < sizeof(shape); ++i)
+        h = (h ^ bytes[i])*1099511628211ULL;
+    bytes = reinterpret_cast<const unsigned char*>(&tolerance);
+    for (size_t i = 0; i < sizeof(tolerance); ++i)
+        h = (h ^ bytes[i])*1099511628211ULL;
+    bytes = reinterpret_cast<const unsigned char*>(&filter[0]);
+    for (size_t i = 0; i < filter.size()*sizeof(float); ++i)
+        h = (h ^ bytes[i])*1099511628211ULL;
+    return size_t(h);
+}
+
+/**
+ * Constructor
+ */
+FilterCache::FilterCache(): mBudget(DEFAULT_BUDGET)
+{
+}
+
+/**
+ * The process-wide cache, created on first use
+ * @return cache
+ */
+FilterCache& FilterCache::instance()
+{
+    static FilterCache cache;
+    return cache;
+}
+
+/**
+ * Cached plan
+ * The filter is checked before it is hashed, with the errors of
+ * ConvolutionPlan. The plan is prepared outside the lock so that a miss
+ * does not stall the hits of other threads; if another thread inserted
+ * the same key meanwhile, its plan is used.
+ * @param imgSize size of image
+ * @param filter input matrix filter
+ * @param engine engine to prepare
+ * @param tolerance tolerance of the box/Gaussian/separable recognizers
+ * @return plan
+ */
+shared_ptr<const ConvolutionPlan>
+FilterCache::get(int imgSize, vector<vector<float>>& filter,
+                 PlanEngine engine, float tolerance)
+{
+    size_t k = filter.size();
+    if (k == 0 || k > size_t(Convolution2D::MAX_FILTER_SIZE) || k % 2 == 0) {
+        throw runtime_error(
+         string("Fatal error: filter size should be in range 1-11 and odd"));
+    }
+    for (size_t i = 0; i < k; ++i) {
+        if (filter[i].size() != k) {
+            throw runtime_error(
+                    string("Fatal error: filter should be square"));
+        }
+    }
+    vector<float> flat;
+    for (size_t i = 0; i < k; ++i)
+        flat.insert(flat.end(), filter[i].begin(), filter[i].end());
+    size_t hash = hashKey(flat, imgSize, engine, tolerance);
+
+    for (int pass = 0; pass < 2; ++pass) {
+        shared_ptr<const ConvolutionPlan> made;
+        if (pass == 1) {
+            PlanOptions options;
+            options.engine = engine;
+            options.tolerance = tolerance;
+            made.reset(new ConvolutionPlan(imgSize, filter, options));
+        }
+        lock_guard<mutex> lock(mMutex);
+        pair<Index::iterator, Index::iterator> range =
+            mIndex.equal_range(hash);
+        for (Index::iterator it = range.first; it != range.second; ++it) {
+            Entry& entry = *it->second;
+            if (entry.imgSize == imgSize && entry.engine == engine &&
+                entry.tolerance == tolerance &&
+                entry.filter.size() == flat.size() &&
+                memcmp(&entry.filter[0], &flat[0],
+                       flat.size()*sizeof(float)) == 0) {
+                mEntries.splice(mEntries.begin(), mEntries, it->second);
+                if (pass == 0)
+                    ++mStats.hits;
+                return entry.plan;
+            }
+        }
+        if (pass == 0) {
+            ++mStats.misses;
+            continue;
+        }
+        Entry entry = { hash, imgSize, engine, tolerance, flat, made,
+                        made->bytes() };
+        mEntries.push_front(entry);
+        mIndex.insert(make_pair(hash, mEntries.begin()));
+        mStats.bytes += entry.bytes;
+        ++mStats.entries;
+        evict();
+        return made;
+    }
+    return shared_ptr<const ConvolutionPlan>();
+}
+
+/**
+ * Evict from the least recently used end, lock held
+ * The plan just inserted is kept even if it alone exceeds the budget.
+ */
+void FilterCache::evict()
+{
+    while (mStats.bytes > mBudget && mEntries.size() > 1) {
+        Entry& victim = mEntries.back();
+        pair<Index::iterator, Index::iterator> range =
+            mIndex.equal_range(victim.hash);
+        for (Index::iterator it = range.first; it != range.second; ++it) {
+            if (&*it->second == &victim) {
+                mIndex.erase(it);
+                break;
+            }
+        }
+        mStats.bytes -= victim.bytes;
+        --mStats.entries;
+        ++mStats.evictions;
+        mEntries.pop_back();
+    }
+}
+
+/**
+ * Change the budget
+ * @param bytes bytes the plans may hold
+ */
+void FilterCache::setBudget(size_t bytes)
+{
+    lock_guard<mutex> lock(mMutex);
+    mBudget = bytes;
+    evict();
+}
+
+/**
+ * Drop all plans and reset the counters
+ */
+void FilterCache::clear()
+{
+    lock_guard<mutex> lock(mMutex);
+    mIndex.clear();
+    mEntries.clear();
+    mStats = FilterCacheStats();
+}
+
+/**
+ * Counters
+ * @return copy of the counters
+ */
+FilterCacheStats FilterCache::stats()
+{
+    lock_guard<mutex> lock(mMutex);
+    return mStats;
+}
+
+/**
+ * Budget
+ * @return bytes the plans may hold
+ */
+size_t FilterCache::budget()
+{
+    lock_guard<mutex> lock(mMutex);
+    return mBudget;
+}
@@ -0,0 +1,244 @@
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * Implementation code for grouped and depthwise convolution.
+ */
+#include "GroupedConvolution2D.hpp"
+#include "Convolution2D.hpp"
+#include <cassert>
+#include <algorithm>
+#include <stdexcept>
+
+/**
+ * Constructor
+ * @param imgSize size of image
+ * @param filterSize size of filter
+ * @param channels input channels
+ * @param groups channel groups
+ * @param outChannels output channels, 0 for as many as input
+ */
+GroupedConvolution2D::GroupedConvolution2D(int imgSize, int filterSize,
+                                           int channels, int groups,
+                                           int outChannels):
+                             mImgSize(imgSize), mFilterSize(filterSize),
+                             mChannels(channels), mGroups(groups),
+                             mOutChannels(outChannels > 0 ? outChannels :
+                                          channels)
+{
+    // same size checks as the single channel engines
+    Convolution2D check(imgSize, filterSize);
+    if (channels <= 0 || groups <= 0) {
+        throw runtime_error(
+                string("Fatal error: channels and groups should be positive"));
+    }
+    if (mChannels % mGroups != 0 || mOutChannels % mGroups != 0) {
+        throw runtime_error(
+                string("Fatal error: groups should divide the channels"));
+    }
+}
+
+/**
+ * Grouped 2D convolution
+ * Assume 'same' mode, i.e., input and output images are of same size
+ * @param image n x n x C input, channels-last
+ * @param filter k x k x C/groups x outChannels taps
+ * @return n x n x outChannels output, channels-last
+ */
+vector<float> GroupedConvolution2D::convolve(vector<float>& image,
+                                             vector<float>& filter)
+{
+    assert(image.size() == size_t(mImgSize)*mImgSize*mChannels);
+    assert(filter.size() == size_t(mFilterSize)*mFilterSize*
+                            (mChannels/mGroups)*mOutChannels);
+    vector<float> result(size_t(mImgSize)*mImgSize*mOutChannels, 0);
+    convolve(&image[0], &filter[0], &result[0]);
+    return result;
+}
+
+/**
+ * Grouped 2D convolution on flat buffers
+ * @param image n x n x C input, channels-last
+ * @param filter k x k x C/groups x outChannels taps
+ * @param outImage n x n x outChannels output, overwritten
+ */
+void GroupedConvolution2D::convolve(const float* image, const float* filter,
+                                    float* outImage) const
+{
+    if (isDepthwise())
+        depthwise(image, filter, outImage);
+    else
+        grouped(image, filter, outImage);
+}
+
+/**
+ * Grouped 2D convolution of a tensor
+ * @param image n x n images with C channels
+ * @param filter k x k x C/groups x outChannels taps
+ * @return output in the layout the engine ran in
+ */
+ImageTensor GroupedConvolution2D::convolve(const ImageTensor& image,
+                                           vector<float>& filter)
+{
+    assert(image.height() == mImgSize && image.width() == mImgSize);
+    assert(image.channels() == mChannels);
+    assert(filter.size() == size_t(mFilterSize)*mFilterSize*
+                            (mChannels/mGroups)*mOutChannels);
+    if (!acceptsLayout(image.layout()))
+        return convolve(image.to(preferredLayout()), filter);
+
+    size_t plane = size_t(mImgSize)*mImgSize;
+    if (image.layout() == NCHWc) {
+        // filter lanes of the padding channels stay zero
+        int b = image.block();
+        int taps = mFilterSize*mFilterSize;
+        vector<float> blocked(size_t(taps)*image.blocks()*b, 0);
+        for (int t = 0; t < taps; ++t)
+            for (int c = 0; c < mChannels; ++c)
+                blocked[(size_t(c/b)*taps + t)*b + c%b] =
+                    filter[size_t(t)*mChannels + c];
+        ImageTensor result(image.batch(), mChannels, mImgSize, mImgSize,
+                           NCHWc, b);
+        size_t stride = plane*image.blocks()*b;
+        for (int n = 0; n < image.batch(); ++n)
+            depthwiseBlocked(image.data() + n*stride, &blocked[0],
+                             result.data() + n*stride, b);
+        return result;
+    }
+    ImageTensor result(image.batch(), mOutChannels, mImgSize, mImgSize, NHWC);
+    for (int n = 0; n < image.batch(); ++n)
+        convolve(image.data() + n*plane*mChannels, &filter[0],
+                 result.data() + n*plane*mOutChannels);
+    return result;
+}
+
+/**
+ * Depthwise kernel on NCHWc
+ * Every block is a plane of pixels with block interleaved channels, so
+ * the innermost loop is a full block of lanes, padding included.
+ * @param image one NCHWc image
+ * @param filter k x k x blocks x block taps, zero padded
+ * @param outImage one NCHWc image
+ * @param block channels per block
+ */
+void GroupedConvolution2D::depthwiseBlocked(const float* image,
+                                            const float* filter,
+                                            float* outImage, int block) const
+{
+    int hFltrSz = (mFilterSize+1)/2;
+    int taps = mFilterSize*mFilterSize;
+    int blocks = (mChannels + block - 1)/block;
+    size_t plane = size_t(mImgSize)*mImgSize;
+    for (int cb = 0; cb < blocks; ++cb) {
+        const float* in = image + cb*plane*block;
+        const float* w = filter + size_t(cb)*taps*block;
+        float* outPlane = outImage + cb*plane*block;
+        for (int x = 0; x < mImgSize; ++x) {
+            int startx = max(hFltrSz-1-x, 0);
+            int endx = mFilterSize + min(mImgSize - x - hFltrSz,0);
+            for (int y = 0; y < mImgSize; ++y) {
+                int starty = max(hFltrSz-1-y, 0);
+                int endy = mFilterSize + min(mImgSize - y - hFltrSz,0);
+                float* out = outPlane + (size_t(x)*mImgSize + y)*block;
+                fill(out, out + block, 0.0f);
+                for (int i = startx; i < endx; ++i) {
+                    for (int j = starty; j < endy; ++j) {
+                        const float* px = in + (size_t(x+i-hFltrSz+1)*
+                                                mImgSize + y+j-hFltrSz+1)*block;
+                        const float* tap = w + (i*mFilterSize + j)*block;
+                        for (int l = 0; l < block; ++l)
+                            out[l] += tap[l]*px[l];
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Depthwise kernel
+ * Same window bounds as convolve(); for every tap the C products of a
+ * pixel are one contiguous multiply-add over channels.
+ * @param image n x n x C input
+ * @param filter k x k x C taps
+ * @param outImage n x n x C output
+ */
+void GroupedConvolution2D::depthwise(const float* image, const float* filter,
+                                     float* outImage) const
+{
+    int hFltrSz = (mFilterSize+1)/2;
+    int c = mChannels;
+    for (int x = 0; x < mImgSize; ++x) {
+        int startx = max(hFltrSz-1-x, 0);
+        int endx = mFilterSize + min(mImgSize - x - hFltrSz,0);
+        for (int y = 0; y < mImgSize; ++y) {
+            int starty = max(hFltrSz-1-y, 0);
+            int endy = mFilterSize + min(mImgSize - y - hFltrSz,0);
+            float* out = outImage + (size_t(x)*mImgSize + y)*c;
+            fill(out, out + c, 0.0f);
+            for (int i = startx; i < endx; ++i) {
+                for (int j = starty; j < endy; ++j) {
+                    const float* in = image +
+                        (size_t(x+i-hFltrSz+1)*mImgSize + y+j-hFltrSz+1)*c;
+                    const float* w = filter + size_t(i*mFilterSize + j)*c;
+                    for (int ch = 0; ch < c; ++ch)
+                        out[ch] += w[ch]*in[ch];
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Grouped kernel
+ * For every tap and input channel, the input value is broadcast over
+ * the contiguous output channels of its group.
+ * @param image n x n x C input
+ * @param filter k x k x C/groups x outChannels taps
+ * @param outImage n x n x outChannels output
+ */
+void GroupedConvolution2D::grouped(const float* image, const float* filter,
+                                   float* outImage) const
+{
+    int hFltrSz = (mFilterSize+1)/2;
+    int inPerGroup = mChannels/mGroups;
+    int outPerGroup = mOutChannels/mGroups;
+    for (int x = 0; x < mImgSize; ++x) {
+        int startx = max(hFltrSz-1-x, 0);
+        int endx = mFilterSize + min(mImgSize - x - hFltrSz,0);
+        for (int y = 0; y < mImgSize; ++y) {
+            int starty = max(hFltrSz-1-y, 0);
+            int endy = mFilterSize + min(mImgSize - y - hFltrSz,0);
+            float* out = outImage + (size_t(x)*mImgSize + y)*mOutChannels;
+            fill(out, out + mOutChannels, 0.0f);
+            for (int i = startx; i < endx; ++i) {
+                for (int j = starty; j < endy; ++j) {
+                    const float* in = image +
+                        (size_t(x+i-hFltrSz+1)*mImgSize + y+j-hFltrSz+1)*
+                        mChannels;
+                    const float* tap = filter +
+                        size_t(i*mFilterSize + j)*inPerGroup*mOutChannels;
+                    for (int g = 0; g < mGroups; ++g) {
+                        float* gOut = out + g*outPerGroup;
+                        for (int ci = 0; ci < inPerGroup; ++ci) {
+                            float v = in[g*inPerGroup + ci];
+                            const float* w = tap + ci*mOutChannels +
+                                             g*outPerGroup;
+                            for (int co = 0; co < outPerGroup; ++co)
+                                gOut[co] += v*w[co];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,165 @@
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * Implementation code for layout conversions of image tensors.
+ */
+#include "ImageTensor.hpp"
+#include <cassert>
+#include <algorithm>
+#include <stdexcept>
+
+// utility function transposing a rows x cols matrix in square tiles,
+// dst[j*dstStride + i] = src[i*srcStride + j]
+static
+void transpose(const float* src, size_t srcStride, float* dst,
+               size_t dstStride, int rows, int cols)
+{
+    const int tile = ImageTensor::TRANSPOSE_TILE;
+    for (int i0 = 0; i0 < rows; i0 += tile) {
+        int i1 = min(i0 + tile, rows);
+        for (int j0 = 0; j0 < cols; j0 += tile) {
+            int j1 = min(j0 + tile, cols);
+            for (int i = i0; i < i1; ++i) {
+                const float* in = src + i*srcStride;
+                for (int j = j0; j < j1; ++j)
+                    dst[j*dstStride + i] = in[j];
+            }
+        }
+    }
+}
+
+/**
+ * Constructor
+ * @param batch images in the batch
+ * @param channels channels of every image
+ * @param height rows of every image
+ * @param width columns of every image
+ * @param layout memory order
+ * @param block channels per block, NCHWc only
+ */
+ImageTensor::ImageTensor(int batch, int channels, int height, int width,
+                         TensorLayout layout, int block):
+                             mBatch(batch), mChannels(channels),
+                             mHeight(height), mWidth(width),
+                             mLayout(layout),
+                             mBlock(layout == NCHWc ? block : 1)
+{
+    if (batch <= 0 || channels <= 0 || height <= 0 || width <= 0) {
+        throw runtime_error(
+                string("Fatal error: tensor dimensions should be positive"));
+    }
+    if (mBlock <= 0) {
+        throw runtime_error(
+                string("Fatal error: channel block should be positive"));
+    }
+    mData.assign(size_t(mBatch)*blocks()*mBlock*mHeight*mWidth, 0);
+}
+
+/**
+ * Offset of an element
+ * @param n image
+ * @param c channel
+ * @param h row
+ * @param w column
+ * @return offset in floats
+ */
+size_t ImageTensor::offset(int n, int c, int h, int w) const
+{
+    assert(n >= 0 && n < mBatch && c >= 0 && c < mChannels);
+    assert(h >= 0 && h < mHeight && w >= 0 && w < mWidth);
+    size_t pixel = size_t(h)*mWidth + w;
+    size_t plane = size_t(mHeight)*mWidth;
+    switch (mLayout) {
+    case NHWC:
+        return (n*plane + pixel)*mChannels + c;
+    case NCHWc:
+        return ((size_t(n)*blocks() + c/mBlock)*plane + pixel)*mBlock +
+               c%mBlock;
+    default:
+        return (size_t(n)*mChannels + c)*plane + pixel;
+    }
+}
+
+/**
+ * Layout conversion
+ * - NCHW <-> NHWC: one tiled C x HW transpose per image
+ * - NCHW <-> NCHWc: one tiled block x HW transpose per channel block
+ * - NHWC <-> NCHWc: the block of every pixel is a contiguous copy
+ * - NCHWc to another block size goes through NCHW
+ * @param layout memory order of the result
+ * @param block channels per block, NCHWc only
+ * @return converted copy
+ */
+ImageTensor ImageTensor::to(TensorLayout layout, int block) const
+{
+    ImageTensor result(mBatch, mChannels, mHeight, mWidth, layout, block);
+    if (layout == mLayout && result.mBlock == mBlock) {
+        result.mData = mData;
+        return result;
+    }
+    if (layout == NCHWc && mLayout == NCHWc)
+        return to(NCHW).to(NCHWc, block);
+
+    int plane = mHeight*mWidth;
+    int c = mChannels;
+    for (int n = 0; n < mBatch; ++n) {
+        if (mLayout == NCHW && layout == NHWC) {
+            transpose(data() + size_t(n)*c*plane, plane,
+                      result.data() + size_t(n)*plane*c, c, c, plane);
+        } else if (mLayout == NHWC && layout == NCHW) {
+            transpose(data() + size_t(n)*plane*c, c,
+                      result.data() + size_t(n)*c*plane, plane, plane, c);
+        } else {
+            const ImageTensor& blocked = mLayout == NCHWc ? *this : result;
+            int b = blocked.mBlock;
+            for (int cb = 0; cb < blocked.blocks(); ++cb) {
+                int lanes = min(b, c - cb*b);
+                size_t blockBase = (size_t(n)*blocked.blocks() + cb)*plane*b;
+                if (mLayout == NCHW) {
+                    transpose(data() + (size_t(n)*c + cb*b)*plane, plane,
+                              result.data() + blockBase, b, lanes, plane);
+                } else if (layout == NCHW) {
+                    transpose(data() + blockBase, b,
+                              result.data() + (size_t(n)*c + cb*b)*plane,
+                              plane, plane, lanes);
+                } else {
+                    bool toBlocked = layout == NCHWc;
+                    for (int p = 0; p < plane; ++p) {
+                        size_t hwc = (size_t(n)*plane + p)*c + cb*b;
+                        size_t blk = blockBase + size_t(p)*b;
+                        if (toBlocked)
+                            copy_n(data() + hwc, lanes, result.data() + blk);
+                        else
+                            copy_n(data() + blk, lanes, result.data() + hwc);
+                    }
+                }
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * Printable name of a layout
+ * @param layout memory order
+ * @return name
+ */
+const char* ImageTensor::layoutName(TensorLayout layout)
+{
+    switch (layout) {
+    case NCHW:  return "NCHW";
+    case NHWC:  return "NHWC";
+    case NCHWc: return "NCHWc";
+    default:    return "?";
+    }
+}
@@ -0,0 +1,163 @@
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * Implementation code for incremental convolution of successive frames.
+ */
+#include "IncrementalConvolution2D.hpp"
+#include <cassert>
+#include <algorithm>
+#include <stdexcept>
+
+/**
+ * Constructor
+ * Size checking is done by the underlying Convolution2D.
+ * @param imgSize size of every frame
+ * @param filter filter applied to every frame
+ */
+IncrementalConvolution2D::IncrementalConvolution2D(int imgSize,
+                                       vector<vector<float>>& filter):
+                             mConv(imgSize, filter.size()),
+                             mImgSize(imgSize), mFilterSize(filter.size()),
+                             mFilter(filter), mPrimed(false),
+                             mLastRecomputed(0)
+{
+    for (size_t i = 0; i < filter.size(); ++i) {
+        if (filter[i].size() != filter.size()) {
+            throw runtime_error(
+                    string("Fatal error: filter should be square"));
+        }
+    }
+}
+
+/**
+ * Mark output pixels affected by a dirty input rectangle
+ * An input pixel is read by every output pixel within the filter
+ * radius of it, so the rectangle is grown by the radius on all sides.
+ * @param mask output mask to update
+ * @param rect changed input pixels
+ */
+void IncrementalConvolution2D::markDirty(vector<vector<char>>& mask,
+                                         const DirtyRect& rect)
+{
+    int radius = mFilterSize/2;
+    int x0 = max(rect.x0 - radius, 0);
+    int y0 = max(rect.y0 - radius, 0);
+    int x1 = min(rect.x1 + radius, mImgSize);
+    int y1 = min(rect.y1 + radius, mImgSize);
+    for (int x = x0; x < x1; ++x)
+        fill(mask[x].begin() + y0, mask[x].begin() + max(y0, y1), 1);
+}
+
+/**
+ * Recompute the output pixels marked in the mask
+ * Each row is split into runs of marked pixels so that overlapping
+ * rectangles are only recomputed once.
+ * @param mask output pixels to recompute
+ */
+void IncrementalConvolution2D::recompute(vector<vector<char>>& mask)
+{
+    mLastRecomputed = 0;
+    for (int x = 0; x < mImgSize; ++x) {
+        int y = 0;
+        while (y < mImgSize) {
+            if (!mask[x][y]) {
+                ++y;
+                continue;
+            }
+            int start = y;
+            while (y < mImgSize && mask[x][y])
+                ++y;
+            mConv.convolveRegion(mPrevImage, mFilter, mPrevOutput,
+                                 x, start, x+1, y);
+            mLastRecomputed += y - start;
+        }
+    }
+}
+
+/**
+ * Convolve a new frame by diffing against the previous frame
+ * The frame is compared tile by tile; changed tiles are copied into
+ * the retained frame and treated as dirty rectangles.
+ * @param image input matrix image
+ * @return convolution of the new frame
+ */
+const vector<vector<float>>&
+IncrementalConvolution2D::update(vector<vector<float>>& image)
+{
+    assert(image.size() == mImgSize);
+    assert(image[0].size() == mImgSize);
+
+    if (!mPrimed) {
+        mPrevImage = image;
+        mPrevOutput = mConv.fastConvolve(mPrevImage, mFilter);
+        mLastRecomputed = mImgSize*mImgSize;
+        mPrimed = true;
+        return mPrevOutput;
+    }
+
+    vector<vector<char>> mask(mImgSize, vector<char>(mImgSize, 0));
+    for (int tx = 0; tx < mImgSize; tx += DIFF_TILE) {
+        for (int ty = 0; ty < mImgSize; ty += DIFF_TILE) {
+            DirtyRect rect = { tx, ty, min(tx + DIFF_TILE, mImgSize),
+                               min(ty + DIFF_TILE, mImgSize) };
+            bool changed = false;
+            for (int x = rect.x0; x < rect.x1 && !changed; ++x) {
+                changed = !equal(image[x].begin() + rect.y0,
+                                 image[x].begin() + rect.y1,
+                                 mPrevImage[x].begin() + rect.y0);
+            }
+            if (!changed)
+                continue;
+            for (int x = rect.x0; x < rect.x1; ++x) {
+                copy(image[x].begin() + rect.y0, image[x].begin() + rect.y1,
+                     mPrevImage[x].begin() + rect.y0);
+            }
+            markDirty(mask, rect);
+        }
+    }
+    recompute(mask);
+    return mPrevOutput;
+}
+
+/**
+ * Convolve a new frame with caller supplied dirty rectangles
+ * @param image input matrix image
+ * @param dirty rectangles of changed input pixels
+ * @return convolution of the new frame
+ */
+const vector<vector<float>>&
+IncrementalConvolution2D::update(vector<vector<float>>& image,
+                                 vector<DirtyRect>& dirty)
+{
+    if (!mPrimed)
+        return update(image);
+
+    assert(image.size() == mImgSize);
+    assert(image[0].size() == mImgSize);
+
+    vector<vector<char>> mask(mImgSize, vector<char>(mImgSize, 0));
+    for (size_t r = 0; r < dirty.size(); ++r) {
+        DirtyRect rect = { max(dirty[r].x0, 0), max(dirty[r].y0, 0),
+                           min(dirty[r].x1, mImgSize),
+                           min(dirty[r].y1, mImgSize) };
+        if (rect.x0 >= rect.x1 || rect.y0 >= rect.y1)
+            continue;
+        for (int x = rect.x0; x < rect.x1; ++x) {
+            copy(image[x].begin() + rect.y0, image[x].begin() + rect.y1,
+                 mPrevImage[x].begin() + rect.y0);
+        }
+        markDirty(mask, rect);
+    }
+    recompute(mask);
+    return mPrevOutput;
+}
@@ -0,0 +1,207 @@
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * Implementation code for the x86-64 emitter of the JIT kernels.
+ */
+#include "JitAssembler.hpp"
+#include <cstring>
+#include <sys/mman.h>
+
+void JitAssembler::dword(uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        byte(value >> (8*i));
+}
+
+void JitAssembler::rex(int reg, int rm)
+{
+    int bits = (reg >> 3 & 1) << 2 | (rm >> 3 & 1);
+    if (bits)
+        byte(0x40 | bits);
+}
+
+void JitAssembler::vex(int map, int pp, int reg, int vvvv, int rm)
+{
+    byte(0xC4);
+    byte((~reg >> 3 & 1) << 7 | 1 << 6 | (~rm >> 3 & 1) << 5 | map);
+    // W0, 256 bit
+    byte((~vvvv & 15) << 3 | 1 << 2 | pp);
+}
+
+void JitAssembler::memory(int reg, int base, int32_t disp)
+{
+    modrm(2, reg, base);
+    dword(disp);
+}
+
+void JitAssembler::constant(int reg, float value)
+{
+    int index = 0;
+    while (index < int(mPool.size()) &&
+           memcmp(&mPool[index], &value, sizeof(float)) != 0)
+        ++index;
+    if (index == int(mPool.size()))
+        mPool.push_back(value);
+    modrm(0, reg, 5);
+    mPoolRefs.push_back(make_pair(mCode.size(), index));
+    dword(0);
+}
+
+void JitAssembler::sse(int opcode, int dst, int src)
+{
+    rex(dst, src);
+    byte(0x0F);
+    byte(opcode);
+    modrm(3, dst, src);
+}
+
+void JitAssembler::movups(int xmm, Base base, int32_t disp)
+{
+    rex(xmm, 0);
+    byte(0x0F);
+    byte(0x10);
+    memory(xmm, base, disp);
+}
+
+void JitAssembler::movups(Base base, int32_t disp, int xmm)
+{
+    rex(xmm, 0);
+    byte(0x0F);
+    byte(0x11);
+    memory(xmm, base, disp);
+}
+
+void JitAssembler::movss(int xmm, float value)
+{
+    byte(0xF3);
+    rex(xmm, 0);
+    byte(0x0F);
+    byte(0x10);
+    constant(xmm, value);
+}
+
+void JitAssembler::shufps(int dst, int src, int imm)
+{
+    sse(0xC6, dst, src);
+    byte(imm);
+}
+
+void JitAssembler::vbroadcastss(int ymm, float value)
+{
+    vex(2, 1, ymm, 0, 0);
+    byte(0x18);
+    constant(ymm, value);
+}
+
+void JitAssembler::vfmadd231ps(int acc, int src, Base base, int32_t disp)
+{
+    vex(2, 1, acc, src, 0);
+    byte(0xB8);
+    memory(acc, base, disp);
+}
+
+void JitAssembler::vmovups(Base base, int32_t disp, int ymm)
+{
+    vex(1, 0, ymm, 0, 0);
+    byte(0x11);
+    memory(ymm, base, disp);
+}
+
+void JitAssembler::vxorps(int dst, int a, int b)
+{
+    vex(1, 0, dst, a, b);
+    byte(0x57);
+    modrm(3, dst, b);
+}
+
+void JitAssembler::vmaxps(int dst, int a, int b)
+{
+    vex(1, 0, dst, a, b);
+    byte(0x5F);
+    modrm(3, dst, b);
+}
+
+void JitAssembler::vzeroupper()
+{
+    byte(0xC5);
+    byte(0xF8);
+    byte(0x77);
+}
+
+void JitAssembler::movEcx(uint32_t value)
+{
+    byte(0xB9);
+    dword(value);
+}
+
+void JitAssembler::add(Base base, int32_t value)
+{
+    byte(0x48);
+    byte(0x81);
+    modrm(3, 0, base);
+    dword(value);
+}
+
+void JitAssembler::decEcx()
+{
+    byte(0xFF);
+    modrm(3, 1, 1);
+}
+
+void JitAssembler::jnz(size_t target)
+{
+    byte(0x0F);
+    byte(0x85);
+    dword(uint32_t(int32_t(target - (mCode.size() + 4))));
+}
+
+/**
+ * Copy code and constants into executable memory
+ * The pool starts at the first 16 byte boundary after the code; every
+ * RIP-relative displacement is relative to the end of its instruction,
+ * which is the end of the displacement for all operands used here.
+ * @param bytes length of the mapping
+ * @return entry point, NULL on failure
+ */
+void* JitAssembler::finalize(size_t& bytes) const
+{
+    size_t pool = (mCode.size() + 15) & ~size_t(15);
+    bytes = pool + mPool.size()*sizeof(float);
+    void* map = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+    uint8_t* code = static_cast<uint8_t*>(map);
+    memcpy(code, mCode.data(), mCode.size());
+    // int3 padding up to the pool
+    memset(code + mCode.size(), 0xCC, pool - mCode.size());
+    if (!mPool.empty())
+        memcpy(code + pool, mPool.data(), mPool.size()*sizeof(float));
+    for (size_t i = 0; i < mPoolRefs.size(); ++i) {
+        size_t at = mPoolRefs[i].first;
+        int32_t disp = int32_t(pool + mPoolRefs[i].second*sizeof(float) -
+                               (at + 4));
+        memcpy(code + at, &disp, sizeof(disp));
+    }
+    if (mprotect(map, bytes, PROT_READ | PROT_EXEC) != 0) {
+        munmap(map, bytes);
+        return NULL;
+    }
+    return map;
+}
+
+void JitAssembler::release(void* code, size_t bytes)
+{
+    if (code)
+        munmap(code, bytes);
+}
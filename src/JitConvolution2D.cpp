@@ -0,0 +1,318 @@
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * Implementation code for JIT generated convolution kernels.
+ */
+#include "JitConvolution2D.hpp"
+#include "JitAssembler.hpp"
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+
+/** Generated code of one shape and filter */
+struct JitKernel {
+    typedef void (*Entry)(const float* padded, float* output);
+
+    Entry entry;
+    void* code;
+    size_t bytes;
+
+    JitKernel() : entry(NULL), code(NULL), bytes(0) {}
+    ~JitKernel() { JitAssembler::release(code, bytes); }
+};
+
+namespace {
+/** Process-wide kernel cache, least recently used first out */
+struct KernelCache {
+    typedef list<pair<string, shared_ptr<JitKernel>>> Entries;
+
+    mutex lock;
+    Entries entries; /** most recently used first */
+    unordered_map<string, Entries::iterator> index;
+};
+
+KernelCache& kernelCache()
+{
+    static KernelCache cache;
+    return cache;
+}
+}
+
+/**
+ * Constructor
+ * @param imgSize size of image
+ * @param filterSize size of filter
+ * @param stride output subsampling
+ * @param epilogue operation on the sums
+ * @param isa requested instruction set
+ */
+JitConvolution2D::JitConvolution2D(int imgSize, int filterSize, int stride,
+                                   JitEpilogue epilogue, JitIsa isa):
+                             mImgSize(imgSize), mFilterSize(filterSize),
+                             mStride(stride), mEpilogue(epilogue),
+                             mIsa(min(isa, detectIsa())), mJitted(false),
+                             mFallback(imgSize, filterSize)
+{
+    if (stride < 1 || stride > imgSize) {
+        throw runtime_error(
+                string("Fatal error: stride should be in range 1-image size"));
+    }
+    int lanes = mIsa == JIT_ISA_AVX2 ? 8 : 4;
+    mOutSize = (mImgSize + mStride - 1)/mStride;
+    mOutStride = (mOutSize + lanes - 1)/lanes*lanes;
+    // the last vector of a row reads up to (k-1)/s past the row end
+    mPhaseWidth = mOutStride + (mFilterSize - 1)/mStride;
+    int rows = (mOutSize - 1)*mStride + mFilterSize;
+    mPadded.assign(size_t(rows)*mStride*mPhaseWidth, 0);
+    mOutput.assign(size_t(mOutSize)*mOutStride, 0);
+}
+
+JitConvolution2D::~JitConvolution2D()
+{
+}
+
+/**
+ * Best instruction set of this CPU
+ * @return instruction set
+ */
+JitIsa JitConvolution2D::detectIsa()
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return JIT_ISA_AVX2;
+    return JIT_ISA_SSE;
+#else
+    return JIT_ISA_NONE;
+#endif
+}
+
+size_t JitConvolution2D::cachedKernels()
+{
+    KernelCache& cache = kernelCache();
+    lock_guard<mutex> guard(cache.lock);
+    return cache.entries.size();
+}
+
+void JitConvolution2D::clearKernels()
+{
+    KernelCache& cache = kernelCache();
+    lock_guard<mutex> guard(cache.lock);
+    cache.index.clear();
+    cache.entries.clear();
+}
+
+/**
+ * Emit the kernel of mFilter
+ * Padded row R of phase p holds padded columns p, p+s, p+2s, ..., so
+ * tap (i, j) of output (x, y) reads row x*s+i, phase j%s, element
+ * y + j/s: contiguous in y for every stride.
+ * - rdi walks the padded rows, rsi the output rows, ecx counts rows
+ * - a row is split into blocks of as many vectors as there are free
+ *   accumulator registers; every block runs all taps
+ * - SSE: acc 0-12, broadcast weight 13, load 14, zero 15
+ * - AVX2: acc 0-13, broadcast weight 14, zero 15; the load is folded
+ *   into the FMA
+ * @return kernel, NULL if the code cannot be made executable
+ */
+shared_ptr<JitKernel> JitConvolution2D::generate() const
+{
+    bool avx = mIsa == JIT_ISA_AVX2;
+    int lanes = avx ? 8 : 4;
+    int maxAcc = avx ? 14 : 13;
+    int weight = avx ? 14 : 13;
+    int load = 14;
+    int zero = 15;
+    int vectors = mOutStride/lanes;
+    int blocks = (vectors + maxAcc - 1)/maxAcc;
+    int rowStride = mStride*mPhaseWidth;
+    bool relu = mEpilogue == JIT_EPILOGUE_RELU;
+
+    JitAssembler as;
+    if (relu) {
+        if (avx)
+            as.vxorps(zero, zero, zero);
+        else
+            as.xorps(zero, zero);
+    }
+    as.movEcx(mOutSize);
+    size_t top = as.here();
+    for (int b = 0; b < blocks; ++b) {
+        // balanced blocks, e.g. 16 vectors as 8 + 8 rather than 13 + 3
+        int first = vectors*b/blocks;
+        int count = vectors*(b + 1)/blocks - first;
+        for (int v = 0; v < count; ++v) {
+            if (avx)
+                as.vxorps(v, v, v);
+            else
+                as.xorps(v, v);
+        }
+        for (int i = 0; i < mFilterSize; ++i) {
+            for (int j = 0; j < mFilterSize; ++j) {
+                float w = mFilter[i*mFilterSize + j];
+                if (w == 0)
+                    continue;
+                int tap = i*rowStride + (j%mStride)*mPhaseWidth + j/mStride;
+                if (avx) {
+                    as.vbroadcastss(weight, w);
+                } else {
+                    as.movss(weight, w);
+                    as.shufps(weight, weight, 0);
+                }
+                for (int v = 0; v < count; ++v) {
+                    int32_t disp = 4*(tap + (first + v)*lanes);
+                    if (avx) {
+                        as.vfmadd231ps(v, weight, JitAssembler::RDI, disp);
+                    } else {
+                        as.movups(load, JitAssembler::RDI, disp);
+                        as.mulps(load, weight);
+                        as.addps(v, load);
+                    }
+                }
+            }
+        }
+        for (int v = 0; v < count; ++v) {
+            int32_t disp = 4*(first + v)*lanes;
+            if (avx) {
+                if (relu)
+                    as.vmaxps(v, v, zero);
+                as.vmovups(JitAssembler::RSI, disp, v);
+            } else {
+                if (relu)
+                    as.maxps(v, zero);
+                as.movups(JitAssembler::RSI, disp, v);
+            }
+        }
+    }
+    as.add(JitAssembler::RDI, 4*mStride*rowStride);
+    as.add(JitAssembler::RSI, 4*mOutStride);
+    as.decEcx();
+    as.jnz(top);
+    if (avx)
+        as.vzeroupper();
+    as.ret();
+
+    shared_ptr<JitKernel> kernel = make_shared<JitKernel>();
+    kernel->code = as.finalize(kernel->bytes);
+    if (!kernel->code)
+        return shared_ptr<JitKernel>();
+    kernel->entry = reinterpret_cast<JitKernel::Entry>(kernel->code);
+    return kernel;
+}
+
+/**
+ * Kernel of mFilter from the cache
+ * The kernel is generated outside the lock; two engines missing on the
+ * same key at once both generate it and the first one is kept.
+ * @return kernel, NULL if it cannot be run
+ */
+shared_ptr<JitKernel> JitConvolution2D::lookup() const
+{
+    int shape[] = { mImgSize, mFilterSize, mStride, mIsa, mEpilogue };
+    string key(reinterpret_cast<const char*>(shape), sizeof(shape));
+    key.append(reinterpret_cast<const char*>(mFilter.data()),
+               mFilter.size()*sizeof(float));
+
+    KernelCache& cache = kernelCache();
+    {
+        lock_guard<mutex> guard(cache.lock);
+        auto found = cache.index.find(key);
+        if (found != cache.index.end()) {
+            cache.entries.splice(cache.entries.begin(), cache.entries,
+                                 found->second);
+            return found->second->second;
+        }
+    }
+    shared_ptr<JitKernel> kernel = generate();
+    if (!kernel)
+        return kernel;
+    lock_guard<mutex> guard(cache.lock);
+    auto found = cache.index.find(key);
+    if (found != cache.index.end())
+        return found->second->second;
+    cache.entries.push_front(make_pair(key, kernel));
+    cache.index[key] = cache.entries.begin();
+    while (cache.entries.size() > MAX_KERNELS) {
+        cache.index.erase(cache.entries.back().first);
+        cache.entries.pop_back();
+    }
+    return kernel;
+}
+
+/**
+ * JIT 2D convolution
+ * Assume 'same' mode, subsampled by the stride
+ * - the filter is compared with the one of the held kernel, so a
+ *   repeated filter costs no cache lookup
+ * - padded column c of image row x goes to phase c%s at c/s; columns
+ *   no tap reads are skipped
+ * @param image input matrix image
+ * @param filter input matrix filter
+ * @return returns outSize() square output matrix
+ */
+vector<vector<float>>
+JitConvolution2D::convolve(vector<vector<float>>& image,
+                           vector<vector<float>>& filter)
+{
+    assert(filter.size() == mFilterSize);
+    assert(filter[0].size() == mFilterSize);
+    assert(image.size() == mImgSize);
+    assert(image[0].size() == mImgSize);
+
+    vector<float> flat;
+    for (int i = 0; i < mFilterSize; ++i)
+        flat.insert(flat.end(), filter[i].begin(), filter[i].end());
+    if (mIsa != JIT_ISA_NONE && (!mKernel || flat != mFilter)) {
+        mFilter.swap(flat);
+        mKernel = lookup();
+    }
+    mJitted = mIsa != JIT_ISA_NONE && mKernel;
+
+    vector<vector<float>> result(mOutSize, vector<float>(mOutSize));
+    if (!mJitted) {
+        vector<vector<float>> full = mFallback.fastConvolve(image, filter);
+        for (int x = 0; x < mOutSize; ++x) {
+            for (int y = 0; y < mOutSize; ++y) {
+                float v = full[x*mStride][y*mStride];
+                result[x][y] = mEpilogue == JIT_EPILOGUE_RELU ?
+                               max(v, 0.0f) : v;
+            }
+        }
+        return result;
+    }
+
+    int radius = mFilterSize/2;
+    int rowStride = mStride*mPhaseWidth;
+    int rows = mPadded.size()/rowStride;
+    for (int x = 0; x < mImgSize; ++x) {
+        int r = x + radius;
+        if (r >= rows)
+            break;
+        float* row = &mPadded[size_t(r)*rowStride];
+        for (int y = 0; y < mImgSize; ++y) {
+            int c = y + radius;
+            if (c/mStride < mPhaseWidth)
+                row[(c%mStride)*mPhaseWidth + c/mStride] = image[x][y];
+        }
+    }
+    mKernel->entry(&mPadded[0], &mOutput[0]);
+    for (int x = 0; x < mOutSize; ++x)
+        copy_n(mOutput.begin() + size_t(x)*mOutStride, mOutSize,
+               result[x].begin());
+    return result;
+}
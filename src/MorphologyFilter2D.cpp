@@ -0,0 +1,220 @@
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * Implementation code for morphological and rank filters.
+ */
+#include "MorphologyFilter2D.hpp"
+#include "Convolution2D.hpp"
+#include <cassert>
+#include <algorithm>
+
+/**
+ * Constructor
+ * @param imgSize size of image
+ * @param windowSize size of window
+ */
+MorphologyFilter2D::MorphologyFilter2D(int imgSize, int windowSize):
+                             mImgSize(imgSize), mWindowSize(windowSize)
+{
+    // same size checks as the convolution whose windows are used
+    Convolution2D check(imgSize, windowSize);
+    int padded = mImgSize + mWindowSize - 1;
+    int length = (padded + mWindowSize - 1)/mWindowSize*mWindowSize;
+    mLine.assign(length, 0);
+    mPrefix.resize(length);
+    mSuffix.resize(length);
+}
+
+/**
+ * van Herk/Gil-Werman on one line
+ * The padded line is cut into blocks of k. Window [y, y+k-1] covers
+ * the end of one block and the start of the next, so its extreme is
+ * that of the suffix from y and the prefix to y+k-1.
+ * @param in first pixel of the line
+ * @param stride distance between pixels of the line
+ * @param out first output pixel
+ * @param outStride distance between output pixels
+ */
+template <bool Dilate>
+void MorphologyFilter2D::extremeLine(const float* in, int stride,
+                                     float* out, int outStride)
+{
+    int k = mWindowSize;
+    int length = mLine.size();
+    for (int i = 0; i < mImgSize; ++i)
+        mLine[k/2 + i] = in[i*stride];
+    for (int i = 0; i < length; ++i) {
+        float v = mLine[i];
+        mPrefix[i] = i%k == 0 ? v : Dilate ? max(mPrefix[i-1], v) :
+                                             min(mPrefix[i-1], v);
+    }
+    for (int i = length - 1; i >= 0; --i) {
+        float v = mLine[i];
+        mSuffix[i] = i%k == k-1 ? v : Dilate ? max(mSuffix[i+1], v) :
+                                               min(mSuffix[i+1], v);
+    }
+    for (int y = 0; y < mImgSize; ++y)
+        out[y*outStride] = Dilate ? max(mSuffix[y], mPrefix[y + k - 1]) :
+                                    min(mSuffix[y], mPrefix[y + k - 1]);
+}
+
+/**
+ * Min or max over the window
+ * Separable: rows outside the image are all zero, so the column pass
+ * with zero padding sees exactly the row pass of the padded rows.
+ * @param image input matrix image
+ * @return filtered image
+ */
+template <bool Dilate>
+vector<vector<float>>
+MorphologyFilter2D::extreme(vector<vector<float>>& image)
+{
+    assert(image.size() == mImgSize);
+    assert(image[0].size() == mImgSize);
+
+    int n = mImgSize;
+    vector<float> rows(n*n);
+    for (int x = 0; x < n; ++x)
+        extremeLine<Dilate>(&image[x][0], 1, &rows[x*n], 1);
+    vector<float> cols(n*n);
+    for (int y = 0; y < n; ++y)
+        extremeLine<Dilate>(&rows[y], n, &cols[y], n);
+    vector<vector<float>> result(n);
+    for (int x = 0; x < n; ++x)
+        result[x].assign(cols.begin() + x*n, cols.begin() + (x+1)*n);
+    return result;
+}
+
+vector<vector<float>> MorphologyFilter2D::erode(vector<vector<float>>& image)
+{
+    return extreme<false>(image);
+}
+
+vector<vector<float>> MorphologyFilter2D::dilate(vector<vector<float>>& image)
+{
+    return extreme<true>(image);
+}
+
+/**
+ * Perreault-Hebert median
+ * Works on the zero padded image of ranks, with one histogram per
+ * padded column over the k rows of the current output row, and one
+ * for the window.
+ * - moving down a row updates every column histogram by one removed
+ *   and one added pixel
+ * - moving right adds the entering column and subtracts the leaving
+ *   one, on the coarse level only
+ * - the coarse level locates the median group; the fine bins of that
+ *   group are then caught up from the column they were last valid for,
+ *   or rebuilt from the k window columns if that is cheaper
+ * @param image input matrix image
+ * @return median filtered image
+ */
+vector<vector<float>> MorphologyFilter2D::median(vector<vector<float>>& image)
+{
+    assert(image.size() == mImgSize);
+    assert(image[0].size() == mImgSize);
+
+    int n = mImgSize;
+    int k = mWindowSize;
+    int width = n + k - 1;
+
+    // the padding zero is a value of every image
+    vector<float> values(1, 0.0f);
+    for (int x = 0; x < n; ++x)
+        values.insert(values.end(), image[x].begin(), image[x].end());
+    sort(values.begin(), values.end());
+    values.erase(unique(values.begin(), values.end()), values.end());
+    int groups = (values.size() + RANK_GROUP - 1)/RANK_GROUP;
+    int bins = groups*RANK_GROUP;
+    uint16_t zero = lower_bound(values.begin(), values.end(), 0.0f) -
+                    values.begin();
+    vector<uint16_t> ranks(width*width, zero);
+    for (int x = 0; x < n; ++x)
+        for (int y = 0; y < n; ++y)
+            ranks[(x + k/2)*width + y + k/2] =
+                lower_bound(values.begin(), values.end(), image[x][y]) -
+                values.begin();
+
+    vector<uint16_t> colCoarse(width*groups, 0);
+    vector<uint16_t> colFine(width*bins, 0);
+    for (int row = 0; row < k; ++row) {
+        for (int c = 0; c < width; ++c) {
+            int rank = ranks[row*width + c];
+            ++colCoarse[c*groups + rank/RANK_GROUP];
+            ++colFine[c*bins + rank];
+        }
+    }
+
+    vector<int> coarse(groups);
+    vector<int> fine(bins);
+    // window end column the fine bins of each group were summed for
+    vector<int> validTo(groups);
+    int half = (k*k + 1)/2;
+    vector<vector<float>> result(n, vector<float>(n));
+    for (int x = 0; x < n; ++x) {
+        if (x > 0) {
+            for (int c = 0; c < width; ++c) {
+                int out = ranks[(x - 1)*width + c];
+                int in = ranks[(x + k - 1)*width + c];
+                --colCoarse[c*groups + out/RANK_GROUP];
+                --colFine[c*bins + out];
+                ++colCoarse[c*groups + in/RANK_GROUP];
+                ++colFine[c*bins + in];
+            }
+        }
+        fill(coarse.begin(), coarse.end(), 0);
+        for (int c = 0; c < k; ++c)
+            for (int g = 0; g < groups; ++g)
+                coarse[g] += colCoarse[c*groups + g];
+        fill(validTo.begin(), validTo.end(), -k - 1);
+
+        for (int y = 0; y < n; ++y) {
+            int end = y + k - 1;
+            if (y > 0) {
+                for (int g = 0; g < groups; ++g)
+                    coarse[g] += colCoarse[end*groups + g] -
+                                 colCoarse[(y - 1)*groups + g];
+            }
+            int count = 0;
+            int g = 0;
+            while (count + coarse[g] < half)
+                count += coarse[g++];
+
+            int* bin = &fine[g*RANK_GROUP];
+            if (end - validTo[g] >= k) {
+                fill(bin, bin + RANK_GROUP, 0);
+                for (int c = y; c <= end; ++c) {
+                    const uint16_t* col = &colFine[c*bins + g*RANK_GROUP];
+                    for (int b = 0; b < RANK_GROUP; ++b)
+                        bin[b] += col[b];
+                }
+            } else {
+                for (int c = validTo[g] + 1; c <= end; ++c) {
+                    const uint16_t* in = &colFine[c*bins + g*RANK_GROUP];
+                    const uint16_t* out =
+                        &colFine[(c - k)*bins + g*RANK_GROUP];
+                    for (int b = 0; b < RANK_GROUP; ++b)
+                        bin[b] += in[b] - out[b];
+                }
+            }
+            validTo[g] = end;
+
+            int b = 0;
+            while (count + bin[b] < half)
+                count += bin[b++];
+            result[x][y] = values[g*RANK_GROUP + b];
+        }
+    }
+    return result;
+}
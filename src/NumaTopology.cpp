@@ -0,0 +1,163 @@
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * Implementation code for NUMA topology detection.
+ */
+#include "NumaTopology.hpp"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <thread>
+#include <sched.h>
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
+
+/**
+ * Constructor
+ * One node with the CPUs of the affinity mask of the process.
+ */
+NumaTopology::NumaTopology()
+{
+    vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if (CPU_ISSET(cpu, &set))
+                cpus.push_back(cpu);
+    }
+    if (cpus.empty()) {
+        int count = max(int(thread::hardware_concurrency()), 1);
+        for (int cpu = 0; cpu < count; ++cpu)
+            cpus.push_back(cpu);
+    }
+    mNodeCpus.push_back(cpus);
+}
+
+/**
+ * Constructor
+ * @param nodeCpus CPU ids of every node, empty nodes are dropped
+ */
+NumaTopology::NumaTopology(const vector<vector<int>>& nodeCpus)
+{
+    for (size_t i = 0; i < nodeCpus.size(); ++i)
+        if (!nodeCpus[i].empty())
+            mNodeCpus.push_back(nodeCpus[i]);
+    if (mNodeCpus.empty()) {
+        throw runtime_error(
+                string("Fatal error: NUMA topology without CPUs"));
+    }
+}
+
+/**
+ * Parse a sysfs cpulist
+ * @param list cpulist such as "0-3,8-11"
+ * @return CPU ids in ascending order
+ */
+vector<int> NumaTopology::parseCpuList(const string& list)
+{
+    vector<int> cpus;
+    istringstream ranges(list);
+    string range;
+    while (getline(ranges, range, ',')) {
+        if (range.find_first_of("0123456789") == string::npos)
+            continue;
+        size_t dash = range.find('-');
+        int first = stoi(range.substr(0, dash));
+        int last = dash == string::npos ? first : stoi(range.substr(dash+1));
+        for (int cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+    }
+    sort(cpus.begin(), cpus.end());
+    cpus.erase(unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
+
+/**
+ * Parse a topology description
+ * @param spec nodes separated by ':' in cpulist syntax
+ * @return parsed topology
+ */
+NumaTopology NumaTopology::fromString(const string& spec)
+{
+    vector<vector<int>> nodeCpus;
+    istringstream nodes(spec);
+    string node;
+    while (getline(nodes, node, ':'))
+        nodeCpus.push_back(parseCpuList(node));
+    return NumaTopology(nodeCpus);
+}
+
+/**
+ * Detect the machine topology
+ * sysfs lists every online node as /sys/devices/system/node/nodeN with
+ * its CPUs in the file cpulist. Node numbers may have gaps.
+ * @param source sysfs or libnuma
+ * @return detected topology, a single node if nothing was found
+ */
+NumaTopology NumaTopology::detect(Source source)
+{
+    vector<vector<int>> nodeCpus;
+#ifdef HAVE_LIBNUMA
+    if (source == LIBNUMA && numa_available() >= 0) {
+        for (int node = 0; node <= numa_max_node(); ++node) {
+            struct bitmask* mask = numa_allocate_cpumask();
+            vector<int> cpus;
+            if (numa_node_to_cpus(node, mask) == 0) {
+                for (unsigned cpu = 0; cpu < mask->size; ++cpu)
+                    if (numa_bitmask_isbitset(mask, cpu))
+                        cpus.push_back(cpu);
+            }
+            numa_free_cpumask(mask);
+            nodeCpus.push_back(cpus);
+        }
+    }
+#else
+    // without libnuma every source reads sysfs
+    (void)source;
+#endif
+    if (nodeCpus.empty()) {
+        ifstream online("/sys/devices/system/node/online");
+        string list;
+        if (online.is_open() && getline(online, list)) {
+            vector<int> ids = parseCpuList(list);
+            for (size_t i = 0; i < ids.size(); ++i) {
+                ostringstream path;
+                path << "/sys/devices/system/node/node" << ids[i]
+                     << "/cpulist";
+                ifstream cpulist(path.str().c_str());
+                string cpus;
+                if (cpulist.is_open() && getline(cpulist, cpus))
+                    nodeCpus.push_back(parseCpuList(cpus));
+            }
+        }
+    }
+    for (size_t i = 0; i < nodeCpus.size(); ++i)
+        if (!nodeCpus[i].empty())
+            return NumaTopology(nodeCpus);
+    return NumaTopology();
+}
+
+/**
+ * Total number of CPUs
+ * @return CPU count over all nodes
+ */
+int NumaTopology::totalCpus() const
+{
+    int count = 0;
+    for (size_t i = 0; i < mNodeCpus.size(); ++i)
+        count += mNodeCpus[i].size();
+    return count;
+}
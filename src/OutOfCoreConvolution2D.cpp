@@ -0,0 +1,277 @@
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * Implementation code for out-of-core convolution of image files.
+ */
+#include "OutOfCoreConvolution2D.hpp"
+#include "Convolution2D.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// utility function reading exactly len bytes at offset
+static
+bool preadFully(int fd, void* buf, size_t len, off_t offset)
+{
+    char* p = static_cast<char*>(buf);
+    while (len > 0) {
+        ssize_t n = pread(fd, p, len, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// utility function writing exactly len bytes at offset
+static
+bool pwriteFully(int fd, const void* buf, size_t len, off_t offset)
+{
+    const char* p = static_cast<const char*>(buf);
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+void OutOfCoreConvolution2D::BlockQueue::push(int item)
+{
+    {
+        lock_guard<mutex> guard(lock);
+        items.push_back(item);
+    }
+    cond.notify_one();
+}
+
+int OutOfCoreConvolution2D::BlockQueue::pop()
+{
+    unique_lock<mutex> guard(lock);
+    while (items.empty())
+        cond.wait(guard);
+    int item = items.front();
+    items.pop_front();
+    return item;
+}
+
+/**
+ * Constructor
+ * @param filter input matrix filter
+ * @param memoryBudget bytes for block buffers
+ */
+OutOfCoreConvolution2D::OutOfCoreConvolution2D(vector<vector<float>>& filter,
+                                               size_t memoryBudget):
+                             mFilterSize(filter.size()),
+                             mMemoryBudget(memoryBudget), mLastBlocks(0)
+{
+    // same size checks as the in-memory engine used for the tiles
+    Convolution2D check(Convolution2D::MAX_IMAGE_SIZE, filter.size());
+    for (size_t i = 0; i < filter.size(); ++i) {
+        if (filter[i].size() != filter.size()) {
+            throw runtime_error(
+                    string("Fatal error: filter should be square"));
+        }
+        mFilter.insert(mFilter.end(), filter[i].begin(), filter[i].end());
+    }
+}
+
+/**
+ * Tile size
+ * @return output rows/columns of one tile
+ */
+int OutOfCoreConvolution2D::tileSize() const
+{
+    return Convolution2D::MAX_IMAGE_SIZE - 2*(mFilterSize/2);
+}
+
+/**
+ * Out-of-core 2D convolution
+ * Assume 'same' mode, i.e., input and output images are of same size
+ * - blocks are a whole number of tiles wide, as wide as the budget
+ *   allows for three blocks (read, compute, write) to be in flight
+ * - reader, compute and writer threads pass block indices through
+ *   queues; the free queue bounds the number of blocks in flight
+ * @param inPath input image, rows x cols floats
+ * @param outPath output image, created or truncated
+ * @param rows image rows
+ * @param cols image columns
+ */
+void OutOfCoreConvolution2D::convolveFile(const string& inPath,
+                                          const string& outPath,
+                                          long rows, long cols)
+{
+    if (rows <= 0 || cols <= 0) {
+        throw runtime_error(string("Fatal error: empty image"));
+    }
+    long radius = mFilterSize/2;
+    long tile = tileSize();
+    long halo = tile + 2*radius;
+
+    // widest block for which three blocks fit the budget
+    long tilesAcross = (cols + tile - 1)/tile;
+    long blockCols = 0;
+    size_t blockBytes = 0;
+    for (long t = tilesAcross; t > 0 && blockCols == 0; --t) {
+        size_t bytes = sizeof(float)*(halo*(t*tile + 2*radius) + tile*t*tile);
+        if (3*bytes <= mMemoryBudget) {
+            blockCols = t*tile;
+            blockBytes = bytes;
+        }
+    }
+    if (blockCols == 0) {
+        throw runtime_error(
+                string("Fatal error: memory budget too small for a tile"));
+    }
+    long blocksDown = (rows + tile - 1)/tile;
+    long blocksAcross = (cols + blockCols - 1)/blockCols;
+    long total = blocksDown*blocksAcross;
+    long poolSize = min(long(mMemoryBudget/blockBytes), total);
+
+    int in = open(inPath.c_str(), O_RDONLY);
+    if (in < 0) {
+        throw runtime_error(string("Fatal error: cannot open ") + inPath);
+    }
+    struct stat st;
+    if (fstat(in, &st) != 0 ||
+        st.st_size < off_t(sizeof(float))*rows*cols) {
+        close(in);
+        throw runtime_error(string("Fatal error: short image file ") +
+                            inPath);
+    }
+    // no O_TRUNC before the output is known not to be the input, by
+    // the same path, a symlink or a hard link
+    int out = open(outPath.c_str(), O_RDWR | O_CREAT, 0644);
+    struct stat outSt;
+    if (out >= 0 && fstat(out, &outSt) == 0 &&
+        outSt.st_dev == st.st_dev && outSt.st_ino == st.st_ino) {
+        close(in);
+        close(out);
+        throw runtime_error(string("Fatal error: output is the input file ")
+                            + outPath);
+    }
+    if (out < 0 || ftruncate(out, 0) != 0 ||
+        ftruncate(out, off_t(sizeof(float))*rows*cols) != 0) {
+        close(in);
+        if (out >= 0)
+            close(out);
+        throw runtime_error(string("Fatal error: cannot create ") + outPath);
+    }
+
+    vector<Block> pool(poolSize);
+    BlockQueue freeBlocks, readBlocks, doneBlocks;
+    for (long i = 0; i < poolSize; ++i) {
+        pool[i].input.resize(halo*(blockCols + 2*radius));
+        pool[i].output.resize(tile*blockCols);
+        freeBlocks.push(i);
+    }
+    mutex errorLock;
+    string error;
+
+    // prefetch: block input plus halo, zero outside the image
+    thread reader([&] () {
+        long stride = blockCols + 2*radius;
+        for (long b = 0; b < total; ++b) {
+            Block& block = pool[freeBlocks.pop()];
+            block.row = (b/blocksAcross)*tile;
+            block.col = (b%blocksAcross)*blockCols;
+            block.rows = min(tile, rows - block.row);
+            block.cols = min(blockCols, cols - block.col);
+            fill(block.input.begin(), block.input.end(), 0.0f);
+            long c0 = max(block.col - radius, 0L);
+            long c1 = min(block.col + block.cols + radius, cols);
+            for (long r = block.row - radius;
+                 r < block.row + block.rows + radius; ++r) {
+                if (r < 0 || r >= rows)
+                    continue;
+                float* dst = &block.input[0] +
+                    (r - block.row + radius)*stride + c0 - block.col + radius;
+                if (!preadFully(in, dst, sizeof(float)*(c1 - c0),
+                                off_t(sizeof(float))*(r*cols + c0))) {
+                    lock_guard<mutex> guard(errorLock);
+                    error = "Fatal error: cannot read " + inPath;
+                }
+            }
+            readBlocks.push(&block - &pool[0]);
+        }
+        readBlocks.push(-1);
+    });
+
+    // compute: halo tiles through the in-memory engine
+    thread compute([&] () {
+        Convolution2D conv2d(halo, mFilterSize);
+        vector<float> tileIn(halo*halo), tileOut(halo*halo);
+        long stride = blockCols + 2*radius;
+        for (int id = readBlocks.pop(); id >= 0; id = readBlocks.pop()) {
+            Block& block = pool[id];
+            for (long tr = 0; tr < block.rows; tr += tile) {
+                for (long tc = 0; tc < block.cols; tc += tile) {
+                    for (long i = 0; i < halo; ++i)
+                        copy_n(block.input.begin() + (tr + i)*stride + tc,
+                               halo, tileIn.begin() + i*halo);
+                    conv2d.directConvolve(&tileIn[0], &mFilter[0],
+                                          &tileOut[0]);
+                    long nr = min(tile, block.rows - tr);
+                    long nc = min(tile, block.cols - tc);
+                    for (long i = 0; i < nr; ++i)
+                        copy_n(tileOut.begin() + (i + radius)*halo + radius,
+                               nc, block.output.begin() +
+                               (tr + i)*blockCols + tc);
+                }
+            }
+            doneBlocks.push(id);
+        }
+        doneBlocks.push(-1);
+    });
+
+    // write back and recycle the block
+    thread writer([&] () {
+        for (int id = doneBlocks.pop(); id >= 0; id = doneBlocks.pop()) {
+            Block& block = pool[id];
+            for (long i = 0; i < block.rows; ++i) {
+                if (!pwriteFully(out, &block.output[0] + i*blockCols,
+                                 sizeof(float)*block.cols,
+                                 off_t(sizeof(float))*
+                                 ((block.row + i)*cols + block.col))) {
+                    lock_guard<mutex> guard(errorLock);
+                    error = "Fatal error: cannot write " + outPath;
+                }
+            }
+            freeBlocks.push(id);
+        }
+    });
+
+    reader.join();
+    compute.join();
+    writer.join();
+    close(in);
+    if (close(out) != 0 && error.empty())
+        error = "Fatal error: cannot write " + outPath;
+    mLastBlocks = total;
+    if (!error.empty())
+        throw runtime_error(error);
+}
@@ -0,0 +1,229 @@
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * Implementation code for NUMA-aware parallel convolution.
+ */
+#include "ParallelConvolution2D.hpp"
+#include "Convolution2D.hpp"
+#include <cassert>
+#include <algorithm>
+#include <stdexcept>
+#include <pthread.h>
+#include <sched.h>
+
+/**
+ * Constructor
+ * Partitions the output rows over nodes and workers, starts the
+ * workers and waits until they have placed their buffers.
+ * @param imgSize size of image
+ * @param filterSize size of filter
+ * @param topology nodes and their CPUs
+ * @param policy thread count, pinning and filter replication
+ */
+ParallelConvolution2D::ParallelConvolution2D(int imgSize, int filterSize,
+                                             const NumaTopology& topology,
+                                             const NumaPolicy& policy):
+                             mImgSize(imgSize), mFilterSize(filterSize),
+                             mTopology(topology), mPolicy(policy),
+                             mGeneration(0), mRunning(0), mStarted(0),
+                             mStop(false), mImage(NULL), mResult(NULL)
+{
+    // same size checks as the single threaded engines
+    Convolution2D check(imgSize, filterSize);
+
+    vector<int> perNode;
+    int total = 0;
+    for (int node = 0; node < mTopology.nodes(); ++node) {
+        int count = mPolicy.threadsPerNode > 0 ? mPolicy.threadsPerNode :
+                    mTopology.cpus(node).size();
+        perNode.push_back(count);
+        total += count;
+    }
+
+    // node bands proportional to the workers of the node, then equal
+    // sub-bands; workers left without rows are not started
+    int assigned = 0;
+    int row = 0;
+    for (int node = 0; node < mTopology.nodes(); ++node) {
+        assigned += perNode[node];
+        int nodeEnd = (long(mImgSize)*assigned)/total;
+        int nodeRows = nodeEnd - row;
+        int nodeBegin = row;
+        for (int w = 0; w < perNode[node]; ++w) {
+            Worker worker;
+            worker.node = node;
+            worker.rowBegin = nodeBegin + (nodeRows*w)/perNode[node];
+            worker.rowEnd = nodeBegin + (nodeRows*(w+1))/perNode[node];
+            if (worker.rowEnd > worker.rowBegin)
+                mWorkers.push_back(worker);
+        }
+        row = nodeEnd;
+    }
+
+    // without replication a single copy lives on the calling node
+    mNodeFilter.resize(mTopology.nodes());
+    if (!mPolicy.replicateFilter)
+        mNodeFilter[0].assign(mFilterSize*mFilterSize, 0);
+    for (size_t i = 0; i < mWorkers.size(); ++i)
+        mThreads.push_back(thread(&ParallelConvolution2D::workerLoop,
+                                  this, int(i)));
+    unique_lock<mutex> lock(mMutex);
+    while (mStarted < int(mWorkers.size()))
+        mDoneCond.wait(lock);
+}
+
+/**
+ * Destructor
+ * Stops and joins the workers.
+ */
+ParallelConvolution2D::~ParallelConvolution2D()
+{
+    {
+        lock_guard<mutex> lock(mMutex);
+        mStop = true;
+    }
+    mStartCond.notify_all();
+    for (size_t i = 0; i < mThreads.size(); ++i)
+        mThreads[i].join();
+}
+
+/**
+ * Worker loop
+ * The buffers are allocated after pinning so that the pages are
+ * first touched on the node of the worker. The first worker of a node
+ * also allocates the node copy of the filter.
+ * @param index worker index
+ */
+void ParallelConvolution2D::workerLoop(int index)
+{
+    Worker& worker = mWorkers[index];
+    if (mPolicy.pinThreads) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        const vector<int>& cpus = mTopology.cpus(worker.node);
+        for (size_t i = 0; i < cpus.size(); ++i)
+            CPU_SET(cpus[i], &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+    int taps = mFilterSize*mFilterSize;
+    worker.im2col.assign(size_t(taps)*(worker.rowEnd - worker.rowBegin)*
+                         mImgSize, 0);
+    bool leader = index == 0 || mWorkers[index-1].node != worker.node;
+    if (leader && mPolicy.replicateFilter)
+        mNodeFilter[worker.node].assign(taps, 0);
+
+    unsigned long seen = 0;
+    unique_lock<mutex> lock(mMutex);
+    ++mStarted;
+    mDoneCond.notify_all();
+    while (true) {
+        while (!mStop && mGeneration == seen)
+            mStartCond.wait(lock);
+        if (mStop)
+            return;
+        seen = mGeneration;
+        lock.unlock();
+        convolveRows(worker);
+        lock.lock();
+        if (--mRunning == 0)
+            mDoneCond.notify_all();
+    }
+}
+
+/**
+ * Rows of one worker
+ * Same window bounds as fastConvolve(); the im2col block is stored
+ * tap-major so the filter product streams through it row by row.
+ * @param worker worker state
+ */
+void ParallelConvolution2D::convolveRows(Worker& worker)
+{
+    vector<vector<float>>& image = *mImage;
+    const vector<float>& filter =
+        mNodeFilter[mPolicy.replicateFilter ? worker.node : 0];
+    int taps = mFilterSize*mFilterSize;
+    int cols = (worker.rowEnd - worker.rowBegin)*mImgSize;
+    int hFltrSz = (mFilterSize+1)/2;
+
+    fill(worker.im2col.begin(), worker.im2col.end(), 0.0f);
+    for (int x = worker.rowBegin; x < worker.rowEnd; ++x) {
+        for (int y = 0; y < mImgSize; ++y) {
+            int col = (x - worker.rowBegin)*mImgSize + y;
+            int startx = max(hFltrSz-1-x, 0);
+            int starty = max(hFltrSz-1-y, 0);
+            int endx = mFilterSize + min(mImgSize - x - hFltrSz,0);
+            int endy = mFilterSize + min(mImgSize - y - hFltrSz,0);
+            for (int i = startx; i < endx; ++i) {
+                for (int j = starty; j < endy; ++j) {
+                    worker.im2col[size_t(i*mFilterSize + j)*cols + col] =
+                        image[x+i-hFltrSz+1][y+j-hFltrSz+1];
+                }
+            }
+        }
+    }
+
+    for (int x = worker.rowBegin; x < worker.rowEnd; ++x) {
+        vector<float> out(mImgSize, 0);
+        const float* col = &worker.im2col[0] +
+                           (x - worker.rowBegin)*mImgSize;
+        for (int t = 0; t < taps; ++t) {
+            float w = filter[t];
+            const float* in = col + size_t(t)*cols;
+            for (int y = 0; y < mImgSize; ++y)
+                out[y] += w*in[y];
+        }
+        (*mResult)[x].swap(out);
+    }
+}
+
+/**
+ * Parallel 2D convolution
+ * Assume 'same' mode, i.e., input and output images are of same size
+ * - the flattened filter is copied into every node copy, then all
+ *   workers run their sub-band
+ * @param image input matrix image
+ * @param filter input matrix filter
+ * @return returns convolve2D output matrix
+ */
+vector<vector<float>>
+ParallelConvolution2D::convolve(vector<vector<float>>& image,
+                                vector<vector<float>>& filter)
+{
+    assert(filter.size() == mFilterSize);
+    assert(filter[0].size() == mFilterSize);
+    assert(image.size() == mImgSize);
+    assert(image[0].size() == mImgSize);
+
+    lock_guard<mutex> call(mCallMutex);
+    for (size_t node = 0; node < mNodeFilter.size(); ++node) {
+        vector<float>& copy = mNodeFilter[node];
+        for (size_t i = 0; i < filter.size() && !copy.empty(); ++i)
+            copy_n(filter[i].begin(), mFilterSize,
+                   copy.begin() + i*mFilterSize);
+    }
+
+    // rows stay empty until the owning worker allocates them
+    vector<vector<float>> result(mImgSize);
+    {
+        lock_guard<mutex> lock(mMutex);
+        mImage = &image;
+        mResult = &result;
+        mRunning = mWorkers.size();
+        ++mGeneration;
+    }
+    mStartCond.notify_all();
+    unique_lock<mutex> lock(mMutex);
+    while (mRunning > 0)
+        mDoneCond.wait(lock);
+    return result;
+}
@@ -0,0 +1,50 @@
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * Futex helpers of the shared-memory ring.
+ */
+#include "SharedRing.hpp"
+#include <climits>
+#include <ctime>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/**
+ * Sleep on a shared word
+ * Shared (not FUTEX_PRIVATE) so that it works across processes; a
+ * spurious or early return only makes the caller look again.
+ * @param word futex word
+ * @param expected value seen before deciding to sleep
+ * @param timeoutMs longest sleep, negative for none
+ */
+void SharedRing::futexWait(atomic<uint32_t>* word, uint32_t expected,
+                           int timeoutMs)
+{
+    struct timespec timeout;
+    timeout.tv_sec = timeoutMs/1000;
+    timeout.tv_nsec = long(timeoutMs%1000)*1000000;
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT,
+            expected, timeoutMs < 0 ? NULL : &timeout, NULL, 0);
+}
+
+/**
+ * Wake sleepers of a shared word
+ * @param word futex word
+ * @param count sleepers to wake
+ */
+void SharedRing::futexWake(atomic<uint32_t>* word, int count)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE,
+            count, NULL, NULL, 0);
+}
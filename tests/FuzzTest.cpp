@@ -0,0 +1,430 @@
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * Methods for the differential fuzz test.
+ */
+#include "FuzzTest.hpp"
+#include "Convolution2D.hpp"
+#include "ParallelConvolution2D.hpp"
+#include "ConvolutionPlan.hpp"
+#include "JitConvolution2D.hpp"
+#include "Convolution3D.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <limits>
+#include <cmath>
+using namespace std;
+
+// serializes output of the worker threads
+static mutex gOutputMutex;
+
+// engine under test, called with a Convolution2D sized for the case
+typedef vector<vector<float>> (*EngineFn)(Convolution2D&,
+                                          vector<vector<float>>&,
+                                          vector<vector<float>>&);
+
+// engine name, error budget relative to the float summation bound,
+// and how to run it
+struct FuzzEngine {
+    const char* name;
+    double budget;
+    EngineFn run;
+};
+
+static vector<vector<float>>
+runNaive(Convolution2D& c, vector<vector<float>>& img,
+         vector<vector<float>>& f)
+{
+    return c.convolve(img, f);
+}
+
+static vector<vector<float>>
+runFast(Convolution2D& c, vector<vector<float>>& img,
+        vector<vector<float>>& f)
+{
+    return c.fastConvolve(img, f);
+}
+
+static vector<vector<float>>
+runBatch(Convolution2D& c, vector<vector<float>>& img,
+         vector<vector<float>>& f)
+{
+    vector<vector<vector<float>>> images(2, img);
+    return c.fastConvolveBatch(images, f)[1];
+}
+
+static vector<vector<float>>
+runDirect(Convolution2D& c, vector<vector<float>>& img,
+          vector<vector<float>>& f)
+{
+    size_t n = img.size();
+    size_t k = f.size();
+    vector<float> flatImg, flatFilter, flatOut(n*n);
+    for (size_t i = 0; i < n; ++i)
+        flatImg.insert(flatImg.end(), img[i].begin(), img[i].end());
+    for (size_t i = 0; i < k; ++i)
+        flatFilter.insert(flatFilter.end(), f[i].begin(), f[i].end());
+    c.directConvolve(&flatImg[0], &flatFilter[0], &flatOut[0]);
+    vector<vector<float>> out(n, vector<float>(n));
+    for (size_t i = 0; i < n; ++i)
+        copy_n(flatOut.begin() + i*n, n, out[i].begin());
+    return out;
+}
+
+static vector<vector<float>>
+runRegion(Convolution2D& c, vector<vector<float>>& img,
+          vector<vector<float>>& f)
+{
+    int n = img.size();
+    vector<vector<float>> out(n, vector<float>(n, 0));
+    // two halves so that region bounds are exercised
+    c.convolveRegion(img, f, out, 0, 0, n/2, n);
+    c.convolveRegion(img, f, out, n/2, 0, n, n);
+    return out;
+}
+
+static vector<vector<float>>
+runSparseFilter(Convolution2D& c, vector<vector<float>>& img,
+                vector<vector<float>>& f)
+{
+    return c.sparseFilterConvolve(img, f);
+}
+
+static vector<vector<float>>
+runSparseImage(Convolution2D& c, vector<vector<float>>& img,
+               vector<vector<float>>& f)
+{
+    return c.sparseImageConvolve(img, f);
+}
+
+static vector<vector<float>>
+runAuto(Convolution2D& c, vector<vector<float>>& img,
+        vector<vector<float>>& f)
+{
+    return c.autoConvolve(img, f);
+}
+
+static vector<vector<float>>
+runParallel(Convolution2D&, vector<vector<float>>& img,
+            vector<vector<float>>& f)
+{
+    // two nodes of two workers, all on the first CPU
+    NumaPolicy policy;
+    policy.threadsPerNode = 2;
+    ParallelConvolution2D parallel(img.size(), f.size(),
+                                   NumaTopology::fromString("0:0"), policy);
+    return parallel.convolve(img, f);
+}
+
+static vector<vector<float>>
+runPlanDirect(Convolution2D&, vector<vector<float>>& img,
+              vector<vector<float>>& f)
+{
+    PlanOptions options;
+    options.engine = PLAN_DIRECT;
+    return ConvolutionPlan(img.size(), f, options).execute(img);
+}
+
+static vector<vector<float>>
+runPlanGemm(Convolution2D&, vector<vector<float>>& img,
+            vector<vector<float>>& f)
+{
+    PlanOptions options;
+    options.engine = PLAN_GEMM;
+    return ConvolutionPlan(img.size(), f, options).execute(img);
+}
+
+static vector<vector<float>>
+runPlanAuto(Convolution2D&, vector<vector<float>>& img,
+            vector<vector<float>>& f)
+{
+    return ConvolutionPlan(img.size(), f).execute(img);
+}
+
+static vector<vector<float>>
+runJit(Convolution2D&, vector<vector<float>>& img,
+       vector<vector<float>>& f)
+{
+    return JitConvolution2D(img.size(), f.size()).convolve(img, f);
+}
+
+static vector<vector<float>>
+runJitSse(Convolution2D&, vector<vector<float>>& img,
+          vector<vector<float>>& f)
+{
+    return JitConvolution2D(img.size(), f.size(), 1, JIT_EPILOGUE_NONE,
+                            JIT_ISA_SSE).convolve(img, f);
+}
+
+static vector<vector<float>>
+runVolume(Convolution2D&, vector<vector<float>>& img,
+          vector<vector<float>>& f)
+{
+    // one slice: the outer filter slices only meet the zero padding
+    int k = f.size();
+    vector<vector<vector<float>>> volume(1, img);
+    vector<vector<vector<float>>> filter(k, vector<vector<float>>(k,
+                                         vector<float>(k, 1.0f)));
+    filter[k/2] = f;
+    vector<vector<vector<float>>> out =
+        Convolution3D(1, img.size(), k).convolve(volume, filter);
+    return out[0];
+}
+
+// Budgets follow the summation order of each engine. A single float
+// dot product rounds every term at most taps times (one product and
+// the additions after it, in any order, fused or not), so it is within
+// taps * eps/2 * sum|f*x|: half the bound. plan_auto also takes the
+// separable path for rank one filters, two passes of k terms over
+// factors within 4 eps of the filter: (k+4)/k^2 of the bound, 7/9 at
+// 3x3. It runs with the default tolerance of 0, so it never takes the
+// Gaussian IIR path, which is only accurate to the caller's tolerance,
+// and the box path sums in double.
+static const FuzzEngine ENGINES[] = {
+    { "naive",         0.5, runNaive },
+    { "fast",          0.5, runFast },
+    { "batch",         0.5, runBatch },
+    { "direct",        0.5, runDirect },
+    { "region",        0.5, runRegion },
+    { "sparse_filter", 0.5, runSparseFilter },
+    { "sparse_image",  0.5, runSparseImage },
+    { "auto",          0.5, runAuto },
+    { "parallel",      0.5, runParallel },
+    { "plan_direct",   0.5, runPlanDirect },
+    { "plan_gemm",     0.5, runPlanGemm },
+    { "plan_auto",     0.8, runPlanAuto },
+    { "jit",           0.5, runJit },
+    { "jit_sse",       0.5, runJitSse },
+    { "volume",        0.5, runVolume },
+};
+
+/** Name of a distribution
+ * @param Distribution dist distribution
+ * @return const char* printable name
+ */
+const char*
+FuzzTest::distName(Distribution dist)
+{
+    switch (dist) {
+    case UNIFORM:       return "uniform";
+    case SIGNED:        return "signed";
+    case DENORMAL:      return "denormal";
+    case DYNAMIC_RANGE: return "dynamic-range";
+    case ALL_ZERO:      return "all-zero";
+    case SPARSE:        return "sparse";
+    default:            return "?";
+    }
+}
+
+// utility function filling a matrix from one distribution
+static
+void fillMatrix(vector<vector<float>>& m, FuzzTest::Distribution dist,
+                mt19937_64& rng)
+{
+    uniform_real_distribution<double> unit(-1.0, 1.0);
+    uniform_real_distribution<double> decade(-15.0, 15.0);
+    for (size_t i = 0; i < m.size(); ++i) {
+        for (size_t j = 0; j < m[i].size(); ++j) {
+            double u = unit(rng);
+            switch (dist) {
+            case FuzzTest::UNIFORM:
+                m[i][j] = 5*(u + 1);
+                break;
+            case FuzzTest::SIGNED:
+                m[i][j] = u;
+                break;
+            case FuzzTest::DENORMAL:
+                m[i][j] = u*numeric_limits<float>::min();
+                break;
+            case FuzzTest::DYNAMIC_RANGE:
+                m[i][j] = (u < 0 ? -1 : 1)*pow(10.0, decade(rng));
+                break;
+            case FuzzTest::SPARSE:
+                m[i][j] = (rng() % 10 == 0) ? 10*u : 0;
+                break;
+            default:
+                m[i][j] = 0;
+                break;
+            }
+        }
+    }
+}
+
+/** Generate the case of a seed
+ * @param unsigned long long seed case seed
+ * @return FuzzCase shapes, distributions and data
+ */
+FuzzTest::FuzzCase
+FuzzTest::makeCase(unsigned long long seed)
+{
+    mt19937_64 rng(seed);
+    FuzzCase fc;
+    fc.seed = seed;
+    fc.imgSize = 5 + rng() % (Convolution2D::MAX_IMAGE_SIZE - 4);
+    fc.filterSize = 1 + 2*(rng() % ((Convolution2D::MAX_FILTER_SIZE+1)/2));
+    fc.imgDist = Distribution(rng() % NUM_DISTRIBUTIONS);
+    fc.filterDist = Distribution(rng() % NUM_DISTRIBUTIONS);
+    fc.image.assign(fc.imgSize, vector<float>(fc.imgSize, 0));
+    fc.filter.assign(fc.filterSize, vector<float>(fc.filterSize, 0));
+    fillMatrix(fc.image, fc.imgDist, rng);
+    fillMatrix(fc.filter, fc.filterDist, rng);
+    return fc;
+}
+
+/** Double precision 'same' convolution and its error scale
+ * @param FuzzCase& fc test case
+ * @param vector<vector<double>>& magnitude sum of |filter*image|
+ * @return vector<vector<double>> reference output
+ */
+vector<vector<double>>
+FuzzTest::reference(FuzzCase& fc, vector<vector<double>>& magnitude)
+{
+    int n = fc.imgSize;
+    int k = fc.filterSize;
+    int r = k/2;
+    vector<vector<double>> out(n, vector<double>(n, 0));
+    magnitude.assign(n, vector<double>(n, 0));
+    for (int x = 0; x < n; ++x) {
+        for (int y = 0; y < n; ++y) {
+            double sum = 0;
+            double mag = 0;
+            for (int i = 0; i < k; ++i) {
+                for (int j = 0; j < k; ++j) {
+                    int p = x + i - r;
+                    int q = y + j - r;
+                    if (p < 0 || q < 0 || p >= n || q >= n)
+                        continue;
+                    double t = double(fc.filter[i][j])*fc.image[p][q];
+                    sum += t;
+                    mag += fabs(t);
+                }
+            }
+            out[x][y] = sum;
+            magnitude[x][y] = mag;
+        }
+    }
+    return out;
+}
+
+/** Run every engine on one case
+ * The error of an output pixel is measured in units of the float
+ * summation bound taps * (eps * sum|f*x| + denorm_min), twice the
+ * worst case of a plain float dot product.
+ * @param unsigned long long seed case seed
+ * @param bool verbose print the case and the error of every engine
+ * @return int status is 0 if every engine is within budget
+ */
+int
+FuzzTest::runCase(unsigned long long seed, bool verbose)
+{
+    FuzzCase fc = makeCase(seed);
+    vector<vector<double>> magnitude;
+    vector<vector<double>> ref = reference(fc, magnitude);
+    double taps = double(fc.filterSize)*fc.filterSize;
+    double eps = numeric_limits<float>::epsilon();
+    double tiny = numeric_limits<float>::denorm_min();
+
+    if (verbose) {
+        cout << "seed " << seed << ": (" << fc.imgSize << ","
+             << fc.filterSize << ") image " << distName(fc.imgDist)
+             << ", filter " << distName(fc.filterDist) << endl;
+    }
+    Convolution2D conv2d(fc.imgSize, fc.filterSize);
+    int status = 0;
+    for (size_t e = 0; e < sizeof(ENGINES)/sizeof(ENGINES[0]); ++e) {
+        vector<vector<float>> out = ENGINES[e].run(conv2d, fc.image,
+                                                   fc.filter);
+        double worst = 0;
+        for (int x = 0; x < fc.imgSize; ++x) {
+            for (int y = 0; y < fc.imgSize; ++y) {
+                double bound = taps*(eps*magnitude[x][y] + tiny);
+                double err = fabs(double(out[x][y]) - ref[x][y]);
+                double ratio = std::isfinite(out[x][y]) ? err/bound :
+                               numeric_limits<double>::infinity();
+                worst = max(worst, ratio);
+            }
+        }
+        bool pass = worst <= ENGINES[e].budget;
+        if (verbose) {
+            cout << "  " << ENGINES[e].name << ": " << worst
+                 << " of budget " << ENGINES[e].budget
+                 << (pass ? " PASS" : " FAIL") << endl;
+        } else if (!pass) {
+            lock_guard<mutex> lock(gOutputMutex);
+            cout << "FUZZ FAIL: seed " << seed << " engine "
+                 << ENGINES[e].name << " (" << fc.imgSize << ","
+                 << fc.filterSize << ") error " << worst
+                 << " of budget " << ENGINES[e].budget << endl;
+        }
+        if (!pass)
+            status = -1;
+    }
+    return status;
+}
+
+/** Run and describe a single seed
+ * @param unsigned long long seed case seed
+ * @return int status is 0 if every engine is within budget
+ */
+int
+FuzzTest::runSeed(unsigned long long seed)
+{
+    return runCase(seed, true);
+}
+
+/** Run consecutive seeds on several threads
+ * @param unsigned long long start first seed
+ * @param unsigned long long count number of seeds
+ * @param int threads worker threads, 0 for hardware concurrency
+ * @return int status is 0 if every case passed
+ */
+int
+FuzzTest::runRange(unsigned long long start, unsigned long long count,
+                   int threads)
+{
+    if (threads <= 0)
+        threads = max(int(thread::hardware_concurrency()), 1);
+    atomic<unsigned long long> next(start);
+    unsigned long long end = start + count;
+    mutex failMutex;
+    vector<unsigned long long> failures;
+
+    vector<thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.push_back(thread([&] () {
+            for (unsigned long long s = next++; s < end; s = next++) {
+                if (runCase(s, false) != 0) {
+                    lock_guard<mutex> lock(failMutex);
+                    failures.push_back(s);
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); ++t)
+        workers[t].join();
+
+    if (failures.empty()) {
+        cout << "FUZZ PASS: " << count << " cases from seed " << start
+             << endl;
+        return 0;
+    }
+    sort(failures.begin(), failures.end());
+    cout << "FUZZ FAIL: " << failures.size() << " of " << count
+         << " cases, reproduce with: fuzz -seed " << failures[0] << endl;
+    return -1;
+}
@@ -15,6 +15,19 @@
  */
 #include "UnitTest.hpp"
 #include "Convolution2D.hpp"
+#include "IncrementalConvolution2D.hpp"
+#include "ConvExpression.hpp"
+#include "ConvolutionScheduler.hpp"
+#include "ParallelConvolution2D.hpp"
+#include "OutOfCoreConvolution2D.hpp"
+#include "GroupedConvolution2D.hpp"
+#include "ConvolutionPlan.hpp"
+#include "FilterCache.hpp"
+#include "ConvolutionDaemon.hpp"
+#include "ConvolutionClient.hpp"
+#include "JitConvolution2D.hpp"
+#include "MorphologyFilter2D.hpp"
+#include "Convolution3D.hpp"
 
 #include <iostream>
 #include <fstream>
@@ -22,6 +35,14 @@
 #include <cstring>
 #include <cmath>
 #include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 using namespace std;
 
 /**
@@ -120,6 +141,1192 @@ bool parseMatrixValues(vector<vector<float>>& vv, ifstream& my_file) {
     return true;
 }
 
+/** Check incremental convolution against full recomputation
+ * @param vector<vector<float>>& img input matrix image
+ * @param vector<vector<float>>& filter input matrix filter
+ * @param vector<vector<float>>& expected output of the first frame
+ * @return int status is 0 if all frames match
+ */
+int
+UnitTest::testIncrementalConv2D(vector<vector<float>>& img,
+                                vector<vector<float>>& filter,
+                                vector<vector<float>>& expected)
+{
+    int imgSize = img.size();
+    Convolution2D conv2d(imgSize, filter.size());
+    IncrementalConvolution2D incr(imgSize, filter);
+    vector<vector<float>> first = incr.update(img);
+    if (compareOutImages(expected, first) != 0)
+        return -1;
+
+    // change a 2x2 block in the middle, found by diffing
+    vector<vector<float>> frame = img;
+    int mid = imgSize/2;
+    frame[mid][mid] += 1.5;
+    frame[mid+1][mid] -= 2.25;
+    frame[mid][mid+1] *= 0.5;
+    vector<vector<float>> diffed = incr.update(frame);
+    vector<vector<float>> full = conv2d.fastConvolve(frame, filter);
+    if (compareOutImages(full, diffed) != 0)
+        return -1;
+
+    // only the changed tiles, dilated by the filter radius, are redone
+    int r = filter.size()/2;
+    int tile = IncrementalConvolution2D::DIFF_TILE;
+    int lo = max(mid/tile*tile - r, 0);
+    int hi = min(((mid+1)/tile + 1)*tile + r, imgSize);
+    if (incr.lastRecomputed() > (hi - lo)*(hi - lo))
+        return -1;
+
+    // change the corner and pass the dirty rectangle explicitly
+    frame[0][0] += 3.0;
+    frame[imgSize-1][imgSize-1] += 1.0;
+    vector<DirtyRect> dirty;
+    DirtyRect corner = { 0, 0, 1, 1 };
+    DirtyRect last = { imgSize-1, imgSize-1, imgSize, imgSize };
+    dirty.push_back(corner);
+    dirty.push_back(last);
+    vector<vector<float>> rects = incr.update(frame, dirty);
+    full = conv2d.fastConvolve(frame, filter);
+    if (compareOutImages(full, rects) != 0)
+        return -1;
+    // two corner pixels, each dilated by the radius and clipped
+    if (incr.lastRecomputed() > 2*(r+1)*(r+1))
+        return -1;
+    return 0;
+}
+
+/** Check the sparse engines against the naive convolution
+ * @param vector<vector<float>>& img input matrix image
+ * @param vector<vector<float>>& filter input matrix filter
+ * @param vector<vector<float>>& expected output for img and filter
+ * @return int status is 0 if all engines match
+ */
+int
+UnitTest::testSparseConv2D(vector<vector<float>>& img,
+                           vector<vector<float>>& filter,
+                           vector<vector<float>>& expected)
+{
+    Convolution2D conv2d(img.size(), filter.size());
+    vector<vector<float>> out = conv2d.sparseFilterConvolve(img, filter);
+    if (compareOutImages(expected, out) != 0)
+        return -1;
+    out = conv2d.sparseImageConvolve(img, filter);
+    if (compareOutImages(expected, out) != 0)
+        return -1;
+    out = conv2d.autoConvolve(img, filter);
+    if (compareOutImages(expected, out) != 0)
+        return -1;
+
+    // keep every third filter tap and every seventh pixel so that
+    // autoConvolve takes a sparse path
+    vector<vector<float>> sparseFilter = filter;
+    vector<vector<float>> sparseImg = img;
+    for (size_t i = 0; i < filter.size(); ++i)
+        for (size_t j = 0; j < filter.size(); ++j)
+            if ((i*filter.size() + j) % 3 != 0)
+                sparseFilter[i][j] = 0;
+    for (size_t i = 0; i < img.size(); ++i)
+        for (size_t j = 0; j < img.size(); ++j)
+            if ((i*img.size() + j) % 7 != 0)
+                sparseImg[i][j] = 0;
+    vector<vector<float>> ref = conv2d.convolve(sparseImg, sparseFilter);
+    out = conv2d.sparseFilterConvolve(sparseImg, sparseFilter);
+    if (compareOutImages(ref, out) != 0)
+        return -1;
+    out = conv2d.sparseImageConvolve(sparseImg, sparseFilter);
+    if (compareOutImages(ref, out) != 0)
+        return -1;
+    out = conv2d.autoConvolve(sparseImg, sparseFilter);
+    if (compareOutImages(ref, out) != 0)
+        return -1;
+    return 0;
+}
+
+/** Check lazy expressions against separate convolution passes
+ * @param vector<vector<float>>& img input matrix image
+ * @param vector<vector<float>>& filter input matrix filter
+ * @param vector<vector<float>>& expected output for img and filter
+ * @return int status is 0 if all expressions match
+ */
+int
+UnitTest::testExpressionConv2D(vector<vector<float>>& img,
+                               vector<vector<float>>& filter,
+                               vector<vector<float>>& expected)
+{
+    ConvExpr leaf = ConvExpr::image(img);
+    ConvExpr sum = 0.25f*leaf.conv(filter) + leaf.conv(filter)*0.75f;
+    int passes = 0;
+    vector<vector<float>> out = sum.evaluate(passes);
+    if (compareOutImages(expected, out) != 0 || passes != 1)
+        return -1;
+
+    // asymmetric so that a flipped combination would be caught
+    vector<vector<float>> edge(3, vector<float>(3, 0));
+    edge[0][0] = 0.5;  edge[0][1] = -1;  edge[0][2] = 0.25;
+    edge[1][0] = 0;    edge[1][1] = 2;   edge[1][2] = 0.75;
+    edge[2][0] = -0.5; edge[2][1] = 0.1; edge[2][2] = 1;
+    ConvExpr cascade = leaf.conv(filter) + 2.0f*leaf.conv(filter).conv(edge);
+    out = cascade.evaluate(passes);
+
+    Convolution2D conv2d(img.size(), 3);
+    vector<vector<float>> first = expected;
+    vector<vector<float>> ref = conv2d.fastConvolve(first, edge);
+    for (size_t i = 0; i < ref.size(); ++i)
+        for (size_t j = 0; j < ref.size(); ++j)
+            ref[i][j] = expected[i][j] + 2*ref[i][j];
+    if (compareOutImages(ref, out) != 0 || passes > 3)
+        return -1;
+
+    // one expression evaluated by two threads at once
+    vector<vector<vector<float>>> outs(2);
+    vector<int> counts(2, 0);
+    vector<thread> threads;
+    for (int t = 0; t < 2; ++t)
+        threads.push_back(thread([&, t] () {
+            outs[t] = cascade.evaluate(counts[t]);
+        }));
+    for (int t = 0; t < 2; ++t)
+        threads[t].join();
+    for (int t = 0; t < 2; ++t)
+        if (compareOutImages(ref, outs[t]) != 0 || counts[t] != passes)
+            return -1;
+    return 0;
+}
+
+/** Check the asynchronous scheduler against the expected output
+ * @param vector<vector<float>>& img input matrix image
+ * @param vector<vector<float>>& filter input matrix filter
+ * @param vector<vector<float>>& expected output for img and filter
+ * @return int status is 0 if every future holds the expected output
+ */
+int
+UnitTest::testSchedulerConv2D(vector<vector<float>>& img,
+                              vector<vector<float>>& filter,
+                              vector<vector<float>>& expected)
+{
+    // long deadline so that the six requests form a full batch of
+    // four and a batch of two closed by the deadline
+    ConvolutionScheduler scheduler(2, 4, chrono::milliseconds(20));
+    vector<future<vector<vector<float>>>> futures(6);
+    vector<thread> clients;
+    for (int c = 0; c < 2; ++c) {
+        clients.push_back(thread([&, c] () {
+            for (int i = 0; i < 3; ++i)
+                futures[c*3 + i] = scheduler.submit(img, filter);
+        }));
+    }
+    for (size_t c = 0; c < clients.size(); ++c)
+        clients[c].join();
+
+    for (size_t i = 0; i < futures.size(); ++i) {
+        vector<vector<float>> out = futures[i].get();
+        if (compareOutImages(expected, out) != 0)
+            return -1;
+    }
+    SchedulerStats stats = scheduler.stats();
+    if (stats.completed != 6 || stats.batches != 2 ||
+        stats.largestBatch != 4 || stats.queueDepth != 0)
+        return -1;
+
+    // ragged rows fail their own future and never reach a worker
+    vector<vector<float>> ragged = filter;
+    ragged.back().pop_back();
+    vector<vector<float>> raggedImg = img;
+    raggedImg[img.size()/2].push_back(0);
+    vector<future<vector<vector<float>>>> failed;
+    failed.push_back(scheduler.submit(img, ragged));
+    failed.push_back(scheduler.submit(raggedImg, filter));
+    for (size_t i = 0; i < failed.size(); ++i) {
+        try {
+            failed[i].get();
+            return -1;
+        } catch (runtime_error&) {
+        }
+    }
+    stats = scheduler.stats();
+    if (stats.completed != 8 || stats.batches != 2)
+        return -1;
+    return 0;
+}
+
+/** Check the NUMA-aware parallel engine on a two node topology
+ * @param vector<vector<float>>& img input matrix image
+ * @param vector<vector<float>>& filter input matrix filter
+ * @param vector<vector<float>>& expected output for img and filter
+ * @return int status is 0 if both policies match
+ */
+int
+UnitTest::testParallelConv2D(vector<vector<float>>& img,
+                             vector<vector<float>>& filter,
+                             vector<vector<float>>& expected)
+{
+    // two nodes on the first CPU so the test runs on any machine
+    NumaTopology topology = NumaTopology::fromString("0:0");
+    NumaPolicy policy;
+    policy.threadsPerNode = 2;
+    for (int replicate = 0; replicate < 2; ++replicate) {
+        policy.replicateFilter = replicate;
+        ParallelConvolution2D parallel(img.size(), filter.size(),
+                                       topology, policy);
+        vector<vector<float>> out = parallel.convolve(img, filter);
+        if (compareOutImages(expected, out) != 0)
+            return -1;
+        out = parallel.convolve(img, filter);
+        if (compareOutImages(expected, out) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+// utility function giving the microseconds per call of an engine
+template <typename Engine>
+static
+double timeEngine(Engine engine, int iterations) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        engine();
+    chrono::duration<double, micro> elapsed =
+        chrono::steady_clock::now() - start;
+    return elapsed.count()/iterations;
+}
+
+/** Time the engines on a random image and filter
+ * @param int imgSz input image size
+ * @param int filterSz input filter size
+ * @param int iterations calls per engine
+ * @return int status is 0 on success
+ */
+int
+UnitTest::benchConv2D(int imgSize, int filterSize, int iterations) {
+    Convolution2D conv2d(imgSize,filterSize);
+    vector<vector<float>> inImg = conv2d.createRandImage();
+    vector<vector<float>> filter = conv2d.createRandFilter();
+    NumaTopology topology = NumaTopology::detect();
+    NumaPolicy replicated;
+    NumaPolicy shared;
+    shared.replicateFilter = false;
+    NumaPolicy unpinned;
+    unpinned.pinThreads = false;
+    unpinned.replicateFilter = false;
+    ParallelConvolution2D numa(imgSize, filterSize, topology, replicated);
+    ParallelConvolution2D numaShared(imgSize, filterSize, topology, shared);
+    ParallelConvolution2D flat(imgSize, filterSize,
+                               NumaTopology(), unpinned);
+    JitConvolution2D jitSse(imgSize, filterSize, 1, JIT_EPILOGUE_NONE,
+                            JIT_ISA_SSE);
+    JitConvolution2D jit(imgSize, filterSize);
+
+    cout << "(" << imgSize << "," << filterSize << ") "
+         << topology.nodes() << " node(s), " << topology.totalCpus()
+         << " cpu(s), " << iterations << " iterations" << endl;
+    cout << "  naive              " << timeEngine([&] () {
+                conv2d.convolve(inImg, filter); }, iterations)
+         << " us" << endl;
+    cout << "  fast               " << timeEngine([&] () {
+                conv2d.fastConvolve(inImg, filter); }, iterations)
+         << " us" << endl;
+    cout << "  jit sse            " << timeEngine([&] () {
+                jitSse.convolve(inImg, filter); }, iterations)
+         << " us" << endl;
+    cout << "  jit best isa       " << timeEngine([&] () {
+                jit.convolve(inImg, filter); }, iterations)
+         << " us" << endl;
+    cout << "  parallel unpinned  " << timeEngine([&] () {
+                flat.convolve(inImg, filter); }, iterations)
+         << " us" << endl;
+    cout << "  parallel numa      " << timeEngine([&] () {
+                numaShared.convolve(inImg, filter); }, iterations)
+         << " us" << endl;
+    cout << "  parallel numa+repl " << timeEngine([&] () {
+                numa.convolve(inImg, filter); }, iterations)
+         << " us" << endl;
+    return 0;
+}
+
+// utility function running the out-of-core engine on a rows x cols
+// image held in memory, through temporary files
+static
+vector<float> convolveThroughFiles(vector<float>& image, long rows, long cols,
+                                   vector<vector<float>>& filter,
+                                   size_t budget, long& blocks)
+{
+    char inPath[] = "/tmp/conv2dInXXXXXX";
+    char outPath[] = "/tmp/conv2dOutXXXXXX";
+    int in = mkstemp(inPath);
+    int out = mkstemp(outPath);
+    vector<float> result(rows*cols, 0);
+    if (in < 0 || out < 0)
+        return vector<float>();
+    bool ok = write(in, &image[0], image.size()*sizeof(float)) ==
+              ssize_t(image.size()*sizeof(float));
+    close(in);
+    close(out);
+    if (ok) {
+        OutOfCoreConvolution2D engine(filter, budget);
+        engine.convolveFile(inPath, outPath, rows, cols);
+        blocks = engine.lastBlocks();
+        ifstream outFile(outPath, ios::binary);
+        outFile.read(reinterpret_cast<char*>(&result[0]),
+                     result.size()*sizeof(float));
+        ok = bool(outFile);
+    }
+    unlink(inPath);
+    unlink(outPath);
+    return ok ? result : vector<float>();
+}
+
+/** Check the out-of-core engine through temporary files
+ * @param vector<vector<float>>& img input matrix image
+ * @param vector<vector<float>>& filter input matrix filter
+ * @param vector<vector<float>>& expected output for img and filter
+ * @return int status is 0 if both files match
+ */
+int
+UnitTest::testOutOfCoreConv2D(vector<vector<float>>& img,
+                              vector<vector<float>>& filter,
+                              vector<vector<float>>& expected)
+{
+    long n = img.size();
+    vector<float> flat;
+    for (long i = 0; i < n; ++i)
+        flat.insert(flat.end(), img[i].begin(), img[i].end());
+    long blocks = 0;
+    vector<float> result = convolveThroughFiles(flat, n, n, filter,
+                                                size_t(16) << 20, blocks);
+    if (result.empty())
+        return -1;
+    vector<vector<float>> out(n, vector<float>(n));
+    for (long i = 0; i < n; ++i)
+        copy_n(result.begin() + i*n, n, out[i].begin());
+    if (compareOutImages(expected, out) != 0)
+        return -1;
+
+    // 150 x 97 image, budget of four single-tile blocks
+    long rows = 150;
+    long cols = 97;
+    long k = filter.size();
+    long r = k/2;
+    long tile = Convolution2D::MAX_IMAGE_SIZE - 2*r;
+    size_t budget = 4*sizeof(float)*(Convolution2D::MAX_IMAGE_SIZE*
+                                     Convolution2D::MAX_IMAGE_SIZE +
+                                     tile*tile);
+    vector<float> big(rows*cols);
+    for (size_t i = 0; i < big.size(); ++i)
+        big[i] = rand()%10 + ((float)(rand()%10000))/10000;
+    result = convolveThroughFiles(big, rows, cols, filter, budget, blocks);
+    if (result.empty() ||
+        blocks != ((rows + tile - 1)/tile)*((cols + tile - 1)/tile))
+        return -1;
+    for (long x = 0; x < rows; ++x) {
+        for (long y = 0; y < cols; ++y) {
+            float sum = 0;
+            for (long i = 0; i < k; ++i) {
+                for (long j = 0; j < k; ++j) {
+                    long p = x + i - r;
+                    long q = y + j - r;
+                    if (p >= 0 && q >= 0 && p < rows && q < cols)
+                        sum += filter[i][j]*big[p*cols + q];
+                }
+            }
+            if (!floatCompare(sum, result[x*cols + y])) {
+                cout << "Out-of-core mismatch at (" << x << "," << y
+                     << "): " << sum << " != " << result[x*cols + y] << endl;
+                return -1;
+            }
+        }
+    }
+
+    // the input as output, by its path and through a hard link, is
+    // refused and left intact
+    char inPath[] = "/tmp/conv2dSameXXXXXX";
+    int in = mkstemp(inPath);
+    if (in < 0)
+        return -1;
+    bool written = write(in, &flat[0], flat.size()*sizeof(float)) ==
+                   ssize_t(flat.size()*sizeof(float));
+    close(in);
+    string linkPath = string(inPath) + ".link";
+    int refused = 0;
+    if (written && link(inPath, linkPath.c_str()) == 0) {
+        OutOfCoreConvolution2D engine(filter);
+        const string outPaths[] = { inPath, linkPath };
+        for (int i = 0; i < 2; ++i) {
+            try {
+                engine.convolveFile(inPath, outPaths[i], n, n);
+            } catch (runtime_error&) {
+                ++refused;
+            }
+        }
+    }
+    struct stat st;
+    bool intact = stat(inPath, &st) == 0 &&
+                  st.st_size == off_t(flat.size()*sizeof(float));
+    unlink(linkPath.c_str());
+    unlink(inPath);
+    return refused == 2 && intact ? 0 : -1;
+}
+
+/** Check the backward pass against the definitions
+ * @param vector<vector<float>>& img input matrix image
+ * @param vector<vector<float>>& filter input matrix filter
+ * @param vector<vector<float>>& expected output for img and filter
+ * @return int status is 0 if both gradients match
+ */
+int
+UnitTest::testBackwardConv2D(vector<vector<float>>& img,
+                             vector<vector<float>>& filter,
+                             vector<vector<float>>& expected)
+{
+    int n = img.size();
+    int k = filter.size();
+    int r = k/2;
+    Convolution2D conv2d(n, k);
+    vector<vector<float>> outGrad = conv2d.createRandImage();
+
+    // dW[i][j] = sum over x,y of g[x][y]*img[x+i-r][y+j-r]
+    vector<vector<float>> dW = conv2d.weightGradient(img, outGrad);
+    conv2d.retainIm2col(true);
+    vector<vector<float>> out = conv2d.fastConvolve(img, filter);
+    if (compareOutImages(expected, out) != 0)
+        return -1;
+    vector<vector<float>> dWRetained = conv2d.weightGradient(outGrad);
+    conv2d.retainIm2col(false);
+    if (compareOutImages(dW, dWRetained) != 0)
+        return -1;
+    for (int i = 0; i < k; ++i) {
+        for (int j = 0; j < k; ++j) {
+            double sum = 0;
+            for (int x = 0; x < n; ++x) {
+                for (int y = 0; y < n; ++y) {
+                    int p = x + i - r;
+                    int q = y + j - r;
+                    if (p >= 0 && q >= 0 && p < n && q < n)
+                        sum += double(outGrad[x][y])*img[p][q];
+                }
+            }
+            if (!floatCompare(sum, dW[i][j]))
+                return -1;
+        }
+    }
+
+    // adjoint of the forward pass: <conv(img,f), g> == <img, dX>
+    vector<vector<float>> dX = conv2d.inputGradient(outGrad, filter);
+    double forward = 0;
+    double backward = 0;
+    for (int x = 0; x < n; ++x) {
+        for (int y = 0; y < n; ++y) {
+            forward += double(expected[x][y])*outGrad[x][y];
+            backward += double(img[x][y])*dX[x][y];
+        }
+    }
+    if (!floatCompare(forward, backward, 0.001))
+        return -1;
+    return 0;
+}
+
+/** Check the grouped engine against per-channel convolve()
+ * @param vector<vector<float>>& img input matrix image
+ * @param vector<vector<float>>& filter input matrix filter
+ * @param vector<vector<float>>& expected output for img and filter
+ * @return int status is 0 if every output channel matches
+ */
+int
+UnitTest::testGroupedConv2D(vector<vector<float>>& img,
+                            vector<vector<float>>& filter,
+                            vector<vector<float>>& expected)
+{
+    int n = img.size();
+    int k = filter.size();
+    Convolution2D conv2d(n, k);
+
+    // depthwise: channel 0 is the file case, the others random
+    int c = 3;
+    vector<vector<vector<float>>> imgs(1, img), filters(1, filter);
+    for (int ch = 1; ch < c; ++ch) {
+        imgs.push_back(conv2d.createRandImage());
+        filters.push_back(conv2d.createRandFilter());
+    }
+    vector<float> hwc(n*n*c), taps(k*k*c);
+    for (int ch = 0; ch < c; ++ch) {
+        for (int i = 0; i < n*n; ++i)
+            hwc[i*c + ch] = imgs[ch][i/n][i%n];
+        for (int t = 0; t < k*k; ++t)
+            taps[t*c + ch] = filters[ch][t/k][t%k];
+    }
+    GroupedConvolution2D depthwise(n, k, c, c);
+    if (!depthwise.isDepthwise())
+        return -1;
+    vector<float> out = depthwise.convolve(hwc, taps);
+    for (int ch = 0; ch < c; ++ch) {
+        vector<vector<float>> ref = ch == 0 ? expected :
+                                    conv2d.convolve(imgs[ch], filters[ch]);
+        for (int i = 0; i < n*n; ++i) {
+            if (!floatCompare(ref[i/n][i%n], out[i*c + ch]))
+                return -1;
+        }
+    }
+
+    // 4 inputs, 2 groups, 6 outputs: out o sums convolve() over the
+    // 2 inputs of its group
+    int inC = 4, groups = 2, outC = 6;
+    int inPerGroup = inC/groups, outPerGroup = outC/groups;
+    for (int ch = c; ch < inC; ++ch)
+        imgs.push_back(conv2d.createRandImage());
+    hwc.assign(n*n*inC, 0);
+    for (int ch = 0; ch < inC; ++ch)
+        for (int i = 0; i < n*n; ++i)
+            hwc[i*inC + ch] = imgs[ch][i/n][i%n];
+    vector<vector<vector<float>>> weights;
+    taps.assign(k*k*inPerGroup*outC, 0);
+    for (int ci = 0; ci < inPerGroup; ++ci) {
+        for (int co = 0; co < outC; ++co) {
+            vector<vector<float>> w = conv2d.createRandFilter();
+            for (int t = 0; t < k*k; ++t)
+                taps[(t*inPerGroup + ci)*outC + co] = w[t/k][t%k];
+            weights.push_back(w);
+        }
+    }
+    GroupedConvolution2D grouped(n, k, inC, groups, outC);
+    out = grouped.convolve(hwc, taps);
+    for (int co = 0; co < outC; ++co) {
+        vector<vector<float>> ref(n, vector<float>(n, 0));
+        int g = co/outPerGroup;
+        for (int ci = 0; ci < inPerGroup; ++ci) {
+            vector<vector<float>> part =
+                conv2d.convolve(imgs[g*inPerGroup + ci],
+                                weights[ci*outC + co]);
+            for (int i = 0; i < n*n; ++i)
+                ref[i/n][i%n] += part[i/n][i%n];
+        }
+        for (int i = 0; i < n*n; ++i) {
+            if (!floatCompare(ref[i/n][i%n], out[i*outC + co]))
+                return -1;
+        }
+    }
+    return 0;
+}
+
+/** Check layout conversions and layout-aware engines
+ * @param vector<vector<float>>& img input matrix image
+ * @param vector<vector<float>>& filter input matrix filter
+ * @param vector<vector<float>>& expected output for img and filter
+ * @return int status is 0 if all layouts agree
+ */
+int
+UnitTest::testLayoutConv2D(vector<vector<float>>& img,
+                           vector<vector<float>>& filter,
+                           vector<vector<float>>& expected)
+{
+    int n = img.size();
+    int k = filter.size();
+    int c = 5;
+    Convolution2D conv2d(n, k);
+
+    // channel 0 of image 0 is the file case
+    ImageTensor planar(2, c, n, n, NCHW);
+    for (int b = 0; b < 2; ++b) {
+        for (int ch = 0; ch < c; ++ch) {
+            vector<vector<float>> plane = (b == 0 && ch == 0) ? img :
+                                          conv2d.createRandImage();
+            for (int x = 0; x < n; ++x)
+                for (int y = 0; y < n; ++y)
+                    planar.at(b, ch, x, y) = plane[x][y];
+        }
+    }
+    ImageTensor round = planar.to(NHWC).to(NCHWc, 4).to(NCHW)
+                              .to(NCHWc).to(NHWC).to(NCHWc, 2)
+                              .to(NCHWc, 3).to(NCHW);
+    if (round.layout() != NCHW ||
+        !equal(planar.data(), planar.data() + planar.size(), round.data()))
+        return -1;
+
+    // the same planar result whatever the input layout
+    TensorLayout layouts[] = { NCHW, NHWC, NCHWc };
+    ImageTensor ref = conv2d.convolvePlanes(planar, filter);
+    for (int l = 0; l < 3; ++l) {
+        ImageTensor out = conv2d.convolvePlanes(planar.to(layouts[l], 4),
+                                                filter);
+        if (!equal(ref.data(), ref.data() + ref.size(), out.data()))
+            return -1;
+    }
+    for (int x = 0; x < n; ++x)
+        for (int y = 0; y < n; ++y)
+            if (!floatCompare(expected[x][y], ref.at(0, 0, x, y)))
+                return -1;
+
+    // depthwise with the file filter on every channel keeps NHWC and
+    // NCHWc, converts NCHW
+    GroupedConvolution2D depthwise(n, k, c, c);
+    vector<float> taps(k*k*c);
+    for (int t = 0; t < k*k; ++t)
+        for (int ch = 0; ch < c; ++ch)
+            taps[t*c + ch] = filter[t/k][t%k];
+    TensorLayout kept[] = { NHWC, NHWC, NCHWc };
+    for (int l = 0; l < 3; ++l) {
+        ImageTensor out = depthwise.convolve(planar.to(layouts[l], 4), taps);
+        if (out.layout() != kept[l])
+            return -1;
+        for (int b = 0; b < 2; ++b)
+            for (int ch = 0; ch < c; ++ch)
+                for (int x = 0; x < n; ++x)
+                    for (int y = 0; y < n; ++y)
+                        if (!floatCompare(ref.at(b, ch, x, y),
+                                          out.at(b, ch, x, y)))
+                            return -1;
+    }
+    return 0;
+}
+
+/** Check prepared plans of every engine
+ * @param vector<vector<float>>& img input matrix image
+ * @param vector<vector<float>>& filter input matrix filter
+ * @param vector<vector<float>>& expected output for img and filter
+ * @return int status is 0 if every execution matches
+ */
+int
+UnitTest::testPlanConv2D(vector<vector<float>>& img,
+                         vector<vector<float>>& filter,
+                         vector<vector<float>>& expected)
+{
+    PlanEngine engines[] = { PLAN_AUTO, PLAN_DIRECT, PLAN_GEMM };
+    for (int e = 0; e < 3; ++e) {
+        PlanOptions options;
+        options.engine = engines[e];
+        ConvolutionPlan plan(img.size(), filter, options);
+        if (plan.engine() == PLAN_AUTO)
+            return -1;
+        vector<vector<float>> out = plan.execute(img);
+        if (compareOutImages(expected, out) != 0)
+            return -1;
+        size_t bytes = plan.bytes();
+
+        // more threads than pooled workspaces
+        vector<int> status(4, 0);
+        vector<thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.push_back(thread([&, t] () {
+                for (int r = 0; r < 3; ++r) {
+                    vector<vector<float>> mine = plan.execute(img);
+                    for (size_t x = 0; x < mine.size(); ++x)
+                        if (mine[x] != out[x])
+                            status[t] = -1;
+                }
+            }));
+        }
+        for (int t = 0; t < 4; ++t) {
+            threads[t].join();
+            if (status[t] != 0)
+                return -1;
+        }
+        // the extra workspaces were not kept
+        if (plan.bytes() != bytes)
+            return -1;
+    }
+    return 0;
+}
+
+/** Check cachedConvolve() and the counters of FilterCache
+ * @param vector<vector<float>>& img input matrix image
+ * @param vector<vector<float>>& filter input matrix filter
+ * @param vector<vector<float>>& expected output for img and filter
+ * @return int status is 0 if outputs and counters are as expected
+ */
+int
+UnitTest::testCacheConv2D(vector<vector<float>>& img,
+                          vector<vector<float>>& filter,
+                          vector<vector<float>>& expected)
+{
+    FilterCache& cache = FilterCache::instance();
+    cache.clear();
+    Convolution2D conv2d(img.size(), filter.size());
+    for (int r = 0; r < 2; ++r) {
+        vector<vector<float>> out = conv2d.cachedConvolve(img, filter);
+        if (compareOutImages(expected, out) != 0)
+            return -1;
+    }
+    FilterCacheStats stats = cache.stats();
+    if (stats.hits != 1 || stats.misses != 1 || stats.entries != 1 ||
+        stats.evictions != 0)
+        return -1;
+
+    // another filter pushes the first one out of a one-plan budget
+    size_t budget = cache.budget();
+    cache.setBudget(stats.bytes);
+    vector<vector<float>> other = conv2d.createRandFilter();
+    other[0][0] += 1;
+    conv2d.cachedConvolve(img, other);
+    stats = cache.stats();
+    bool evicted = stats.evictions == 1 && stats.entries == 1;
+    conv2d.cachedConvolve(img, filter);
+    stats = cache.stats();
+    evicted = evicted && stats.misses == 3 && stats.hits == 1;
+    cache.setBudget(budget);
+    cache.clear();
+
+    // the bytes accounted at insert still hold after concurrent calls
+    shared_ptr<const ConvolutionPlan> plan =
+        cache.get(img.size(), filter, PLAN_GEMM);
+    size_t held = cache.stats().bytes;
+    vector<thread> threads;
+    for (int t = 0; t < 4; ++t)
+        threads.push_back(thread([&] () { plan->execute(img); }));
+    for (int t = 0; t < 4; ++t)
+        threads[t].join();
+    bool fixed = held == plan->bytes();
+    cache.clear();
+
+    // an empty or ragged filter is refused before it is hashed
+    vector<vector<float>> empty;
+    vector<vector<float>> ragged = filter;
+    ragged.back().push_back(0);
+    vector<vector<float>>* refused[] = { &empty, &ragged };
+    for (int f = 0; f < 2; ++f) {
+        try {
+            cache.get(img.size(), *refused[f], PLAN_AUTO);
+            return -1;
+        } catch (runtime_error&) {
+        }
+    }
+    return evicted && fixed ? 0 : -1;
+}
+
+// utility function checking one integer pixel type against the float
+// path of the same plan
+template <typename Pixel>
+static
+int checkIntegerPlan(const ConvolutionPlan& plan, int n, unsigned range)
+{
+    vector<Pixel> pixels(n*n);
+    vector<float> widened(n*n), ref(n*n), out(n*n);
+    for (int i = 0; i < n*n; ++i) {
+        pixels[i] = Pixel(rand() % range);
+        widened[i] = pixels[i];
+    }
+    plan.execute(&widened[0], &ref[0]);
+    plan.execute(&pixels[0], &out[0]);
+    if (ref != out)
+        return -1;
+    vector<Pixel> saturated(n*n);
+    plan.execute(&pixels[0], &saturated[0]);
+    for (int i = 0; i < n*n; ++i) {
+        float v = floor(ref[i] + 0.5f);
+        float top = float(range - 1);
+        Pixel want = v >= top ? Pixel(top) : (v > 0 ? Pixel(v) : Pixel(0));
+        if (saturated[i] != want)
+            return -1;
+    }
+    return 0;
+}
+
+/** Check the uint8/uint16 plan inputs on both engines
+ * @param vector<vector<float>>& img input matrix image
+ * @param vector<vector<float>>& filter input matrix filter
+ * @param vector<vector<float>>& expected output for img and filter
+ * @return int status is 0 if all outputs match
+ */
+int
+UnitTest::testIntegerConv2D(vector<vector<float>>& img,
+                            vector<vector<float>>& filter,
+                            vector<vector<float>>& expected)
+{
+    int n = img.size();
+    // normalized copy keeps most outputs inside the pixel range
+    vector<vector<float>> normalized = filter;
+    float total = 0;
+    for (size_t i = 0; i < filter.size(); ++i)
+        for (size_t j = 0; j < filter.size(); ++j)
+            total += fabs(filter[i][j]);
+    for (size_t i = 0; i < filter.size() && total > 0; ++i)
+        for (size_t j = 0; j < filter.size(); ++j)
+            normalized[i][j] /= total;
+
+    PlanEngine engines[] = { PLAN_DIRECT, PLAN_GEMM };
+    vector<vector<float>>* filters[] = { &filter, &normalized };
+    for (int e = 0; e < 2; ++e) {
+        for (int f = 0; f < 2; ++f) {
+            PlanOptions options;
+            options.engine = engines[e];
+            ConvolutionPlan plan(n, *filters[f], options);
+            // the float path of the same plan against the fixture
+            vector<vector<float>> out = plan.execute(img);
+            if (f == 0 && compareOutImages(expected, out) != 0)
+                return -1;
+            if (checkIntegerPlan<uint8_t>(plan, n, 256) != 0 ||
+                checkIntegerPlan<uint16_t>(plan, n, 65536) != 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+/** Check the box, Gaussian and separable plan engines
+ * @param vector<vector<float>>& img input matrix image
+ * @param vector<vector<float>>& filter input matrix filter
+ * @param vector<vector<float>>& expected output for img and filter
+ * @return int status is 0 if engines and outputs are as expected
+ */
+int
+UnitTest::testBlurConv2D(vector<vector<float>>& img,
+                         vector<vector<float>>& filter,
+                         vector<vector<float>>& expected)
+{
+    int n = img.size();
+    // the file's filter on each exact engine that accepts it
+    PlanEngine exact[] = { PLAN_AUTO, PLAN_BOX, PLAN_SEPARABLE };
+    for (int e = 0; e < 3; ++e) {
+        PlanOptions fileOptions;
+        fileOptions.engine = exact[e];
+        shared_ptr<ConvolutionPlan> filePlan;
+        try {
+            filePlan = make_shared<ConvolutionPlan>(n, filter, fileOptions);
+        } catch (runtime_error&) {
+            continue;
+        }
+        vector<vector<float>> fileOut = filePlan->execute(img);
+        if (compareOutImages(expected, fileOut) != 0)
+            return -1;
+    }
+
+    int k = max(int(filter.size()), 3);
+    Convolution2D conv2d(n, k);
+
+    vector<vector<float>> box(k, vector<float>(k, 1.0f/(k*k)));
+    ConvolutionPlan boxPlan(n, box);
+    vector<vector<float>> ref = conv2d.convolve(img, box);
+    vector<vector<float>> out = boxPlan.execute(img);
+    if (boxPlan.engine() != PLAN_BOX || compareOutImages(ref, out) != 0 ||
+        checkIntegerPlan<uint8_t>(boxPlan, n, 256) != 0)
+        return -1;
+
+    vector<float> u(k), v(k);
+    vector<vector<float>> rankOne(k, vector<float>(k));
+    for (int i = 0; i < k; ++i) {
+        u[i] = rand()%10 - 4.5f;
+        v[i] = ((float)(rand()%10000))/10000;
+    }
+    for (int i = 0; i < k; ++i)
+        for (int j = 0; j < k; ++j)
+            rankOne[i][j] = u[i]*v[j];
+    ConvolutionPlan rankOnePlan(n, rankOne);
+    ref = conv2d.convolve(img, rankOne);
+    out = rankOnePlan.execute(img);
+    if (rankOnePlan.engine() != PLAN_SEPARABLE ||
+        compareOutImages(ref, out) != 0)
+        return -1;
+
+    // sigma 1.5 on 11x11 reaches past 3 sigma; the IIR deviates from
+    // the filter by at most tolerance*peak per tap, at any offset
+    int g = Convolution2D::MAX_FILTER_SIZE;
+    double sigma = 1.5, total = 0;
+    vector<vector<float>> gauss(g, vector<float>(g));
+    for (int i = 0; i < g; ++i)
+        for (int j = 0; j < g; ++j)
+            total += exp(-((i-g/2)*(i-g/2) + (j-g/2)*(j-g/2))/
+                         (2*sigma*sigma));
+    for (int i = 0; i < g; ++i)
+        for (int j = 0; j < g; ++j)
+            gauss[i][j] = exp(-((i-g/2)*(i-g/2) + (j-g/2)*(j-g/2))/
+                              (2*sigma*sigma))/total;
+    Convolution2D gaussConv(n, g);
+    ref = gaussConv.convolve(img, gauss);
+    PlanOptions options;
+    options.tolerance = 0.002;
+    ConvolutionPlan iir(n, gauss, options);
+    out = iir.execute(img);
+    double mass = 0;
+    for (int x = 0; x < n; ++x)
+        for (int y = 0; y < n; ++y)
+            mass += fabs(img[x][y]);
+    double bound = options.tolerance*gauss[g/2][g/2]*mass + 0.0001;
+    if (iir.engine() != PLAN_GAUSSIAN)
+        return -1;
+    for (int x = 0; x < n; ++x)
+        for (int y = 0; y < n; ++y)
+            if (fabs(out[x][y] - ref[x][y]) > bound)
+                return -1;
+    options.tolerance = 1e-6;
+    ConvolutionPlan tight(n, gauss, options);
+    out = tight.execute(img);
+    if (tight.engine() != PLAN_SEPARABLE || compareOutImages(ref, out) != 0)
+        return -1;
+
+    // an explicit engine refuses a filter it cannot run
+    options.engine = PLAN_BOX;
+    options.tolerance = 0;
+    try {
+        ConvolutionPlan wrong(n, rankOne, options);
+        return -1;
+    } catch (runtime_error&) {
+    }
+    return 0;
+}
+
+/** Test the shared-memory daemon
+ * @param vector<vector<float>>& img input matrix image
+ * @param vector<vector<float>>& filter input matrix filter
+ * @param vector<vector<float>>& expected output for img and filter
+ * @return int status is 0 if every client request matches expected
+ */
+int
+UnitTest::testDaemonConv2D(vector<vector<float>>& img,
+                           vector<vector<float>>& filter,
+                           vector<vector<float>>& expected)
+{
+    // fewer slots than requests in flight, so clients also sleep on
+    // the free counter
+    string name = "/conv2d-test-" + to_string(getpid());
+    ConvolutionDaemon daemon(name, 2, 2);
+    const int clients = 3;
+    const int requests = 4;
+    vector<int> status(clients, 0);
+    vector<thread> threads;
+    for (int c = 0; c < clients; ++c) {
+        threads.push_back(thread([&, c] () {
+            try {
+                ConvolutionClient client(name);
+                for (int r = 0; r < requests; ++r) {
+                    vector<vector<float>> out = client.convolve(img, filter);
+                    if (compareOutImages(expected, out) != 0)
+                        status[c] = -1;
+                }
+            } catch (runtime_error&) {
+                status[c] = -1;
+            }
+        }));
+    }
+    for (int c = 0; c < clients; ++c)
+        threads[c].join();
+    for (int c = 0; c < clients; ++c)
+        if (status[c] != 0)
+            return -1;
+
+    // a completed slot is submitted again without rewriting it
+    int n = img.size();
+    ConvolutionClient client(name);
+    int slot = client.acquire(n, filter.size());
+    for (size_t i = 0; i < filter.size(); ++i)
+        copy(filter[i].begin(), filter[i].end(),
+             client.filter(slot) + i*filter.size());
+    for (int i = 0; i < n; ++i)
+        copy(img[i].begin(), img[i].end(), client.image(slot) + i*n);
+    for (int r = 0; r < 2; ++r) {
+        client.submit(slot);
+        if (client.wait(slot) != 0)
+            return -1;
+        vector<vector<float>> out;
+        for (int i = 0; i < n; ++i)
+            out.push_back(vector<float>(client.output(slot) + i*n,
+                                        client.output(slot) + (i+1)*n));
+        if (compareOutImages(expected, out) != 0)
+            return -1;
+    }
+    client.release(slot);
+    if (daemon.completed() != clients*requests + 2 ||
+        daemon.batches() > daemon.completed())
+        return -1;
+
+    // a second daemon cannot take the name over
+    try {
+        ConvolutionDaemon second(name, 2, 1);
+        return -1;
+    } catch (runtime_error&) {
+    }
+
+    // a client that dies holding every slot does not exhaust the ring
+    pid_t child = fork();
+    if (child == 0) {
+        client.acquire(n, filter.size());
+        client.acquire(n, filter.size());
+        _exit(0);
+    }
+    int childStatus = 0;
+    if (child < 0 || waitpid(child, &childStatus, 0) != child)
+        return -1;
+    vector<vector<float>> out = client.convolve(img, filter);
+    if (compareOutImages(expected, out) != 0)
+        return -1;
+
+    // a daemon killed with a request in flight fails the wait; it is
+    // stopped before serving, so the request cannot complete first
+    string killedName = name + "-killed";
+    pid_t server = fork();
+    if (server == 0) {
+        ConvolutionDaemon killed(killedName, 1, 1);
+        raise(SIGSTOP);
+        _exit(0);
+    }
+    if (server < 0 || waitpid(server, &childStatus, WUNTRACED) != server)
+        return -1;
+    int lost = 0;
+    {
+        ConvolutionClient orphan(killedName);
+        int pending = orphan.acquire(n, filter.size());
+        orphan.submit(pending);
+        kill(server, SIGKILL);
+        waitpid(server, &childStatus, 0);
+        lost = orphan.wait(pending);
+        orphan.release(pending);
+    }
+    shm_unlink(killedName.c_str());
+    return lost == -1 ? 0 : -1;
+}
+
+/** Test the JIT engine
+ * @param vector<vector<float>>& img input matrix image
+ * @param vector<vector<float>>& filter input matrix filter
+ * @param vector<vector<float>>& expected output for img and filter
+ * @return int status is 0 if every kernel matches expected
+ */
+int
+UnitTest::testJitConv2D(vector<vector<float>>& img,
+                        vector<vector<float>>& filter,
+                        vector<vector<float>>& expected)
+{
+    int n = img.size();
+    int k = filter.size();
+    JitIsa best = JitConvolution2D::detectIsa();
+    for (int isa = JIT_ISA_NONE; isa <= best; ++isa) {
+        JitConvolution2D jit(n, k, 1, JIT_EPILOGUE_NONE, JitIsa(isa));
+        vector<vector<float>> out = jit.convolve(img, filter);
+        if (jit.jitted() != (isa != JIT_ISA_NONE) ||
+            compareOutImages(expected, out) != 0)
+            return -1;
+    }
+
+    // strides 2 and 3 with ReLU against the subsampled output
+    for (int stride = 2; stride <= 3; ++stride) {
+        JitConvolution2D jit(n, k, stride, JIT_EPILOGUE_RELU);
+        vector<vector<float>> out = jit.convolve(img, filter);
+        vector<vector<float>> ref(jit.outSize(),
+                                  vector<float>(jit.outSize()));
+        for (int x = 0; x < jit.outSize(); ++x)
+            for (int y = 0; y < jit.outSize(); ++y)
+                ref[x][y] = max(expected[x*stride][y*stride], 0.0f);
+        if (compareOutImages(ref, out) != 0)
+            return -1;
+    }
+
+    // a second engine of the same shape and filter reuses the kernel
+    JitConvolution2D first(n, k);
+    vector<vector<float>> out = first.convolve(img, filter);
+    size_t kernels = JitConvolution2D::cachedKernels();
+    JitConvolution2D second(n, k);
+    out = second.convolve(img, filter);
+    if (JitConvolution2D::cachedKernels() != kernels ||
+        compareOutImages(expected, out) != 0)
+        return -1;
+    return 0;
+}
+
+/** Test the morphological and rank filters
+ * @param vector<vector<float>>& img input matrix image
+ * @param int windowSize side of the window of the file
+ * @return int status is 0 if every filter matches a sort of each window
+ */
+int
+UnitTest::testMorphConv2D(vector<vector<float>>& img, int windowSize)
+{
+    int n = img.size();
+    // the window of the file, and the largest one, on an image with
+    // repeated values so that ranks are shared
+    vector<vector<float>> coarse(img);
+    for (int x = 0; x < n; ++x)
+        for (int y = 0; y < n; ++y)
+            coarse[x][y] = floor(img[x][y]*4)/4;
+    int sizes[] = { windowSize, Convolution2D::MAX_FILTER_SIZE };
+    for (int s = 0; s < 2; ++s) {
+        int k = sizes[s];
+        int r = k/2;
+        MorphologyFilter2D morph(n, k);
+        for (int source = 0; source < 2; ++source) {
+            vector<vector<float>>& image = source == 0 ? img : coarse;
+            vector<vector<float>> eroded = morph.erode(image);
+            vector<vector<float>> dilated = morph.dilate(image);
+            vector<vector<float>> median = morph.median(image);
+            vector<float> window;
+            for (int x = 0; x < n; ++x) {
+                for (int y = 0; y < n; ++y) {
+                    window.clear();
+                    for (int i = x - r; i <= x + r; ++i)
+                        for (int j = y - r; j <= y + r; ++j)
+                            window.push_back(i < 0 || i >= n || j < 0 ||
+                                             j >= n ? 0 : image[i][j]);
+                    sort(window.begin(), window.end());
+                    if (eroded[x][y] != window.front() ||
+                        dilated[x][y] != window.back() ||
+                        median[x][y] != window[window.size()/2])
+                        return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/** Test the 3D engines
+ * @param vector<vector<float>>& img input matrix image
+ * @param vector<vector<float>>& filter input matrix filter
+ * @param vector<vector<float>>& expected output for img and filter
+ * @return int status is 0 if every engine matches the sum of 2D
+ *             convolutions
+ */
+int
+UnitTest::testVolumeConv2D(vector<vector<float>>& img,
+                           vector<vector<float>>& filter,
+                           vector<vector<float>>& expected)
+{
+    int n = img.size();
+    int k = filter.size();
+    int r = k/2;
+    Convolution2D conv2d(n, k);
+    vector<vector<vector<float>>> filter3d(k);
+    for (int dz = 0; dz < k; ++dz)
+        filter3d[dz] = dz == r ? filter : conv2d.createRandFilter();
+
+    // fewer slices than the filter and more, so that the window both
+    // leaves the volume on both sides and rolls through it
+    int depths[] = { 1, 2, 5 };
+    for (int d = 0; d < 3; ++d) {
+        int depth = depths[d];
+        vector<vector<vector<float>>> volume(depth);
+        for (int z = 0; z < depth; ++z)
+            volume[z] = z == depth/2 ? img : conv2d.createRandImage();
+
+        // reference: the k 2D convolutions per slice the engine replaces
+        vector<vector<vector<float>>> ref(depth,
+            vector<vector<float>>(n, vector<float>(n, 0)));
+        for (int z = 0; z < depth; ++z) {
+            for (int dz = 0; dz < k; ++dz) {
+                int zIn = z + dz - r;
+                if (zIn < 0 || zIn >= depth)
+                    continue;
+                vector<vector<float>> part =
+                    conv2d.convolve(volume[zIn], filter3d[dz]);
+                for (int x = 0; x < n; ++x)
+                    for (int y = 0; y < n; ++y)
+                        ref[z][x][y] += part[x][y];
+            }
+        }
+        for (int threads = 1; threads <= 3; threads += 2) {
+            Convolution3D conv3d(depth, n, k, threads);
+            vector<vector<vector<float>>> direct =
+                conv3d.convolve(volume, filter3d);
+            vector<vector<vector<float>>> gemm =
+                conv3d.gemmConvolve(volume, filter3d);
+            for (int z = 0; z < depth; ++z)
+                if (compareOutImages(ref[z], direct[z]) != 0 ||
+                    compareOutImages(ref[z], gemm[z]) != 0)
+                    return -1;
+            // a single slice only meets the middle filter slice
+            if (depth == 1 && (compareOutImages(expected, direct[0]) != 0 ||
+                               compareOutImages(expected, gemm[0]) != 0))
+                return -1;
+        }
+    }
+    return 0;
+}
+
 /** Create random image and filter and run 2D conv
  * @param int input image size
  * @param int input filter size
@@ -198,6 +1405,143 @@ UnitTest::testUnitFile(string testFile) {
             cout << "  FAST CONV2D PASS: (" << imgSize << "," 
                  << filterSize << ") " << testFile << endl;
         }
+        vector<float> flatImg, flatFilter;
+        for (int i = 0; i < imgSize; ++i)
+            flatImg.insert(flatImg.end(), img[i].begin(), img[i].end());
+        for (int i = 0; i < filterSize; ++i)
+            flatFilter.insert(flatFilter.end(), filter[i].begin(),
+                              filter[i].end());
+        vector<float> flatOut(imgSize*imgSize, 0);
+        conv2d.directConvolve(&flatImg[0], &flatFilter[0], &flatOut[0]);
+        vector<vector<float>> outImg4(imgSize, vector<float>(imgSize, 0));
+        for (int i = 0; i < imgSize; ++i)
+            copy_n(flatOut.begin() + i*imgSize, imgSize, outImg4[i].begin());
+        if(UnitTest::compareOutImages(outImg, outImg4) != 0) {
+            cout << "DIRECT CONV2D FAIL: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        } else {
+            cout << "DIRECT CONV2D PASS: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        }
+        if(UnitTest::testSparseConv2D(img, filter, outImg) != 0) {
+            cout << "SPARSE CONV2D FAIL: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        } else {
+            cout << "SPARSE CONV2D PASS: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        }
+        if(UnitTest::testExpressionConv2D(img, filter, outImg) != 0) {
+            cout << "  EXPR CONV2D FAIL: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        } else {
+            cout << "  EXPR CONV2D PASS: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        }
+        if(UnitTest::testSchedulerConv2D(img, filter, outImg) != 0) {
+            cout << " ASYNC CONV2D FAIL: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        } else {
+            cout << " ASYNC CONV2D PASS: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        }
+        if(UnitTest::testParallelConv2D(img, filter, outImg) != 0) {
+            cout << "  NUMA CONV2D FAIL: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        } else {
+            cout << "  NUMA CONV2D PASS: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        }
+        if(UnitTest::testOutOfCoreConv2D(img, filter, outImg) != 0) {
+            cout << "   OOC CONV2D FAIL: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        } else {
+            cout << "   OOC CONV2D PASS: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        }
+        if(UnitTest::testIncrementalConv2D(img, filter, outImg) != 0) {
+            cout << "  INCR CONV2D FAIL: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        } else {
+            cout << "  INCR CONV2D PASS: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        }
+        if(UnitTest::testGroupedConv2D(img, filter, outImg) != 0) {
+            cout << " GROUP CONV2D FAIL: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        } else {
+            cout << " GROUP CONV2D PASS: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        }
+        if(UnitTest::testLayoutConv2D(img, filter, outImg) != 0) {
+            cout << "LAYOUT CONV2D FAIL: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        } else {
+            cout << "LAYOUT CONV2D PASS: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        }
+        if(UnitTest::testPlanConv2D(img, filter, outImg) != 0) {
+            cout << "  PLAN CONV2D FAIL: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        } else {
+            cout << "  PLAN CONV2D PASS: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        }
+        if(UnitTest::testCacheConv2D(img, filter, outImg) != 0) {
+            cout << " CACHE CONV2D FAIL: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        } else {
+            cout << " CACHE CONV2D PASS: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        }
+        if(UnitTest::testIntegerConv2D(img, filter, outImg) != 0) {
+            cout << " UINT8 CONV2D FAIL: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        } else {
+            cout << " UINT8 CONV2D PASS: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        }
+        if(UnitTest::testBlurConv2D(img, filter, outImg) != 0) {
+            cout << "  BLUR CONV2D FAIL: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        } else {
+            cout << "  BLUR CONV2D PASS: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        }
+        if(UnitTest::testDaemonConv2D(img, filter, outImg) != 0) {
+            cout << "DAEMON CONV2D FAIL: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        } else {
+            cout << "DAEMON CONV2D PASS: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        }
+        if(UnitTest::testJitConv2D(img, filter, outImg) != 0) {
+            cout << "   JIT CONV2D FAIL: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        } else {
+            cout << "   JIT CONV2D PASS: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        }
+        if(UnitTest::testMorphConv2D(img, filterSize) != 0) {
+            cout << " MORPH CONV2D FAIL: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        } else {
+            cout << " MORPH CONV2D PASS: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        }
+        if(UnitTest::testVolumeConv2D(img, filter, outImg) != 0) {
+            cout << "VOLUME CONV2D FAIL: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        } else {
+            cout << "VOLUME CONV2D PASS: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        }
+        if(UnitTest::testBackwardConv2D(img, filter, outImg) != 0) {
+            cout << "  GRAD CONV2D FAIL: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        } else {
+            cout << "  GRAD CONV2D PASS: (" << imgSize << "," 
+                 << filterSize << ") " << testFile << endl;
+        }
     } catch (...) {
         cerr << "Could not parse the file - " << testFile << endl;
         my_file.close();
@@ -0,0 +1,79 @@
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * main method of the convolution daemon
+ */
+#include "ConvolutionDaemon.hpp"
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <csignal>
+#include <unistd.h>
+using namespace std;
+
+static
+void printArgs() {
+    cout << "Serve convolutions over a shared-memory ring until SIGINT/SIGTERM"
+         << endl;
+    cout << "$ conv2dd [-name </shm-name>] [-slots <count>] [-threads <count>]"
+         << endl;
+}
+
+int main(int argc, char* argv[]) {
+    string name = ConvolutionDaemon::DEFAULT_NAME;
+    int slots = 64;
+    int threads = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 >= argc) {
+            printArgs();
+            return EXIT_FAILURE;
+        }
+        if (strcmp(argv[i], "-name") == 0) {
+            name = argv[++i];
+        } else if (strcmp(argv[i], "-slots") == 0) {
+            slots = stoi(argv[++i]);
+        } else if (strcmp(argv[i], "-threads") == 0) {
+            threads = stoi(argv[++i]);
+        } else {
+            printArgs();
+            return EXIT_FAILURE;
+        }
+    }
+    if (slots <= 0) {
+        printArgs();
+        return EXIT_FAILURE;
+    }
+
+    // the workers inherit the blocked mask, so only main sees the signals
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    try {
+        ConvolutionDaemon daemon(name, slots, threads);
+        cout << "conv2dd: serving " << name << " with " << slots << " slots"
+             << endl;
+        int signal = 0;
+        sigwait(&signals, &signal);
+        daemon.stop();
+        cout << "conv2dd: " << daemon.completed() << " requests in "
+             << daemon.batches() << " batches" << endl;
+    } catch (exception& e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
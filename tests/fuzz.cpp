@@ -0,0 +1,59 @@
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * main method for differential fuzz testing
+ */
+#include "FuzzTest.hpp"
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+using namespace std;
+
+static
+void printArgs() {
+    cout << "Compare every engine with a double precision reference" << endl;
+    cout << "$ fuzz [-n <cases>] [-start <seed>] [-threads <count>]" << endl;
+    cout << "Reproduce one failing case" << endl;
+    cout << "$ fuzz -seed <seed>" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    unsigned long long start = 1;
+    unsigned long long count = 1000;
+    int threads = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 >= argc) {
+            printArgs();
+            return EXIT_FAILURE;
+        }
+        if (strcmp(argv[i], "-seed") == 0) {
+            if (FuzzTest::runSeed(stoull(argv[i+1])) != 0)
+                return EXIT_FAILURE;
+            return EXIT_SUCCESS;
+        } else if (strcmp(argv[i], "-n") == 0) {
+            count = stoull(argv[++i]);
+        } else if (strcmp(argv[i], "-start") == 0) {
+            start = stoull(argv[++i]);
+        } else if (strcmp(argv[i], "-threads") == 0) {
+            threads = stoi(argv[++i]);
+        } else {
+            printArgs();
+            return EXIT_FAILURE;
+        }
+    }
+    if (FuzzTest::runRange(start, count, threads) != 0)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
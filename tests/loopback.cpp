@@ -0,0 +1,162 @@
+/*
+ * This file is part of the github distribution (https://github.com/sdbma).
+ * Copyright (c) 2021 Shomit Dutta.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License <http://www.gnu.org/licenses/> for more details.
+ *
+ * loopback benchmark of the convolution daemon
+ */
+#include "ConvolutionDaemon.hpp"
+#include "ConvolutionClient.hpp"
+#include "Convolution2D.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <chrono>
+#include <random>
+#include <csignal>
+#include <unistd.h>
+#include <sys/wait.h>
+using namespace std;
+
+static
+void printArgs() {
+    cout << "Time requests through a forked daemon against in-process calls"
+         << endl;
+    cout << "$ loopback [-n <imgSize>] [-k <filterSize>] [-iter <count>]"
+         << endl;
+}
+
+// utility function timing a callable in microseconds per call
+template <typename Call>
+static
+double timeCalls(int iterations, Call call)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        call();
+    chrono::duration<double, micro> elapsed =
+        chrono::steady_clock::now() - start;
+    return elapsed.count()/iterations;
+}
+
+int main(int argc, char* argv[]) {
+    int n = 64;
+    int k = 5;
+    int iterations = 2000;
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 >= argc) {
+            printArgs();
+            return EXIT_FAILURE;
+        }
+        if (strcmp(argv[i], "-n") == 0) {
+            n = stoi(argv[++i]);
+        } else if (strcmp(argv[i], "-k") == 0) {
+            k = stoi(argv[++i]);
+        } else if (strcmp(argv[i], "-iter") == 0) {
+            iterations = stoi(argv[++i]);
+        } else {
+            printArgs();
+            return EXIT_FAILURE;
+        }
+    }
+
+    string name = "/conv2d-loopback-" + to_string(getpid());
+    int ready[2];
+    if (pipe(ready) != 0)
+        return EXIT_FAILURE;
+    pid_t child = fork();
+    if (child < 0)
+        return EXIT_FAILURE;
+    if (child == 0) {
+        close(ready[0]);
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, NULL);
+        {
+            // the destructor removes the shared memory object
+            ConvolutionDaemon daemon(name, 16, 1);
+            char byte = 1;
+            if (write(ready[1], &byte, 1) == 1) {
+                int signal = 0;
+                sigwait(&signals, &signal);
+            }
+        }
+        _exit(EXIT_SUCCESS);
+    }
+    close(ready[1]);
+    char byte = 0;
+    if (read(ready[0], &byte, 1) != 1) {
+        cerr << "daemon failed to start" << endl;
+        return EXIT_FAILURE;
+    }
+
+    mt19937 gen(7);
+    uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    vector<vector<float>> image(n, vector<float>(n));
+    vector<vector<float>> filter(k, vector<float>(k));
+    for (int i = 0; i < n; ++i)
+        for (int j = 0; j < n; ++j)
+            image[i][j] = dist(gen);
+    for (int i = 0; i < k; ++i)
+        for (int j = 0; j < k; ++j)
+            filter[i][j] = dist(gen);
+
+    int status = EXIT_SUCCESS;
+    try {
+        ConvolutionClient client(name);
+        Convolution2D conv2d(n, k);
+        vector<vector<float>> expected = conv2d.convolve(image, filter);
+        vector<vector<float>> result = client.convolve(image, filter);
+        for (int i = 0; i < n; ++i)
+            for (int j = 0; j < n; ++j)
+                if (fabs(expected[i][j] - result[i][j]) > 0.001f)
+                    status = EXIT_FAILURE;
+        if (status != EXIT_SUCCESS)
+            cerr << "daemon result differs" << endl;
+
+        // zero copy: the image is written once into the slot and the
+        // slot is resubmitted, so only signaling and compute are timed
+        int slot = client.acquire(n, k);
+        for (int i = 0; i < k; ++i)
+            copy(filter[i].begin(), filter[i].end(), client.filter(slot) + i*k);
+        for (int i = 0; i < n; ++i)
+            copy(image[i].begin(), image[i].end(), client.image(slot) + i*n);
+        double local = timeCalls(iterations, [&] () {
+            conv2d.cachedConvolve(image, filter);
+        });
+        double copying = timeCalls(iterations, [&] () {
+            client.convolve(image, filter);
+        });
+        double ring = timeCalls(iterations, [&] () {
+            client.submit(slot);
+            client.wait(slot);
+        });
+        client.release(slot);
+        cout << fixed << setprecision(2);
+        cout << "image " << n << "x" << n << " filter " << k << "x" << k
+             << ", " << iterations << " calls" << endl;
+        cout << "  in-process cachedConvolve: " << local << " us/call" << endl;
+        cout << "  daemon convolve (copies)  : " << copying << " us/call"
+             << endl;
+        cout << "  daemon slot resubmit      : " << ring << " us/call" << endl;
+    } catch (exception& e) {
+        cerr << e.what() << endl;
+        status = EXIT_FAILURE;
+    }
+    kill(child, SIGTERM);
+    waitpid(child, NULL, 0);
+    return status;
+}
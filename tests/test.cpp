@@ -29,6 +29,7 @@ void printArgs() {
     cout << "$ unittest <test1.txt>" << endl;
     cout << "$ unittest -f <test1.list>" << endl;
     cout << "$ unittest -rand <imgSize> <filterSize>" << endl;
+    cout << "$ unittest -bench <imgSize> <filterSize> <iterations>" << endl;
 }
 
 int main(int argc, char* argv[]) {
@@ -66,6 +67,18 @@ int main(int argc, char* argv[]) {
             return EXIT_FAILURE;
         else
             return EXIT_SUCCESS;
+    } else if(strcmp(argv[1], "-bench") == 0) {
+        if (argc < 5) {
+            printArgs();
+            return EXIT_FAILURE;
+        }
+        int i = stoi(argv[2]);
+        int j = stoi(argv[3]);
+        int k = stoi(argv[4]);
+        if(UnitTest::benchConv2D(i, j, k) != 0)
+            return EXIT_FAILURE;
+        else
+            return EXIT_SUCCESS;
     } else {
         // only one test
         string test(argv[1]);